@@ -28,6 +28,8 @@ class API;
 #define SUPHP_API_H
 
 #include <string>
+#include <utility>
+#include <vector>
 #include "CommandLine.hpp"
 #include "Environment.hpp"
 #include "File.hpp"
@@ -132,6 +134,11 @@ class API {
    */
   virtual bool File_exists(const File& file) const = 0;
 
+  /**
+   * Returns identity (device, inode, mtime, size) of file
+   */
+  virtual FileIdentity File_getIdentity(const File& file) const = 0;
+
   /**
    * Returns real path to file
    */
@@ -157,6 +164,38 @@ class API {
    */
   virtual bool File_isSymlink(const File& file) const = 0;
 
+  /**
+   * Checks whether a file is a directory (symlinks are not followed)
+   */
+  virtual bool File_isDirectory(const File& file) const = 0;
+
+  /**
+   * Returns names of the entries of a directory (sorted, without "." and
+   * "..")
+   */
+  virtual std::vector<std::string> File_getDirectoryEntries(
+      const File& file) const = 0;
+
+  /**
+   * Opens file for reading. The descriptor is kept open across execute().
+   */
+  virtual int File_open(const File& file) const = 0;
+
+  /**
+   * Returns identity of the file an open descriptor refers to
+   */
+  virtual FileIdentity getDescriptorIdentity(int fd) const = 0;
+
+  /**
+   * Returns path of the file an open descriptor refers to
+   */
+  virtual std::string getDescriptorPath(int fd) const = 0;
+
+  /**
+   * Closes an open descriptor
+   */
+  virtual void closeDescriptor(int fd) const = 0;
+
   /**
    * Runs another program (replaces current process)
    */
@@ -182,6 +221,16 @@ class API {
    * Changes root directory for the current process
    */
   virtual void chroot(const std::string& dir) const = 0;
+
+  /**
+   * Moves the current process into the cgroup dir. If dir does not
+   * exist, it is created with the (file, value) pairs of settings
+   * written to it before it appears under its name.
+   */
+  virtual void joinCgroup(
+      const std::string& dir,
+      const std::vector<std::pair<std::string, std::string> >& settings)
+      const = 0;
 };
 }  // namespace suPHP
 
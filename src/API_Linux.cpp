@@ -19,12 +19,17 @@
   51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
 */
 
+#include <algorithm>
 #include <iostream>
 #include <string>
+#include <vector>
 
+#include <dirent.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <grp.h>
 #include <pwd.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/stat.h>
@@ -72,6 +77,19 @@ std::string suPHP::API_Linux::readSymlink(const std::string path) const {
   }
 }
 
+void suPHP::API_Linux::writeFile(const std::string& path,
+                                 const std::string& value) const {
+  int fd = ::open(path.c_str(), O_WRONLY | O_CLOEXEC);
+  if (fd == -1 || ::write(fd, value.data(), value.length()) == -1) {
+    int err = errno;
+    if (fd != -1) ::close(fd);
+    throw SystemException(std::string("Could not write \"") + value +
+                              "\" to \"" + path + "\": " + ::strerror(err),
+                          __FILE__, __LINE__);
+  }
+  ::close(fd);
+}
+
 Environment suPHP::API_Linux::getProcessEnvironment() {
   Environment env;
   char** entry = ::environ;
@@ -226,6 +244,22 @@ bool suPHP::API_Linux::File_exists(const File& file) const {
     return false;
 }
 
+FileIdentity suPHP::API_Linux::File_getIdentity(const File& file) const {
+  struct stat temp;
+  FileIdentity identity;
+  if (::stat(file.getPath().c_str(), &temp) == -1) {
+    throw SystemException(std::string("Could not stat \"") + file.getPath() +
+                              "\": " + ::strerror(errno),
+                          __FILE__, __LINE__);
+  }
+  identity.device = temp.st_dev;
+  identity.inode = temp.st_ino;
+  identity.mtime = temp.st_mtim.tv_sec;
+  identity.mtime_nsec = temp.st_mtim.tv_nsec;
+  identity.size = temp.st_size;
+  return identity;
+}
+
 std::string suPHP::API_Linux::File_getRealPath(const File& file) const {
   std::string currentpath = file.getPath();
   std::string resolvedpath = "";
@@ -361,6 +395,76 @@ bool suPHP::API_Linux::File_isSymlink(const File& file) const {
   return this->isSymlink(file.getPath());
 }
 
+bool suPHP::API_Linux::File_isDirectory(const File& file) const {
+  struct stat temp;
+  if (::lstat(file.getPath().c_str(), &temp) == -1) {
+    throw SystemException(std::string("Could not stat \"") + file.getPath() +
+                              "\": " + ::strerror(errno),
+                          __FILE__, __LINE__);
+  }
+  return S_ISDIR(temp.st_mode);
+}
+
+std::vector<std::string> suPHP::API_Linux::File_getDirectoryEntries(
+    const File& file) const {
+  std::vector<std::string> entries;
+  DIR* dir = ::opendir(file.getPath().c_str());
+  if (dir == NULL) {
+    throw SystemException(std::string("Could not open directory \"") +
+                              file.getPath() + "\": " + ::strerror(errno),
+                          __FILE__, __LINE__);
+  }
+  struct dirent* entry;
+  while ((entry = ::readdir(dir)) != NULL) {
+    std::string name = entry->d_name;
+    if (name != "." && name != "..") {
+      entries.push_back(name);
+    }
+  }
+  ::closedir(dir);
+  std::sort(entries.begin(), entries.end());
+  return entries;
+}
+
+int suPHP::API_Linux::File_open(const File& file) const {
+  int fd = ::open(file.getPath().c_str(), O_RDONLY | O_NOFOLLOW | O_NOCTTY);
+  if (fd == -1) {
+    throw SystemException(std::string("Could not open \"") + file.getPath() +
+                              "\": " + ::strerror(errno),
+                          __FILE__, __LINE__);
+  }
+  return fd;
+}
+
+FileIdentity suPHP::API_Linux::getDescriptorIdentity(int fd) const {
+  struct stat temp;
+  FileIdentity identity;
+  if (::fstat(fd, &temp) == -1) {
+    throw SystemException(std::string("Could not stat descriptor ") +
+                              Util::intToStr(fd) + ": " + ::strerror(errno),
+                          __FILE__, __LINE__);
+  }
+  identity.device = temp.st_dev;
+  identity.inode = temp.st_ino;
+  identity.mtime = temp.st_mtim.tv_sec;
+  identity.mtime_nsec = temp.st_mtim.tv_nsec;
+  identity.size = temp.st_size;
+  return identity;
+}
+
+std::string suPHP::API_Linux::getDescriptorPath(int fd) const {
+  // The kernel keeps the resolved path, so no component has to be looked up
+  std::string path = this->readSymlink("/proc/self/fd/" + Util::intToStr(fd));
+  if (path.empty() || path[0] != '/') {
+    throw SystemException("Descriptor " + Util::intToStr(fd) +
+                              " does not refer to a file: " + path,
+                          __FILE__, __LINE__);
+  }
+  return path;
+}
+
+void suPHP::API_Linux::closeDescriptor(int fd) const { ::close(fd); }
+
 void suPHP::API_Linux::execute(std::string program, const CommandLine& cline,
                                const Environment& env) const {
   char** sysCline = NULL;
@@ -431,3 +535,53 @@ void suPHP::API_Linux::chroot(const std::string& dir) const {
                           __FILE__, __LINE__);
   }
 }
+
+void suPHP::API_Linux::joinCgroup(
+    const std::string& dir,
+    const std::vector<std::pair<std::string, std::string> >& settings) const {
+  std::vector<std::pair<std::string, std::string> >::const_iterator i;
+
+  // The controllers of the settings have to be enabled for the children
+  // of the parent before their files show up in the cgroup. This is done
+  // on every use, so a cgroup created by a request that failed or is
+  // still setting it up gets them as well.
+  std::string parent = dir.substr(0, dir.find_last_of('/'));
+  for (i = settings.begin(); i != settings.end(); i++) {
+    this->writeFile(parent + "/cgroup.subtree_control",
+                    "+" + i->first.substr(0, i->first.find('.')));
+  }
+
+  // The cgroup is set up under a name of its own and renamed into place,
+  // so no process can join it before the settings are written. Of two
+  // requests doing this at once, the second one fails to rename its
+  // cgroup and joins the first one.
+  struct stat st;
+  if (::stat(dir.c_str(), &st) == -1) {
+    std::string temp = dir + ".new." + Util::intToStr(::getpid());
+    if (::mkdir(temp.c_str(), 0755) == -1) {
+      throw SystemException(std::string("Could not create cgroup \"") +
+                                temp + "\": " + ::strerror(errno),
+                            __FILE__, __LINE__);
+    }
+    try {
+      for (i = settings.begin(); i != settings.end(); i++) {
+        this->writeFile(temp + "/" + i->first, i->second);
+      }
+    } catch (SystemException&) {
+      ::rmdir(temp.c_str());
+      throw;
+    }
+    if (::rename(temp.c_str(), dir.c_str()) == -1) {
+      int error = errno;
+      ::rmdir(temp.c_str());
+      if (error != EEXIST && error != ENOTEMPTY) {
+        throw SystemException(std::string("Could not create cgroup \"") +
+                                  dir + "\": " + ::strerror(error),
+                              __FILE__, __LINE__);
+      }
+    }
+  }
+
+  // Writing 0 moves the writing process
+  this->writeFile(dir + "/cgroup.procs", "0");
+}
@@ -23,6 +23,7 @@
 #define SUPHP_API_LINUX_H
 
 #include <string>
+#include <vector>
 
 #include "API.hpp"
 #include "API_Linux_Logger.hpp"
@@ -46,6 +47,11 @@ class API_Linux : public API {
    */
   std::string readSymlink(const std::string path) const;
 
+  /**
+   * Internal function to write value to the existing file path
+   */
+  void writeFile(const std::string& path, const std::string& value) const;
+
  public:
   /**
    * Get environment variable
@@ -134,6 +140,11 @@ class API_Linux : public API {
    */
   virtual bool File_exists(const File& file) const;
 
+  /**
+   * Returns identity (device, inode, mtime, size) of file
+   */
+  virtual FileIdentity File_getIdentity(const File& file) const;
+
   /**
    * Returns real path to file
    */
@@ -159,6 +170,38 @@ class API_Linux : public API {
    */
   virtual bool File_isSymlink(const File& file) const;
 
+  /**
+   * Checks whether a file is a directory (symlinks are not followed)
+   */
+  virtual bool File_isDirectory(const File& file) const;
+
+  /**
+   * Returns names of the entries of a directory (sorted, without "." and
+   * "..")
+   */
+  virtual std::vector<std::string> File_getDirectoryEntries(
+      const File& file) const;
+
+  /**
+   * Opens file for reading. The descriptor is kept open across execute().
+   */
+  virtual int File_open(const File& file) const;
+
+  /**
+   * Returns identity of the file an open descriptor refers to
+   */
+  virtual FileIdentity getDescriptorIdentity(int fd) const;
+
+  /**
+   * Returns path of the file an open descriptor refers to
+   */
+  virtual std::string getDescriptorPath(int fd) const;
+
+  /**
+   * Closes an open descriptor
+   */
+  virtual void closeDescriptor(int fd) const;
+
   /**
    * Runs another program (replaces current process)
    */
@@ -184,6 +227,16 @@ class API_Linux : public API {
    * Sets new root directory for current process
    */
   virtual void chroot(const std::string& dir) const;
+
+  /**
+   * Moves the current process into the cgroup dir. If dir does not
+   * exist, it is created with the (file, value) pairs of settings
+   * written to it before it appears under its name.
+   */
+  virtual void joinCgroup(
+      const std::string& dir,
+      const std::vector<std::pair<std::string, std::string> >& settings)
+      const;
 };
 }  // namespace suPHP
 
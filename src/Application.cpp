@@ -20,6 +20,8 @@
 */
 
 #include <iostream>
+#include <map>
+#include <mutex>
 
 #include "config.h"
 
@@ -33,6 +35,8 @@
 #include "GroupInfo.hpp"
 #include "Logger.hpp"
 #include "PathMatcher.hpp"
+#include "StageStatistics.hpp"
+#include "TreeWalker.hpp"
 #include "UserInfo.hpp"
 #include "Util.hpp"
 
@@ -40,12 +44,168 @@
 
 using namespace suPHP;
 
-suPHP::Application::Application() {
-  // do nothing
-}
+/**
+ * Visitor checking the directories for "suphp --index", once for the
+ * owner of each file in the directory
+ */
+class suPHP::Application::ScriptIndexer : public TreeVisitor {
+ private:
+  const Application& application;
+  const Configuration& config;
+  std::mutex mutex;
+  std::map<std::string, std::string> records;
+  int errors;
+
+ public:
+  ScriptIndexer(const Application& application, const Configuration& config)
+      : application(application), config(config), errors(0) {}
+
+  virtual void visitDirectory(const File& directory,
+                              const std::vector<File>& files,
+                              const std::vector<File>&) {
+    std::map<int, File> owners;
+    for (std::vector<File>::const_iterator i = files.begin();
+         i != files.end(); i++) {
+      try {
+        owners.insert(std::make_pair(i->getUser().getUid(), *i));
+      } catch (SystemException& e) {
+        // Removed while walking
+      }
+    }
+
+    for (std::map<int, File>::const_iterator i = owners.begin();
+         i != owners.end(); i++) {
+      UserInfo owner(i->first);
+      try {
+        // Taken before checking, so a change during the check makes the
+        // entry stale rather than wrong
+        std::string chain = ScriptIndex::getChain(directory);
+        if (this->application
+                .checkParentDirectories(i->second, owner, this->config)
+                .isRejected()) {
+          continue;
+        }
+        std::lock_guard<std::mutex> lock(this->mutex);
+        this->records[ScriptIndex::getKey(directory, owner, this->config)] =
+            chain;
+      } catch (Exception& e) {
+        // Also a file owned by a UID without passwd entry
+        this->visitError(directory, e);
+      }
+    }
+  }
+
+  virtual void visitError(const File& directory, Exception& e) {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    std::cerr << directory.getPath() << ": " << e.getMessage() << std::endl;
+    this->errors++;
+  }
+
+  const std::map<std::string, std::string>& getRecords() const {
+    return this->records;
+  }
+
+  int getErrors() const { return this->errors; }
+};
+
+/**
+ * Visitor checking the files for "suphp --audit" like the script files
+ * of requests, with the owner of the file as target user and the walked
+ * directory as DOCUMENT_ROOT. Files outside of the docroots cannot be
+ * executed and are left out.
+ */
+class suPHP::Application::ScriptAuditor : public TreeVisitor {
+ private:
+  const Application& application;
+  const Configuration& config;
+  std::vector<std::string> roots;
+  std::mutex mutex;
+  int refused;
+  int errors;
+
+  /**
+   * Returns the walked directory containing directory
+   */
+  std::string getRoot(const File& directory) const {
+    std::string root;
+    for (std::vector<std::string>::const_iterator i = this->roots.begin();
+         i != this->roots.end(); i++) {
+      if (directory.getPath().compare(0, i->length(), *i) == 0 &&
+          i->length() > root.length()) {
+        root = *i;
+      }
+    }
+    return root;
+  }
+
+ public:
+  ScriptAuditor(const Application& application, const Configuration& config,
+                const std::vector<File>& roots)
+      : application(application),
+        config(config),
+        roots(),
+        refused(0),
+        errors(0) {
+    for (std::vector<File>::const_iterator i = roots.begin();
+         i != roots.end(); i++) {
+      this->roots.push_back(i->getPath());
+    }
+  }
+
+  virtual void visitDirectory(const File& directory,
+                              const std::vector<File>& files,
+                              const std::vector<File>&) {
+    Environment env;
+    env.putVar("DOCUMENT_ROOT", this->getRoot(directory));
+    for (std::vector<File>::const_iterator i = files.begin();
+         i != files.end(); i++) {
+      try {
+        File realScriptFile(i->getRealPath());
+        Rejection rejection = this->application.checkScriptFileStage1(
+            *i, realScriptFile, this->config, env);
+        if (!rejection.isRejected()) {
+          rejection = this->application.checkScriptFileStage2(
+              *i, realScriptFile, this->config, env, i->getUser(),
+              i->getGroup());
+        }
+        if (!rejection.isRejected() ||
+            rejection.getReason() == REJECT_NOT_IN_DOCROOT) {
+          continue;
+        }
+        std::lock_guard<std::mutex> lock(this->mutex);
+        std::cout << i->getPath() << ": "
+                  << Rejection::getReasonName(rejection.getReason()) << ": "
+                  << rejection.getMessage() << std::endl;
+        this->refused++;
+      } catch (SystemException& e) {
+        // Removed while walking
+      } catch (Exception& e) {
+        // Such as a file or directory owned by a deleted account, which
+        // suphp could not run either
+        std::lock_guard<std::mutex> lock(this->mutex);
+        std::cout << i->getPath() << ": error: " << e.getMessage()
+                  << std::endl;
+        this->refused++;
+      }
+    }
+  }
+
+  virtual void visitError(const File& directory, Exception& e) {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    std::cerr << directory.getPath() << ": " << e.getMessage() << std::endl;
+    this->errors++;
+  }
+
+  int getRefused() const { return this->refused; }
+
+  int getErrors() const { return this->errors; }
+};
+
+suPHP::Application::Application() : scriptIndex() {}
 
 int suPHP::Application::run(CommandLine& cmdline, const Environment& env) {
   Configuration config;
+  StageStatistics statistics;
   API& api = API_Helper::getSystemAPI();
   Logger& logger = api.getSystemLogger();
 
@@ -67,10 +227,10 @@ int suPHP::Application::run(CommandLine& cmdline, const Environment& env) {
     UserInfo targetUser;
     GroupInfo targetGroup;
 
-    // If caller is super-user, print info message and exit
+    // If caller is super-user, handle admin options or print info message
+    // and exit
     if (api.getRealProcessUser().isSuperUser()) {
-      this->printAboutMessage();
-      return 0;
+      return this->runAdminCommand(cmdline, cfgFile);
     }
     config.readFromFile(cfgFile);
 
@@ -82,27 +242,57 @@ int suPHP::Application::run(CommandLine& cmdline, const Environment& env) {
     // logging anyway
     logger.init(config);
 
-    try {
-      scriptFilename = env.getVar("SCRIPT_FILENAME");
-    } catch (KeyNotFoundException& e) {
+    this->attachStageStatistics(config, statistics);
+    this->publishPolicy(cfgFile, config, statistics);
+    this->openScriptIndex(config);
+    statistics.endStage(STAGE_CONFIG);
+
+    if (!env.hasVar("SCRIPT_FILENAME")) {
       logger.logError("Environment variable SCRIPT_FILENAME not set");
       this->printAboutMessage();
       return 1;
     }
+    scriptFilename = env.getVar("SCRIPT_FILENAME");
 
     File scriptFile(scriptFilename);
-    File realScriptFile(scriptFile.getRealPath());
+    File realScriptFile(env.hasVar("SUPHP_SCRIPT_FD")
+                            ? this->getScriptDescriptorPath(scriptFile, env)
+                            : scriptFile.getRealPath());
 
     // Do checks that do not need target user info
-    this->checkScriptFileStage1(scriptFile, realScriptFile, config, env);
+    Rejection rejection =
+        this->checkScriptFileStage1(scriptFile, realScriptFile, config, env);
+    if (rejection.isRejected()) {
+      return this->refuse(rejection, config, env, statistics);
+    }
+
+    // The script passed as descriptor must be the file that is checked
+    FileIdentity scriptIdentity;
+    if (config.getScriptDescriptor()) {
+      scriptIdentity = realScriptFile.getIdentity();
+    }
 
     // Find out target user
-    this->checkProcessPermissions(scriptFile, realScriptFile, config, env,
-                                  targetUser, targetGroup);
+    rejection = this->checkProcessPermissions(
+        scriptFile, realScriptFile, config, env, targetUser, targetGroup);
+    if (rejection.isRejected()) {
+      return this->refuse(rejection, config, env, statistics);
+    }
+
+    // Settings for the target user or vhost replace the global ones
+    config.applyOverrides(targetUser, env.getVar("DOCUMENT_ROOT"));
 
     // Now do checks that might require user info
-    this->checkScriptFileStage2(scriptFile, realScriptFile, config, env,
-                                targetUser, targetGroup);
+    rejection = this->checkScriptFileStage2(scriptFile, realScriptFile, config,
+                                            env, targetUser, targetGroup);
+    if (rejection.isRejected()) {
+      return this->refuse(rejection, config, env, statistics);
+    }
+    statistics.endStage(STAGE_VALIDATION);
+
+    // The cgroup file system is outside of the chroot and can only be
+    // written by the super-user
+    this->joinCgroup(config, targetUser);
 
     // Root privileges are needed for chroot()
     // so do this before changing process permissions
@@ -127,10 +317,23 @@ int suPHP::Application::run(CommandLine& cmdline, const Environment& env) {
       newEnv.putVar("PHPRC", phprc_path);
     }
 
+    // Let the interpreter read the checked file instead of looking up
+    // the path again
+    std::string scriptPath = scriptFilename;
+    if (config.getScriptDescriptor() && targetMode == TARGETMODE_PHP) {
+      rejection = this->openScriptDescriptor(realScriptFile, scriptIdentity,
+                                             scriptPath);
+      if (rejection.isRejected()) {
+        return this->refuse(rejection, config, env, statistics);
+      }
+      newEnv.putVar("ORIG_SCRIPT_FILENAME", scriptFilename);
+      newEnv.setVar("SCRIPT_FILENAME", scriptPath);
+    }
+
     // Set PATH_TRANSLATED to SCRIPT_FILENAME, otherwise
     // the PHP interpreter will not be able to find the script
     if (targetMode == TARGETMODE_PHP && newEnv.hasVar("PATH_TRANSLATED")) {
-      newEnv.setVar("PATH_TRANSLATED", scriptFilename);
+      newEnv.setVar("PATH_TRANSLATED", scriptPath);
     }
 
     // Log attempt to execute script
@@ -139,6 +342,8 @@ int suPHP::Application::run(CommandLine& cmdline, const Environment& env) {
                    ", GID " +
                    Util::intToStr(api.getEffectiveProcessGroup().getGid()));
 
+    // The mapping is still writable after changing process permissions
+    statistics.endStage(STAGE_EXEC);
     this->executeScript(scriptFilename, interpreter, targetMode, newEnv,
                         config);
 
@@ -146,27 +351,31 @@ int suPHP::Application::run(CommandLine& cmdline, const Environment& env) {
     // So, if we get here, return with error code
     return 1;
   } catch (SoftException& e) {
-    if (!config.getErrorsToBrowser()) {
-      std::cerr << e;
-      return 2;
-    }
-    std::cout << "Content-Type: text/html\n"
-              << "Status: 500\n"
-              << "\n"
-              << "<html>\n"
-              << " <head>\n"
-              << "  <title>500 Internal Server Error</title>\n"
-              << " </head>\n"
-              << " <body>\n"
-              << "  <h1>Internal Server Error</h1>\n"
-              << "  <p>" << e.getMessage() << "</p>\n"
-              << "  <hr/>"
-              << "  <address>suPHP " << PACKAGE_VERSION << "</address>\n"
-              << " </body>\n"
-              << "</html>\n";
-  }
-
-  // Only reached on error
+    statistics.countRejection(e.getReason());
+    return this->reportError(e, config);
+  }
+}
+
+int suPHP::Application::reportError(SoftException& e,
+                                    const Configuration& config) const {
+  if (!config.getErrorsToBrowser()) {
+    std::cerr << e;
+    return 2;
+  }
+  std::cout << "Content-Type: text/html\n"
+            << "Status: 500\n"
+            << "\n"
+            << "<html>\n"
+            << " <head>\n"
+            << "  <title>500 Internal Server Error</title>\n"
+            << " </head>\n"
+            << " <body>\n"
+            << "  <h1>Internal Server Error</h1>\n"
+            << "  <p>" << e.getMessage() << "</p>\n"
+            << "  <hr/>"
+            << "  <address>suPHP " << PACKAGE_VERSION << "</address>\n"
+            << " </body>\n"
+            << "</html>\n";
   return 2;
 }
 
@@ -175,6 +384,114 @@ void suPHP::Application::printAboutMessage() {
   std::cerr << "(c) 2002-2007 Sebastian Marsching\n";
   std::cerr << std::endl;
   std::cerr << "suPHP has to be called by mod_suphp to work." << std::endl;
+  std::cerr << std::endl;
+  std::cerr << "Options (super-user only):\n";
+  std::cerr << "  --check-config  validate the configuration file\n";
+  std::cerr << "  --dump-config   print the effective configuration\n";
+  std::cerr << "  --compile-overrides  compile overrides_dir into "
+               "overrides_index\n";
+  std::cerr << "  --index DIR...  write the directories below DIR that pass "
+               "the checks to script_index\n";
+  std::cerr << "  --audit [DIR...]  list the files below DIR or the docroots "
+               "that would be refused"
+            << std::endl;
+}
+
+int suPHP::Application::runAdminCommand(CommandLine& cmdline, File& cfgFile) {
+  if (cmdline.count() < 2) {
+    this->printAboutMessage();
+    return 0;
+  }
+
+  std::string option = cmdline.getArgument(1);
+  if (option != "--check-config" && option != "--dump-config" &&
+      option != "--compile-overrides" && option != "--index" &&
+      option != "--audit") {
+    std::cerr << "Unknown option \"" << option << "\"\n\n";
+    this->printAboutMessage();
+    return 1;
+  }
+  if (option != "--audit" && (option == "--index") != (cmdline.count() > 2)) {
+    this->printAboutMessage();
+    return 1;
+  }
+
+  Configuration config;
+  try {
+    config.readFromFile(cfgFile);
+
+    // Resolve every handler, so that unusable entries are reported now
+    // rather than on the first request using them
+    const std::vector<std::string> handlers = config.getHandlerNames();
+    for (std::vector<std::string>::const_iterator i = handlers.begin();
+         i != handlers.end(); i++) {
+      this->getTargetMode(config.getInterpreter(*i));
+      config.getPHPRCPath(*i);
+    }
+  } catch (Exception& e) {
+    std::cerr << cfgFile.getPath() << ": " << e;
+    return 1;
+  }
+
+  if (option == "--dump-config") {
+    std::cout << "; " << cfgFile.getPath() << "\n";
+    config.dump(std::cout);
+  } else if (option == "--index" || option == "--audit") {
+    std::vector<File> roots;
+    for (CommandLine::size_type i = 2; i < cmdline.count(); i++) {
+      roots.push_back(File(cmdline.getArgument(i)));
+    }
+    if (option == "--audit") {
+      return this->auditScripts(config, roots);
+    }
+    return this->writeScriptIndex(config, roots);
+  } else if (option == "--compile-overrides") {
+    try {
+      int count = config.compileOverrides();
+      std::cout << "Wrote " << count << " overrides" << std::endl;
+    } catch (Exception& e) {
+      std::cerr << e;
+      return 1;
+    }
+  } else {
+    std::cout << cfgFile.getPath() << ": OK (generation "
+              << Util::hashToStr(config.getGeneration()) << ")" << std::endl;
+  }
+  return 0;
+}
+
+int suPHP::Application::writeScriptIndex(
+    const Configuration& config, const std::vector<File>& roots) const {
+  if (config.getScriptIndex().empty()) {
+    std::cerr << "Option \"script_index\" has to be set" << std::endl;
+    return 1;
+  }
+
+  ScriptIndexer indexer(*this, config);
+  TreeWalker(indexer).walk(roots);
+  try {
+    IndexFile::write(File(config.getScriptIndex()), indexer.getRecords());
+  } catch (Exception& e) {
+    std::cerr << e;
+    return 1;
+  }
+  std::cout << "Wrote " << indexer.getRecords().size() << " directories"
+            << std::endl;
+  return indexer.getErrors() == 0 ? 0 : 1;
+}
+
+int suPHP::Application::auditScripts(const Configuration& config,
+                                     std::vector<File> roots) const {
+  // Walk each docroot from the directory above its first pattern
+  if (roots.empty()) {
+    roots = config.getDocrootDirectories();
+  }
+
+  ScriptAuditor auditor(*this, config, roots);
+  TreeWalker(auditor).walk(roots);
+  std::cerr << auditor.getRefused() << " files would be refused"
+            << std::endl;
+  return auditor.getRefused() == 0 && auditor.getErrors() == 0 ? 0 : 1;
 }
 
 void suPHP::Application::checkProcessPermissions(Configuration& config) {
@@ -191,23 +508,16 @@ void suPHP::Application::checkProcessPermissions(Configuration& config) {
   }
 }
 
-void suPHP::Application::checkScriptFileStage1(
+Rejection suPHP::Application::checkScriptFileStage1(
     const File& scriptFile, const File& realScriptFile,
     const Configuration& config, const Environment& environment) const {
-  Logger& logger = API_Helper::getSystemAPI().getSystemLogger();
-
   // Check wheter file exists
   if (!scriptFile.exists()) {
-    std::string error = "File " + scriptFile.getPath() + " does not exist";
-    logger.logWarning(error);
-    throw SoftException(error, __FILE__, __LINE__);
+    return Rejection(REJECT_SCRIPT_MISSING, scriptFile.getPath());
   }
   if (!realScriptFile.exists()) {
-    std::string error = "File " + realScriptFile.getPath() +
-                        " referenced by symlink " + scriptFile.getPath() +
-                        " does not exist";
-    logger.logWarning(error);
-    throw SoftException(error, __FILE__, __LINE__);
+    return Rejection(REJECT_TARGET_MISSING, realScriptFile.getPath(),
+                     scriptFile.getPath());
   }
 
   // If enabled, check whether script is in the vhost's docroot
@@ -216,61 +526,33 @@ void suPHP::Application::checkScriptFileStage1(
                         __LINE__);
   if (config.getCheckVHostDocroot() &&
       realScriptFile.getPath().find(environment.getVar("DOCUMENT_ROOT")) != 0) {
-    std::string error = "File \"" + realScriptFile.getPath() +
-                        "\" is not in document root of Vhost \"" +
-                        environment.getVar("DOCUMENT_ROOT") + "\"";
-    logger.logWarning(error);
-    throw SoftException(error, __FILE__, __LINE__);
+    return Rejection(REJECT_NOT_IN_VHOST_DOCROOT, realScriptFile.getPath(),
+                     environment.getVar("DOCUMENT_ROOT"));
   }
   if (config.getCheckVHostDocroot() &&
       scriptFile.getPath().find(environment.getVar("DOCUMENT_ROOT")) != 0) {
-    std::string error = "File \"" + scriptFile.getPath() +
-                        "\" is not in document root of Vhost \"" +
-                        environment.getVar("DOCUMENT_ROOT") + "\"";
-    logger.logWarning(error);
-    throw SoftException(error, __FILE__, __LINE__);
+    return Rejection(REJECT_NOT_IN_VHOST_DOCROOT, scriptFile.getPath(),
+                     environment.getVar("DOCUMENT_ROOT"));
   }
 
   // Check script permissions
-  // Directories will be checked later
+  // Write permissions and directories will be checked later
   if (!realScriptFile.hasUserReadBit()) {
-    std::string error =
-        "File \"" + realScriptFile.getPath() + "\" not readable";
-    logger.logWarning(error);
-    throw SoftException(error, __FILE__, __LINE__);
-  }
-
-  if (!config.getAllowFileGroupWriteable() &&
-      realScriptFile.hasGroupWriteBit()) {
-    std::string error =
-        "File \"" + realScriptFile.getPath() + "\" is writeable by group";
-    logger.logWarning(error);
-    throw SoftException(error, __FILE__, __LINE__);
-  }
-
-  if (!config.getAllowFileOthersWriteable() &&
-      realScriptFile.hasOthersWriteBit()) {
-    std::string error =
-        "File \"" + realScriptFile.getPath() + "\" is writeable by others";
-    logger.logWarning(error);
-    throw SoftException(error, __FILE__, __LINE__);
+    return Rejection(REJECT_NOT_READABLE, realScriptFile.getPath());
   }
 
   // Check UID/GID of symlink is matching target
   if (scriptFile.getUser() != realScriptFile.getUser() ||
       scriptFile.getGroup() != realScriptFile.getGroup()) {
-    std::string error = "UID or GID of symlink \"" + scriptFile.getPath() +
-                        "\" is not matching its target";
-    logger.logWarning(error);
-    throw SoftException(error, __FILE__, __LINE__);
+    return Rejection(REJECT_SYMLINK_OWNER, scriptFile.getPath());
   }
+  return Rejection();
 }
 
-void suPHP::Application::checkScriptFileStage2(
+Rejection suPHP::Application::checkScriptFileStage2(
     const File& scriptFile, const File& realScriptFile,
     const Configuration& config, const Environment& environment,
     const UserInfo& targetUser, const GroupInfo& targetGroup) const {
-  Logger& logger = API_Helper::getSystemAPI().getSystemLogger();
   auto pathMatcher = PathMatcher<>(targetUser, targetGroup);
 
   // Check wheter script is in one of the defined docroots
@@ -285,11 +567,8 @@ void suPHP::Application::checkScriptFileStage2(
     }
   }
   if (!file_in_docroot) {
-    std::string error = "Script \"" + scriptFile.getPath() +
-                        "\" resolving to \"" + realScriptFile.getPath() +
-                        "\" not within configured docroot";
-    logger.logWarning(error);
-    throw SoftException(error, __FILE__, __LINE__);
+    return Rejection(REJECT_NOT_IN_DOCROOT, scriptFile.getPath(),
+                     realScriptFile.getPath());
   }
   file_in_docroot = false;
   for (std::vector<std::string>::const_iterator i = docroots.begin();
@@ -301,72 +580,66 @@ void suPHP::Application::checkScriptFileStage2(
     }
   }
   if (!file_in_docroot) {
-    std::string error =
-        "Script \"" + scriptFile.getPath() + "\" not within configured docroot";
-    logger.logWarning(error);
-    throw SoftException(error, __FILE__, __LINE__);
+    return Rejection(REJECT_NOT_IN_DOCROOT, scriptFile.getPath());
+  }
+
+  // Check write permissions, these may be overridden for the target user
+  if (!config.getAllowFileGroupWriteable() &&
+      realScriptFile.hasGroupWriteBit()) {
+    return Rejection(REJECT_FILE_GROUP_WRITEABLE, realScriptFile.getPath());
+  }
+
+  if (!config.getAllowFileOthersWriteable() &&
+      realScriptFile.hasOthersWriteBit()) {
+    return Rejection(REJECT_FILE_OTHERS_WRITEABLE, realScriptFile.getPath());
   }
 
   // Check directory ownership and permissions
-  checkParentDirectories(realScriptFile, targetUser, config);
-  checkParentDirectories(scriptFile, targetUser, config);
+  Rejection rejection =
+      checkParentDirectories(realScriptFile, targetUser, config);
+  if (rejection.isRejected()) {
+    return rejection;
+  }
+  return checkParentDirectories(scriptFile, targetUser, config);
 }
 
-void suPHP::Application::checkProcessPermissions(const File& scriptFile,
-                                                 const File& realScriptFile,
-                                                 const Configuration& config,
-                                                 const Environment& environment,
-                                                 UserInfo& targetUser,
-                                                 GroupInfo& targetGroup) const {
+Rejection suPHP::Application::checkProcessPermissions(
+    const File& scriptFile, const File& realScriptFile,
+    const Configuration& config, const Environment& environment,
+    UserInfo& targetUser, GroupInfo& targetGroup) const {
   API& api = API_Helper::getSystemAPI();
-  Logger& logger = api.getSystemLogger();
   SetidMode mode = config.getMode();
 
   // Common code (for all security modes)
 
   // Check UID/GID of script
   if (scriptFile.getUser().getUid() < config.getMinUid()) {
-    std::string error = "UID of script \"" + scriptFile.getPath() +
-                        "\" is smaller than min_uid";
-    logger.logWarning(error);
-    throw SoftException(error, __FILE__, __LINE__);
+    return Rejection(REJECT_MIN_UID, scriptFile.getPath());
   }
   if (scriptFile.getGroup().getGid() < config.getMinGid()) {
-    std::string error = "GID of script \"" + scriptFile.getPath() +
-                        "\" is smaller than min_gid";
-    logger.logWarning(error);
-    throw SoftException(error, __FILE__, __LINE__);
+    return Rejection(REJECT_MIN_GID, scriptFile.getPath());
   }
 
   if (mode == OWNER_MODE) {
     // owner mode
     targetUser = scriptFile.getUser();
     targetGroup = scriptFile.getGroup();
-    return;
+    return Rejection();
   }
   // paranoid and force mode
-  std::string targetUsername, targetGroupname;
-  try {
-    targetUsername = environment.getVar("SUPHP_USER");
-    targetGroupname = environment.getVar("SUPHP_GROUP");
-  } catch (KeyNotFoundException& e) {
+  if (!environment.hasVar("SUPHP_USER") || !environment.hasVar("SUPHP_GROUP")) {
     throw SecurityException(
         "Environment variable SUPHP_USER or SUPHP_GROUP not set", __FILE__,
         __LINE__);
   }
+  std::string targetUsername = environment.getVar("SUPHP_USER");
+  std::string targetGroupname = environment.getVar("SUPHP_GROUP");
 
   if (config.getUserdirOverridesUsergroup() &&
       environment.hasVar("SUPHP_USERDIR_USER") &&
       environment.hasVar("SUPHP_USERDIR_GROUP")) {
-    try {
-      targetUsername = environment.getVar("SUPHP_USERDIR_USER");
-      targetGroupname = environment.getVar("SUPHP_USERDIR_GROUP");
-    } catch (KeyNotFoundException& e) {
-      throw SecurityException(
-          "Environment variable SUPHP_USERDIR_USER or SUPHP_USERDIR_GROUP not "
-          "set",
-          __FILE__, __LINE__);
-    }
+    targetUsername = environment.getVar("SUPHP_USERDIR_USER");
+    targetGroupname = environment.getVar("SUPHP_USERDIR_GROUP");
   }
 
   if (targetUsername[0] == '#' &&
@@ -386,23 +659,16 @@ void suPHP::Application::checkProcessPermissions(const File& scriptFile,
   if (mode == PARANOID_MODE) {
     // Paranoid mode only
     if (config.getParanoidUIDCheck() && targetUser != scriptFile.getUser()) {
-      std::string error = "Mismatch between target UID (" +
-                          Util::intToStr(targetUser.getUid()) + ") and UID (" +
-                          Util::intToStr(scriptFile.getUser().getUid()) +
-                          ") of file \"" + scriptFile.getPath() + "\"";
-      logger.logWarning(error);
-      throw SoftException(error, __FILE__, __LINE__);
+      return Rejection(REJECT_UID_MISMATCH, scriptFile.getPath(), "",
+                       targetUser.getUid(), scriptFile.getUser().getUid());
     }
 
     if (config.getParanoidGIDCheck() && targetGroup != scriptFile.getGroup()) {
-      std::string error = "Mismatch between target GID (" +
-                          Util::intToStr(targetGroup.getGid()) + ") and GID (" +
-                          Util::intToStr(scriptFile.getGroup().getGid()) +
-                          ") of file \"" + scriptFile.getPath() + "\"";
-      logger.logWarning(error);
-      throw SoftException(error, __FILE__, __LINE__);
+      return Rejection(REJECT_GID_MISMATCH, scriptFile.getPath(), "",
+                       targetGroup.getGid(), scriptFile.getGroup().getGid());
     }
   }
+  return Rejection();
 }
 
 void suPHP::Application::changeProcessPermissions(
@@ -420,6 +686,143 @@ void suPHP::Application::changeProcessPermissions(
   api.setUmask(config.getUmask());
 }
 
+void suPHP::Application::logRejection(const Rejection& rejection) const {
+  Logger& logger = API_Helper::getSystemAPI().getSystemLogger();
+
+  // Only format the message if it is logged
+  if (logger.getLogLevel() == LOGLEVEL_WARN ||
+      logger.getLogLevel() == LOGLEVEL_INFO) {
+    logger.logWarning(rejection.getMessage());
+  }
+}
+
+int suPHP::Application::refuse(const Rejection& rejection,
+                               const Configuration& config,
+                               const Environment& env,
+                               StageStatistics& statistics) const {
+  this->logRejection(rejection);
+  statistics.countRejection(rejection.getReason());
+
+  // The token is removed from the environment of the script, so only
+  // suphp can tell mod_suphp why it refused the script
+  if (env.hasVar("SUPHP_REFUSAL_TOKEN")) {
+    std::cerr << env.getVar("SUPHP_REFUSAL_TOKEN") << " "
+              << rejection.getReason() << std::endl;
+  }
+  SoftException e(rejection, __FILE__, __LINE__);
+  return this->reportError(e, config);
+}
+
+void suPHP::Application::attachStageStatistics(
+    const Configuration& config, StageStatistics& statistics) const {
+  Logger& logger = API_Helper::getSystemAPI().getSystemLogger();
+  File file(config.getStageStatistics());
+
+  if (file.getPath().empty()) {
+    return;
+  }
+
+  try {
+    // The file is written with root privileges, so nobody else may
+    // replace its contents
+    if (!file.getUser().isSuperUser() || file.hasGroupWriteBit() ||
+        file.hasOthersWriteBit()) {
+      logger.logWarning("Not using " + file.getPath() +
+                        " for stage statistics, it is not owned and only "
+                        "writable by the super-user");
+      return;
+    }
+    statistics.attach(file);
+  } catch (SystemException& e) {
+    logger.logWarning(e.getMessage());
+  } catch (IOException& e) {
+    logger.logWarning(e.getMessage());
+  }
+}
+
+void suPHP::Application::publishPolicy(const File& cfgFile,
+                                       const Configuration& config,
+                                       StageStatistics& statistics) const {
+  uint32_t flags = 0;
+
+  // Overrides may allow for some users what the global section denies
+  if (config.getOverridesIndex().empty()) {
+    if (!config.getAllowFileGroupWriteable()) {
+      flags |= StageStatistics::POLICY_DENY_FILE_GROUP_WRITEABLE;
+    }
+    if (!config.getAllowFileOthersWriteable()) {
+      flags |= StageStatistics::POLICY_DENY_FILE_OTHERS_WRITEABLE;
+    }
+  }
+  statistics.publishPolicy(cfgFile.getPath(), config.getIdentity(), flags);
+}
+
+void suPHP::Application::openScriptIndex(const Configuration& config) {
+  Logger& logger = API_Helper::getSystemAPI().getSystemLogger();
+  File file(config.getScriptIndex());
+
+  if (file.getPath().empty()) {
+    return;
+  }
+
+  try {
+    // Directories found in the index are not checked any more
+    if (!file.getUser().isSuperUser() || file.hasGroupWriteBit() ||
+        file.hasOthersWriteBit()) {
+      logger.logWarning("Not using script index " + file.getPath() +
+                        ", it is not owned and only writable by the "
+                        "super-user");
+      return;
+    }
+    this->scriptIndex.open(file);
+
+    // Directories verified since the last change are trusted
+    File state(config.getScriptIndexState());
+    if (state.getPath().empty()) {
+      return;
+    }
+    if (!state.getUser().isSuperUser() || state.hasGroupWriteBit() ||
+        state.hasOthersWriteBit()) {
+      logger.logWarning("Not using script index state " + state.getPath() +
+                        ", it is not owned and only writable by the "
+                        "super-user");
+      return;
+    }
+    this->scriptIndex.watch(state);
+  } catch (SystemException& e) {
+    logger.logWarning(e.getMessage());
+  } catch (IOException& e) {
+    logger.logWarning(e.getMessage());
+  }
+}
+
+void suPHP::Application::joinCgroup(const Configuration& config,
+                                    const UserInfo& targetUser) const {
+  std::vector<std::pair<std::string, std::string> > settings;
+
+  if (config.getCgroupParent().empty()) {
+    return;
+  }
+
+  if (config.getCgroupCpuWeight() > 0) {
+    settings.push_back(std::make_pair(
+        "cpu.weight", Util::intToStr(config.getCgroupCpuWeight())));
+  }
+  if (!config.getCgroupMemoryMax().empty()) {
+    settings.push_back(
+        std::make_pair("memory.max", config.getCgroupMemoryMax()));
+  }
+  if (config.getCgroupPidsMax() > 0) {
+    settings.push_back(std::make_pair(
+        "pids.max", Util::intToStr(config.getCgroupPidsMax())));
+  }
+
+  API_Helper::getSystemAPI().joinCgroup(
+      config.getCgroupParent() + "/uid-" +
+          Util::intToStr(targetUser.getUid()),
+      settings);
+}
+
 Environment suPHP::Application::prepareEnvironment(
     const Environment& sourceEnv, const Configuration& config,
     TargetMode mode) {
@@ -438,6 +841,8 @@ Environment suPHP::Application::prepareEnvironment(
   env.deleteVar("SUPHP_AUTH_USER");
   env.deleteVar("SUPHP_AUTH_PW");
   env.deleteVar("SUPHP_PHP_CONFIG");
+  env.deleteVar("SUPHP_SCRIPT_FD");
+  env.deleteVar("SUPHP_REFUSAL_TOKEN");
 
   // Reset PATH
   env.putVar("PATH", config.getEnvPath());
@@ -528,38 +933,101 @@ void suPHP::Application::executeScript(const std::string& scriptFilename,
   }
 }
 
-void suPHP::Application::checkParentDirectories(
+Rejection suPHP::Application::checkParentDirectories(
     const File& file, const UserInfo& owner,
     const Configuration& config) const {
+  if (this->scriptIndex.contains(file.getParentDirectory(), owner, config)) {
+    return Rejection();
+  }
+
   File directory = file;
-  Logger& logger = API_Helper::getSystemAPI().getSystemLogger();
   do {
     directory = directory.getParentDirectory();
 
     UserInfo directoryOwner = directory.getUser();
     if (directoryOwner != owner && !directoryOwner.isSuperUser()) {
-      std::string error = "Directory " + directory.getPath() +
-                          " is not owned by " + owner.getUsername();
-      logger.logWarning(error);
-      throw SoftException(error, __FILE__, __LINE__);
+      return Rejection(REJECT_DIRECTORY_OWNER, directory.getPath(), "",
+                       owner.getUid());
     }
 
     if (!directory.isSymlink() && !config.getAllowDirectoryGroupWriteable() &&
         directory.hasGroupWriteBit()) {
-      std::string error =
-          "Directory \"" + directory.getPath() + "\" is writeable by group";
-      logger.logWarning(error);
-      throw SoftException(error, __FILE__, __LINE__);
+      return Rejection(REJECT_DIRECTORY_GROUP_WRITEABLE, directory.getPath());
     }
 
     if (!directory.isSymlink() && !config.getAllowDirectoryOthersWriteable() &&
         directory.hasOthersWriteBit()) {
-      std::string error =
-          "Directory \"" + directory.getPath() + "\" is writeable by others";
-      logger.logWarning(error);
-      throw SoftException(error, __FILE__, __LINE__);
+      return Rejection(REJECT_DIRECTORY_OTHERS_WRITEABLE, directory.getPath());
     }
   } while (directory.getPath() != "/");
+  return Rejection();
+}
+
+std::string suPHP::Application::getScriptDescriptorPath(
+    const File& scriptFile, const Environment& env) const {
+  API& api = API_Helper::getSystemAPI();
+  std::string value = env.getVar("SUPHP_SCRIPT_FD");
+  if (value.empty() ||
+      value.find_first_not_of("0123456789") != std::string::npos) {
+    throw SecurityException("Invalid SUPHP_SCRIPT_FD \"" + value + "\"",
+                            __FILE__, __LINE__);
+  }
+  int fd = Util::strToInt(value);
+
+  FileIdentity identity, scriptIdentity, realIdentity;
+  std::string path;
+  try {
+    identity = api.getDescriptorIdentity(fd);
+    path = api.getDescriptorPath(fd);
+    scriptIdentity = scriptFile.getIdentity();
+    realIdentity = File(path).getIdentity();
+  } catch (SystemException& e) {
+    api.closeDescriptor(fd);
+    throw SoftException("Invalid descriptor for script \"" +
+                            scriptFile.getPath() + "\"",
+                        e, __FILE__, __LINE__);
+  }
+  // The interpreter must not inherit it
+  api.closeDescriptor(fd);
+
+  // The descriptor only replaces resolving the path if both the script
+  // and the resolved path still are the file it was opened for
+  if (scriptIdentity.device != identity.device ||
+      scriptIdentity.inode != identity.inode ||
+      realIdentity.device != identity.device ||
+      realIdentity.inode != identity.inode) {
+    throw SecurityException("Script descriptor does not refer to \"" +
+                                scriptFile.getPath() + "\"",
+                            __FILE__, __LINE__);
+  }
+  return path;
+}
+
+Rejection suPHP::Application::openScriptDescriptor(
+    const File& realScriptFile, const FileIdentity& identity,
+    std::string& path) const {
+  API& api = API_Helper::getSystemAPI();
+  int fd;
+  FileIdentity opened;
+  try {
+    fd = api.File_open(realScriptFile);
+  } catch (SystemException& e) {
+    throw SoftException(
+        "Could not open script \"" + realScriptFile.getPath() + "\"", e,
+        __FILE__, __LINE__);
+  }
+  opened = api.getDescriptorIdentity(fd);
+
+  // Refuse a file that was replaced or modified after it was checked
+  if (opened.device != identity.device || opened.inode != identity.inode ||
+      opened.mtime != identity.mtime ||
+      opened.mtime_nsec != identity.mtime_nsec ||
+      opened.size != identity.size) {
+    api.closeDescriptor(fd);
+    return Rejection(REJECT_SCRIPT_CHANGED, realScriptFile.getPath());
+  }
+  path = "/dev/fd/" + Util::intToStr(fd);
+  return Rejection();
 }
 
 int main(int argc, char** argv) {
@@ -27,9 +27,13 @@
 
 #include "CommandLine.hpp"
 #include "Environment.hpp"
+#include "File.hpp"
 #include "GroupInfo.hpp"
+#include "Rejection.hpp"
+#include "ScriptIndex.hpp"
 #include "SecurityException.hpp"
 #include "SoftException.hpp"
+#include "StageStatistics.hpp"
 #include "SystemException.hpp"
 #include "UserInfo.hpp"
 
@@ -43,11 +47,42 @@ enum TargetMode { TARGETMODE_PHP, TARGETMODE_SELFEXECUTE };
  */
 class Application {
  private:
+  class ScriptIndexer;
+  class ScriptAuditor;
+
+  ScriptIndex scriptIndex;
+
+  Application(const Application&) = delete;
+  Application& operator=(const Application&) = delete;
+
   /**
    * Print message containing version information
    */
   void printAboutMessage();
 
+  /**
+   * Handles command line options available to the super-user
+   * (--check-config, --dump-config, --compile-overrides, --index,
+   * --audit)
+   */
+  int runAdminCommand(CommandLine& cmdline, File& cfgFile);
+
+  /**
+   * Checks the directories below roots and writes those that pass the
+   * checks of checkParentDirectories() to the file named by
+   * script_index. Returns the exit code.
+   */
+  int writeScriptIndex(const Configuration& config,
+                       const std::vector<File>& roots) const;
+
+  /**
+   * Checks the files below roots, or below the docroots if roots is
+   * empty, and prints those the checks of the script file would refuse.
+   * Returns the exit code.
+   */
+  int auditScripts(const Configuration& config,
+                   std::vector<File> roots) const;
+
   /**
    * Checks wheter process has root privileges
    * and calling user is webserver user
@@ -57,31 +92,37 @@ class Application {
   /**
    * Checks scriptfile (first stage).
    * Includes check for VHost docroot, symbollink and permissions.
+   * Returns why the script is refused, the checks themselves only throw
+   * if the system cannot be queried.
    */
-  void checkScriptFileStage1(const File& scriptFile, const File& realScriptFile,
-                             const Configuration& config,
-                             const Environment& environment) const;
+  Rejection checkScriptFileStage1(const File& scriptFile,
+                                  const File& realScriptFile,
+                                  const Configuration& config,
+                                  const Environment& environment) const;
 
   /**
    * Checks scriptfile.
    * Includes check for paths which might be user specific
+   * Returns why the script is refused, like checkScriptFileStage1().
    */
-  void checkScriptFileStage2(const File& scriptFile, const File& realScriptFile,
-                             const Configuration& config,
-                             const Environment& environment,
-                             const UserInfo& targetUser,
-                             const GroupInfo& targetGroup) const;
+  Rejection checkScriptFileStage2(const File& scriptFile,
+                                  const File& realScriptFile,
+                                  const Configuration& config,
+                                  const Environment& environment,
+                                  const UserInfo& targetUser,
+                                  const GroupInfo& targetGroup) const;
 
   /**
    * Determines target user and group that is to be used for script execution.
    * Uses preprocessor macros to distinguish between modes
+   * Returns why the script is refused, like checkScriptFileStage1().
    */
-  void checkProcessPermissions(const File& scriptFile,
-                               const File& realScriptFile,
-                               const Configuration& config,
-                               const Environment& environment,
-                               UserInfo& targetUser,
-                               GroupInfo& targetGroup) const;
+  Rejection checkProcessPermissions(const File& scriptFile,
+                                    const File& realScriptFile,
+                                    const Configuration& config,
+                                    const Environment& environment,
+                                    UserInfo& targetUser,
+                                    GroupInfo& targetGroup) const;
 
   /**
    * Changes process permission (user and group).
@@ -91,6 +132,56 @@ class Application {
                                 const UserInfo& targetUser,
                                 const GroupInfo& targetGroup) const;
 
+  /**
+   * Logs the rejection of the script, if warnings are logged
+   */
+  void logRejection(const Rejection& rejection) const;
+
+  /**
+   * Logs and counts the rejection of the script and reports it like a
+   * SoftException, without throwing. If mod_suphp passed
+   * SUPHP_REFUSAL_TOKEN, the token and the reason are written to stderr
+   * first (suPHP_RefusalCache). Returns the exit code.
+   */
+  int refuse(const Rejection& rejection, const Configuration& config,
+             const Environment& env, StageStatistics& statistics) const;
+
+  /**
+   * Reports e on stderr or, with errors_to_browser, as error page.
+   * Returns the exit code.
+   */
+  int reportError(SoftException& e, const Configuration& config) const;
+
+  /**
+   * Maps the file named by stage_statistics, if it is set and only
+   * writable by the super-user. Problems are logged, but do not stop
+   * the script from being executed.
+   */
+  void attachStageStatistics(const Configuration& config,
+                             StageStatistics& statistics) const;
+
+  /**
+   * Publishes the checks of the script file mod_suphp may do before
+   * starting suphp, for the configuration read from cfgFile
+   */
+  void publishPolicy(const File& cfgFile, const Configuration& config,
+                     StageStatistics& statistics) const;
+
+  /**
+   * Opens the file named by script_index, and the state of
+   * suphp-cached named by script_index_state, if they are set and only
+   * writable by the super-user. Problems are logged, the directories are
+   * then checked as usual.
+   */
+  void openScriptIndex(const Configuration& config);
+
+  /**
+   * Moves the process into the cgroup of the target user below
+   * cgroup_parent, if that is set
+   */
+  void joinCgroup(const Configuration& config,
+                  const UserInfo& targetUser) const;
+
   /**
    * Prepares the environment before invoking the script
    */
@@ -121,10 +212,29 @@ class Application {
                      const Environment& env, const Configuration& config) const;
 
   /**
-   * Checks ownership and permissions for parent directories
+   * Checks ownership and permissions for parent directories, unless they
+   * are found unchanged in the script index
+   */
+  Rejection checkParentDirectories(const File& file, const UserInfo& owner,
+                                   const Configuration& config) const;
+
+  /**
+   * Returns the real path of the script from the descriptor passed by
+   * mod_suphp in SUPHP_SCRIPT_FD, after checking that it refers to the
+   * script. The descriptor is closed.
+   */
+  std::string getScriptDescriptorPath(const File& scriptFile,
+                                      const Environment& env) const;
+
+  /**
+   * Opens the checked script with the permissions of the target user and
+   * sets path to its /dev/fd path. The descriptor is kept open for the
+   * interpreter and must still refer to the file with identity,
+   * otherwise the script is refused.
    */
-  void checkParentDirectories(const File& file, const UserInfo& owner,
-                              const Configuration& config) const;
+  Rejection openScriptDescriptor(const File& realScriptFile,
+                                 const FileIdentity& identity,
+                                 std::string& path) const;
 
  public:
   /**
@@ -0,0 +1,333 @@
+/*
+  suPHP - (c)2002-2013 Sebastian Marsching <sebastian@marsching.com>
+          (c)2018 John Lightsey <john@nixnuts.net>
+
+  This file is part of suPHP.
+
+  suPHP is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  suPHP is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with suPHP; if not, write to the Free Software Foundation, Inc.,
+  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <iostream>
+
+#include "config.h"
+
+#include "API.hpp"
+#include "API_Helper.hpp"
+#include "SystemException.hpp"
+
+#include "CacheDaemon.hpp"
+
+using namespace suPHP;
+
+namespace {
+const uint32_t BELOW_MASK = IN_ATTRIB | IN_CREATE | IN_DELETE |
+                            IN_MOVED_FROM | IN_MOVED_TO | IN_MOVE_SELF |
+                            IN_DELETE_SELF | IN_ONLYDIR | IN_DONT_FOLLOW;
+const uint32_t ABOVE_MASK =
+    IN_ATTRIB | IN_MOVE_SELF | IN_DELETE_SELF | IN_ONLYDIR | IN_DONT_FOLLOW;
+
+// Seconds between attempts to watch directories that could not be
+const int RETRY_INTERVAL = 10;
+
+volatile sig_atomic_t stopping = 0;
+
+void requestStop(int) { stopping = 1; }
+
+bool isBelow(const std::string& path, const std::string& parent) {
+  if (path.compare(0, parent.length(), parent) != 0) return false;
+  return path.length() == parent.length() || parent == "/" ||
+         path[parent.length()] == '/';
+}
+}  // namespace
+
+suPHP::CacheDaemon::CacheDaemon()
+    : fd(-1), state(), roots(), mutex(), watches(), errors(0) {}
+
+suPHP::CacheDaemon::~CacheDaemon() {
+  this->state.stop();
+  if (this->fd != -1) {
+    ::close(this->fd);
+  }
+}
+
+bool suPHP::CacheDaemon::watch(const File& directory, bool above) {
+  int wd = ::inotify_add_watch(this->fd, directory.getPath().c_str(),
+                               above ? ABOVE_MASK : BELOW_MASK);
+  if (wd == -1) {
+    // The target of a symlink is not trusted by suphp anyway
+    if (errno == ENOENT || errno == ENOTDIR) {
+      return false;
+    }
+    throw SystemException("Could not watch \"" + directory.getPath() +
+                              "\": " + ::strerror(errno),
+                          __FILE__, __LINE__);
+  }
+  std::lock_guard<std::mutex> lock(this->mutex);
+  Watch& watch = this->watches[wd];
+  watch.path = directory.getPath();
+  watch.above = above;
+  return true;
+}
+
+void suPHP::CacheDaemon::unwatch(const std::string& path) {
+  std::lock_guard<std::mutex> lock(this->mutex);
+  std::map<int, Watch>::iterator i = this->watches.begin();
+  while (i != this->watches.end()) {
+    if (!i->second.above && isBelow(i->second.path, path)) {
+      ::inotify_rm_watch(this->fd, i->first);
+      this->watches.erase(i++);
+    } else {
+      i++;
+    }
+  }
+}
+
+void suPHP::CacheDaemon::watchTree(const File& root) {
+  try {
+    // Above first, so a directory renamed meanwhile is noticed
+    File current = root;
+    while (current.getPath() != "/") {
+      current = current.getParentDirectory();
+      this->watch(current, true);
+    }
+    if (!this->watch(root, false)) {
+      throw SystemException("Could not watch \"" + root.getPath() +
+                                "\": missing or a symlink",
+                            __FILE__, __LINE__);
+    }
+  } catch (SystemException& e) {
+    // Unlike a subdirectory, a missing root is not watched at all
+    std::cerr << root.getPath() << ": " << e.getMessage() << std::endl;
+    this->errors++;
+    return;
+  }
+  TreeWalker(*this).walk(std::vector<File>(1, root));
+}
+
+bool suPHP::CacheDaemon::isRoot(const std::string& path) const {
+  for (std::vector<File>::const_iterator i = this->roots.begin();
+       i != this->roots.end(); i++) {
+    if (i->getPath() == path) return true;
+  }
+  return false;
+}
+
+bool suPHP::CacheDaemon::rewatch() {
+  // Changes are not noticed until the directories are watched again
+  this->state.stop();
+  if (this->fd != -1) {
+    ::close(this->fd);
+  }
+  this->watches.clear();
+  this->errors = 0;
+  this->fd = ::inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  if (this->fd == -1) {
+    throw SystemException(
+        std::string("Could not initialize inotify: ") + ::strerror(errno),
+        __FILE__, __LINE__);
+  }
+  for (std::vector<File>::const_iterator i = this->roots.begin();
+       i != this->roots.end(); i++) {
+    this->watchTree(*i);
+  }
+  return this->errors == 0;
+}
+
+bool suPHP::CacheDaemon::handle(const struct inotify_event& event) {
+  if (event.mask & (IN_Q_OVERFLOW | IN_UNMOUNT)) {
+    std::cerr << "Events have been lost or a file system has been "
+              << "unmounted, watching the docroots again" << std::endl;
+    this->rewatch();
+    return false;
+  }
+
+  std::map<int, Watch>::iterator i = this->watches.find(event.wd);
+  if (i == this->watches.end()) {
+    return true;
+  }
+  Watch watch = i->second;
+  if (event.mask & IN_IGNORED) {
+    this->watches.erase(i);
+    return true;
+  }
+
+  bool self = event.len == 0;
+  if (self && (event.mask & (IN_MOVE_SELF | IN_DELETE_SELF)) &&
+      (watch.above || this->isRoot(watch.path))) {
+    std::cerr << watch.path << " has been moved or removed, watching the "
+              << "docroots again" << std::endl;
+    this->rewatch();
+    return false;
+  }
+  // Above the docroots only the directories on the way down matter
+  if (!self && (watch.above || !(event.mask & IN_ISDIR))) {
+    return true;
+  }
+
+  if (!self) {
+    std::string path =
+        (watch.path == "/" ? "" : watch.path) + "/" + event.name;
+    if (event.mask & IN_MOVED_FROM) {
+      this->unwatch(path);
+    }
+    try {
+      if ((event.mask & (IN_CREATE | IN_MOVED_TO)) &&
+          this->watch(File(path), false)) {
+        // Events of other directories are not read during the walk, so
+        // nothing is trusted until the next heartbeat
+        this->state.stop();
+        TreeWalker(*this).walk(std::vector<File>(1, File(path)));
+      }
+    } catch (SystemException& e) {
+      this->visitError(File(path), e);
+    }
+  }
+  // After the new directories are watched, so a change to one of them
+  // before cannot be trusted
+  this->state.invalidate();
+  return true;
+}
+
+void suPHP::CacheDaemon::visitDirectory(
+    const File&, const std::vector<File>&,
+    const std::vector<File>& subdirectories) {
+  for (std::vector<File>::const_iterator i = subdirectories.begin();
+       i != subdirectories.end(); i++) {
+    try {
+      this->watch(*i, false);
+    } catch (Exception& e) {
+      this->visitError(*i, e);
+    }
+  }
+}
+
+void suPHP::CacheDaemon::visitError(const File& directory, Exception& e) {
+  // Removed while walking
+  if (!directory.exists()) {
+    return;
+  }
+  std::lock_guard<std::mutex> lock(this->mutex);
+  std::cerr << directory.getPath() << ": " << e.getMessage() << std::endl;
+  this->errors++;
+}
+
+int suPHP::CacheDaemon::run(const Configuration& config) {
+  if (config.getScriptIndexState().empty()) {
+    std::cerr << "Option \"script_index_state\" has to be set" << std::endl;
+    return 1;
+  }
+  this->roots = config.getDocrootDirectories();
+  this->state.create(File(config.getScriptIndexState()), this->roots);
+
+  // Without SA_RESTART, so poll() returns
+  struct sigaction action;
+  ::memset(&action, 0, sizeof(action));
+  action.sa_handler = requestStop;
+  ::sigaction(SIGTERM, &action, NULL);
+  ::sigaction(SIGINT, &action, NULL);
+
+  bool complete = this->rewatch();
+  time_t attempt = ::time(NULL);
+  union {
+    struct inotify_event event;
+    char bytes[65536];
+  } buffer;
+  while (!stopping) {
+    if (complete) {
+      this->state.beat();
+    } else if (::time(NULL) - attempt >= RETRY_INTERVAL) {
+      complete = this->rewatch();
+      attempt = ::time(NULL);
+      continue;
+    }
+
+    struct pollfd ready;
+    ready.fd = this->fd;
+    ready.events = POLLIN;
+    ready.revents = 0;
+    if (::poll(&ready, 1, 1000) <= 0) {
+      continue;
+    }
+    ssize_t length = ::read(this->fd, buffer.bytes, sizeof(buffer.bytes));
+    if (length == -1) {
+      if (errno == EAGAIN || errno == EINTR) {
+        continue;
+      }
+      throw SystemException(
+          std::string("Could not read events: ") + ::strerror(errno),
+          __FILE__, __LINE__);
+    }
+
+    for (ssize_t offset = 0; offset < length;) {
+      const struct inotify_event* event =
+          reinterpret_cast<const struct inotify_event*>(buffer.bytes +
+                                                        offset);
+      if (!this->handle(*event)) {
+        complete = this->errors == 0;
+        attempt = ::time(NULL);
+        break;
+      }
+      offset += sizeof(struct inotify_event) + event->len;
+    }
+    if (complete && this->errors > 0) {
+      std::cerr << "Not all directories are watched, trying again in "
+                << RETRY_INTERVAL << " seconds" << std::endl;
+      this->state.stop();
+      complete = false;
+      attempt = ::time(NULL);
+    }
+  }
+
+  this->state.stop();
+  return 0;
+}
+
+int main(int argc, char** argv) {
+  try {
+    API& api = API_Helper::getSystemAPI();
+    if (argc > 1) {
+      std::cerr << "Usage: " << argv[0] << "\n\n"
+                << "Watches the docroots for suphp, see script_index_state"
+                << std::endl;
+      return 1;
+    }
+    if (!api.getRealProcessUser().isSuperUser()) {
+      std::cerr << "suphp-cached has to be run by the super-user"
+                << std::endl;
+      return 1;
+    }
+
+#ifdef OPT_CONFIGFILE
+    File cfgFile = File(OPT_CONFIGFILE);
+#else
+    File cfgFile = File("/etc/suphp.conf");
+#endif
+    Configuration config;
+    config.readFromFile(cfgFile);
+
+    CacheDaemon daemon;
+    return daemon.run(config);
+  } catch (Exception& e) {
+    std::cerr << e;
+    return 1;
+  }
+}
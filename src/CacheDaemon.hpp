@@ -0,0 +1,137 @@
+/*
+  suPHP - (c)2002-2013 Sebastian Marsching <sebastian@marsching.com>
+          (c)2018 John Lightsey <john@nixnuts.net>
+
+  This file is part of suPHP.
+
+  suPHP is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  suPHP is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with suPHP; if not, write to the Free Software Foundation, Inc.,
+  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#ifndef SUPHP_CACHEDAEMON_H
+#define SUPHP_CACHEDAEMON_H
+
+#include <sys/inotify.h>
+
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "Configuration.hpp"
+#include "File.hpp"
+#include "TreeWalker.hpp"
+#include "WatchState.hpp"
+
+namespace suPHP {
+
+/**
+ * Class of suphp-cached, which watches the directories the docroots are
+ * in, and the directories above them, with inotify and starts a new
+ * epoch in the file named by script_index_state whenever one of them is
+ * chmod'ed, chown'ed, renamed, created or removed. Changes to files are
+ * ignored, the index only covers directories.
+ */
+class CacheDaemon : public TreeVisitor {
+ private:
+  /**
+   * A watched directory. Only changes to the directory itself are of
+   * interest above the docroots, below them new subdirectories are
+   * watched as well.
+   */
+  struct Watch {
+    std::string path;
+    bool above;
+  };
+
+  int fd;
+  WatchState state;
+  std::vector<File> roots;
+  std::mutex mutex;
+  std::map<int, Watch> watches;
+  int errors;
+
+  CacheDaemon(const CacheDaemon&) = delete;
+  CacheDaemon& operator=(const CacheDaemon&) = delete;
+
+  /**
+   * Watches directory. Returns false if it has been removed meanwhile
+   * or is a symlink.
+   */
+  bool watch(const File& directory, bool above);
+
+  /**
+   * Stops watching path and the directories below it
+   */
+  void unwatch(const std::string& path);
+
+  /**
+   * Watches root, all directories below it and above it
+   */
+  void watchTree(const File& root);
+
+  /**
+   * Checks whether path is one of the directories watched with all
+   * directories below it
+   */
+  bool isRoot(const std::string& path) const;
+
+  /**
+   * Replaces all watches. Returns whether every directory is watched.
+   */
+  bool rewatch();
+
+  /**
+   * Handles event. Returns false if the watches have been replaced, the
+   * remaining events are then stale.
+   */
+  bool handle(const struct inotify_event& event);
+
+ public:
+  /**
+   * Constructor
+   */
+  CacheDaemon();
+
+  /**
+   * Destructor, tells suphp that the directories are not watched any
+   * more and closes the inotify descriptor
+   */
+  ~CacheDaemon();
+
+  /**
+   * Watches the subdirectories of directory before TreeWalker lists
+   * them, so a subdirectory created later is always noticed
+   */
+  virtual void visitDirectory(const File& directory,
+                              const std::vector<File>& files,
+                              const std::vector<File>& subdirectories);
+
+  virtual void visitError(const File& directory, Exception& e);
+
+  /**
+   * Watches the docroots of config until a signal asks to stop. Returns
+   * the exit code.
+   */
+  int run(const Configuration& config);
+};
+}  // namespace suPHP
+
+/**
+ * Entry point of suphp-cached
+ */
+int main(int argc, char** argv);
+
+#endif  // SUPHP_CACHEDAEMON_H
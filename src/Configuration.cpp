@@ -19,10 +19,16 @@
   51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
 */
 
+#include <algorithm>
+#include <set>
 #include <string>
 #include <vector>
 
+#include "API_Helper.hpp"
+#include "IndexFile.hpp"
 #include "IniFile.hpp"
+#include "IniSection.hpp"
+#include "SecurityException.hpp"
 #include "Util.hpp"
 
 #include "Configuration.hpp"
@@ -88,6 +94,32 @@ SetidMode suPHP::Configuration::strToMode(const std::string& str) const {
                            __LINE__);
 }
 
+std::string suPHP::Configuration::logLevelToStr(LogLevel level) const {
+  switch (level) {
+    case LOGLEVEL_NONE:
+      return "none";
+    case LOGLEVEL_ERROR:
+      return "error";
+    case LOGLEVEL_WARN:
+      return "warn";
+    case LOGLEVEL_INFO:
+      return "info";
+  }
+  return "info";
+}
+
+std::string suPHP::Configuration::modeToStr(SetidMode mode) const {
+  switch (mode) {
+    case OWNER_MODE:
+      return "owner";
+    case FORCE_MODE:
+      return "force";
+    case PARANOID_MODE:
+      return "paranoid";
+  }
+  return "paranoid";
+}
+
 suPHP::Configuration::Configuration()
     :
 #ifdef OPT_LOGFILE
@@ -127,6 +159,14 @@ suPHP::Configuration::Configuration()
       umask{0077},
       chroot_path{""},
       full_php_process_display{false},
+      script_descriptor{false},
+      cgroup_parent{""},
+      cgroup_cpu_weight{0},
+      cgroup_memory_max{""},
+      cgroup_pids_max{0},
+      stage_statistics{""},
+      script_index{""},
+      script_index_state{""},
 #if defined OPT_USERGROUP_OWNER
       mode{OWNER_MODE},
 #elif defined OPT_USERGROUP_FORCE
@@ -135,98 +175,419 @@ suPHP::Configuration::Configuration()
       mode{PARANOID_MODE},
 #endif
       paranoid_uid_check{true},
-      paranoid_gid_check{true} {
+      paranoid_gid_check{true},
+      overrides_dir{""},
+      overrides_index{""},
+      generation{0},
+      identity() {
+}
+
+namespace {
+/**
+ * Builds index over option names
+ */
+NameIndex indexNames(const std::vector<StringView>& names) {
+  NameIndex index;
+  std::vector<StringView> indexed;
+  for (std::vector<StringView>::const_iterator i = names.begin();
+       i != names.end(); i++) {
+    indexed.push_back(*i);
+    index.add(indexed);
+  }
+  return index;
+}
+}  // namespace
+
+// clang-format off
+const Configuration::OptionSpec suPHP::Configuration::options[] = {
+  {"logfile", OPTION_STRING, &Configuration::logfile, NULL, NULL, 0},
+  {"loglevel", OPTION_LOGLEVEL, NULL, NULL, NULL, 0},
+  {"webserver_user", OPTION_STRING, &Configuration::webserver_user, NULL,
+   NULL, 0},
+  {"docroot", OPTION_DOCROOT, NULL, NULL, NULL, 0},
+  {"chroot", OPTION_STRING, &Configuration::chroot_path, NULL, NULL,
+   OPTION_OMIT_EMPTY},
+  {"overrides_dir", OPTION_STRING, &Configuration::overrides_dir, NULL, NULL,
+   OPTION_OMIT_EMPTY},
+  {"overrides_index", OPTION_STRING, &Configuration::overrides_index, NULL,
+   NULL, OPTION_OMIT_EMPTY},
+  {"allow_file_group_writeable", OPTION_BOOL, NULL,
+   &Configuration::allow_file_group_writeable, NULL, OPTION_OVERRIDABLE},
+  {"allow_file_others_writeable", OPTION_BOOL, NULL,
+   &Configuration::allow_file_others_writeable, NULL, OPTION_OVERRIDABLE},
+  {"allow_directory_group_writeable", OPTION_BOOL, NULL,
+   &Configuration::allow_directory_group_writeable, NULL, OPTION_OVERRIDABLE},
+  {"allow_directory_others_writeable", OPTION_BOOL, NULL,
+   &Configuration::allow_directory_others_writeable, NULL, OPTION_OVERRIDABLE},
+  {"mode", OPTION_MODE, NULL, NULL, NULL, 0},
+  {"paranoid_uid_check", OPTION_BOOL, NULL,
+   &Configuration::paranoid_uid_check, NULL, 0},
+  {"paranoid_gid_check", OPTION_BOOL, NULL,
+   &Configuration::paranoid_gid_check, NULL, 0},
+  {"check_vhost_docroot", OPTION_BOOL, NULL,
+   &Configuration::check_vhost_docroot, NULL, 0},
+  {"errors_to_browser", OPTION_BOOL, NULL, &Configuration::errors_to_browser,
+   NULL, 0},
+  {"env_path", OPTION_STRING, &Configuration::env_path, NULL, NULL,
+   OPTION_OVERRIDABLE},
+  {"umask", OPTION_OCTAL, NULL, NULL, &Configuration::umask,
+   OPTION_OVERRIDABLE},
+  {"min_uid", OPTION_INT, NULL, NULL, &Configuration::min_uid, 0},
+  {"min_gid", OPTION_INT, NULL, NULL, &Configuration::min_gid, 0},
+  {"userdir_overrides_usergroup", OPTION_BOOL, NULL,
+   &Configuration::userdir_overrides_usergroup, NULL, 0},
+  {"full_php_process_display", OPTION_BOOL, NULL,
+   &Configuration::full_php_process_display, NULL, 0},
+  {"script_descriptor", OPTION_BOOL, NULL, &Configuration::script_descriptor,
+   NULL, 0},
+  {"cgroup_parent", OPTION_STRING, &Configuration::cgroup_parent, NULL, NULL,
+   OPTION_OMIT_EMPTY},
+  {"cgroup_cpu_weight", OPTION_INT, NULL, NULL,
+   &Configuration::cgroup_cpu_weight, 0},
+  {"cgroup_memory_max", OPTION_STRING, &Configuration::cgroup_memory_max,
+   NULL, NULL, OPTION_OMIT_EMPTY},
+  {"cgroup_pids_max", OPTION_INT, NULL, NULL, &Configuration::cgroup_pids_max,
+   0},
+  {"stage_statistics", OPTION_STRING, &Configuration::stage_statistics, NULL,
+   NULL, OPTION_OMIT_EMPTY},
+  {"script_index", OPTION_STRING, &Configuration::script_index, NULL, NULL,
+   OPTION_OMIT_EMPTY},
+  {"script_index_state", OPTION_STRING, &Configuration::script_index_state,
+   NULL, NULL, OPTION_OMIT_EMPTY},
+  {NULL, OPTION_STRING, NULL, NULL, NULL, 0}};
+// clang-format on
+
+std::vector<StringView> suPHP::Configuration::getOptionNames() {
+  std::vector<StringView> names;
+  for (const OptionSpec* option = options; option->name != NULL; option++) {
+    names.push_back(option->name);
+  }
+  return names;
+}
+
+const Configuration::OptionSpec* suPHP::Configuration::findOption(
+    const StringView& key) {
+  // The index is built once per process, lookups are a single hash probe
+  static const std::vector<StringView> names = getOptionNames();
+  static const NameIndex index = indexNames(names);
+  long pos = index.find(key, names);
+  return pos == -1 ? NULL : &options[pos];
+}
+
+void suPHP::Configuration::setOption(const OptionSpec& option,
+                                     const std::vector<StringView>& values) {
+  const std::string value = values.front().str();
+
+  switch (option.type) {
+    case OPTION_STRING:
+      this->*option.stringMember = value;
+      break;
+    case OPTION_BOOL:
+      this->*option.boolMember = this->strToBool(value);
+      break;
+    case OPTION_INT:
+      this->*option.intMember = Util::strToInt(value);
+      break;
+    case OPTION_OCTAL:
+      this->*option.intMember = Util::octalStrToInt(value);
+      break;
+    case OPTION_DOCROOT:
+      this->docroots.assign(values.begin(), values.end());
+      break;
+    case OPTION_LOGLEVEL:
+      this->loglevel = this->strToLogLevel(value);
+      break;
+    case OPTION_MODE:
+      this->mode = this->strToMode(value);
+      break;
+  }
+}
+
+void suPHP::Configuration::setOption(const StringView& key,
+                                     const std::vector<StringView>& values) {
+  const OptionSpec* option = findOption(key);
+  if (option == NULL) {
+    throw ParsingException(
+        "Unknown option \"" + key.str() + "\" in section [global]", __FILE__,
+        __LINE__);
+  }
+  this->setOption(*option, values);
+}
+
+std::string suPHP::Configuration::formatOption(const OptionSpec& option) const {
+  switch (option.type) {
+    case OPTION_STRING:
+      return IniFile::escapeValue(this->*option.stringMember);
+    case OPTION_BOOL:
+      return this->*option.boolMember ? "true" : "false";
+    case OPTION_INT:
+      return Util::intToStr(this->*option.intMember);
+    case OPTION_OCTAL:
+      return Util::intToOctalStr(this->*option.intMember);
+    case OPTION_DOCROOT: {
+      std::string docroot;
+      for (std::vector<std::string>::const_iterator i = this->docroots.begin();
+           i != this->docroots.end(); i++) {
+        if (i != this->docroots.begin()) docroot += ":";
+        docroot += IniFile::escapeValue(*i);
+      }
+      return docroot;
+    }
+    case OPTION_LOGLEVEL:
+      return this->logLevelToStr(this->loglevel);
+    case OPTION_MODE:
+      return this->modeToStr(this->mode);
+  }
+  return std::string();
+}
+
+bool suPHP::Configuration::isOverridableOption(const StringView& key) const {
+  const OptionSpec* option = findOption(key);
+  return option != NULL && (option->flags & OPTION_OVERRIDABLE) != 0;
 }
 
 void suPHP::Configuration::readFromFile(File& file) {
-  IniFile ini;
-  ini.parse(file);
-  if (ini.hasSection("global")) {
-    const IniSection& sect = ini.getSection("global");
-    const std::vector<std::string> keys = sect.getKeys();
-    std::vector<std::string>::const_iterator i;
+  // Each request uses a single handler, so the handler sections are
+  // only indexed here and entries are decoded when they are looked up
+  std::vector<std::string> lazySections;
+  lazySections.push_back("handlers");
+  lazySections.push_back("phprc_paths");
+  std::shared_ptr<IniFile> ini(new IniFile());
+  ini->parse(file, lazySections);
+
+  const FileIdentity& identity = ini->getIdentity();
+  uint64_t hash = Util::hashBytes(&identity.device, sizeof(identity.device));
+  hash = Util::hashBytes(&identity.inode, sizeof(identity.inode), hash);
+  hash = Util::hashBytes(&identity.mtime, sizeof(identity.mtime), hash);
+  hash =
+      Util::hashBytes(&identity.mtime_nsec, sizeof(identity.mtime_nsec), hash);
+  hash = Util::hashBytes(&identity.size, sizeof(identity.size), hash);
+  this->generation = hash;
+  this->identity = identity;
+
+  if (ini->hasSection("global")) {
+    const IniSection& sect = ini->getSection("global");
+    const std::vector<StringView>& keys = sect.getKeys();
+    std::vector<StringView>::const_iterator i;
     for (i = keys.begin(); i < keys.end(); i++) {
-      std::string key = *i;
-      std::string value = sect.getValue(key);
-
-      if (key == "logfile")
-        this->logfile = value;
-      else if (key == "webserver_user")
-        this->webserver_user = value;
-      else if (key == "docroot") {
-        this->docroots = sect.getValues(key);
-      } else if (key == "allow_file_group_writeable")
-        this->allow_file_group_writeable = this->strToBool(value);
-      else if (key == "allow_directory_group_writeable")
-        this->allow_directory_group_writeable = this->strToBool(value);
-      else if (key == "allow_file_others_writeable")
-        this->allow_file_others_writeable = this->strToBool(value);
-      else if (key == "allow_directory_others_writeable")
-        this->allow_directory_others_writeable = this->strToBool(value);
-      else if (key == "check_vhost_docroot")
-        this->check_vhost_docroot = this->strToBool(value);
-      else if (key == "userdir_overrides_usergroup")
-        this->userdir_overrides_usergroup = this->strToBool(value);
-      else if (key == "errors_to_browser")
-        this->errors_to_browser = this->strToBool(value);
-      else if (key == "env_path")
-        this->env_path = value;
-      else if (key == "loglevel")
-        this->loglevel = this->strToLogLevel(value);
-      else if (key == "min_uid")
-        this->min_uid = Util::strToInt(value);
-      else if (key == "min_gid")
-        this->min_gid = Util::strToInt(value);
-      else if (key == "umask")
-        this->umask = Util::octalStrToInt(value);
-      else if (key == "chroot")
-        this->chroot_path = value;
-      else if (key == "full_php_process_display")
-        this->full_php_process_display = this->strToBool(value);
-      else if (key == "mode")
-        this->mode = this->strToMode(value);
-      else if (key == "paranoid_gid_check")
-        this->paranoid_gid_check = this->strToBool(value);
-      else if (key == "paranoid_uid_check")
-        this->paranoid_uid_check = this->strToBool(value);
-      else
-        throw ParsingException(
-            "Unknown option \"" + key + "\" in section [global]", __FILE__,
-            __LINE__);
+      this->setOption(*i, sect.getValues(*i));
     }
   }
 
-  // Get handlers / interpreters
-  if (ini.hasSection("handlers")) {
-    IniSection sect = ini.getSection("handlers");
-    const std::vector<std::string> keys = sect.getKeys();
-    std::vector<std::string>::const_iterator i;
-    for (i = keys.begin(); i < keys.end(); i++) {
-      std::string key = *i;
-      std::string value = sect.getValue(key);
-      std::pair<std::string, std::string> p;
-      p.first = key;
-      p.second = value;
-      this->handlers.insert(p);
+  this->ini = ini;
+  this->phprc_overrides.clear();
+}
+
+void suPHP::Configuration::dump(std::ostream& out) const {
+  out << "; generation " << Util::hashToStr(this->generation) << "\n"
+      << "[global]\n";
+  for (const OptionSpec* option = options; option->name != NULL; option++) {
+    if ((option->flags & OPTION_OMIT_EMPTY) != 0 &&
+        (this->*option->stringMember).empty()) {
+      continue;
     }
+    out << option->name << "=" << this->formatOption(*option) << "\n";
   }
 
-  // Get configured phprc_paths
-  if (ini.hasSection("phprc_paths")) {
-    IniSection sect = ini.getSection("phprc_paths");
-    std::vector<std::string> keys = sect.getKeys();
-    std::vector<std::string>::iterator i;
-    for (i = keys.begin(); i < keys.end(); i++) {
-      std::string key = *i;
-      std::string value = sect.getValue(key);
-      std::pair<std::string, std::string> p;
-      p.first = key;
-      p.second = value;
-      this->phprc_paths.insert(p);
+  out << "\n[handlers]\n";
+  const std::vector<std::string> handlers = this->getHandlerNames();
+  for (std::vector<std::string>::const_iterator i = handlers.begin();
+       i != handlers.end(); i++) {
+    out << *i << "=" << IniFile::escapeValue(this->getInterpreter(*i))
+        << "\n";
+  }
+
+  std::map<std::string, std::string> phprc_paths;
+  if (this->ini && this->ini->hasSection("phprc_paths")) {
+    const IniSection& sect = this->ini->getSection("phprc_paths");
+    const std::vector<StringView>& keys = sect.getKeys();
+    for (std::vector<StringView>::const_iterator i = keys.begin();
+         i != keys.end(); i++) {
+      phprc_paths[i->str()] = this->getPHPRCPath(i->str());
+    }
+  }
+  phprc_paths.insert(this->phprc_overrides.begin(), this->phprc_overrides.end());
+  out << "\n[phprc_paths]\n";
+  for (std::map<std::string, std::string>::const_iterator i =
+           phprc_paths.begin();
+       i != phprc_paths.end(); i++) {
+    out << i->first << "=" << IniFile::escapeValue(i->second) << "\n";
+  }
+}
+
+std::string suPHP::Configuration::overrideDocrootKey(
+    const std::string& docroot) const {
+  std::string::size_type end = docroot.find_last_not_of('/');
+  if (end == std::string::npos) {
+    return "docroot:/";
+  }
+  return "docroot:" + docroot.substr(0, end + 1);
+}
+
+std::string suPHP::Configuration::overrideLine(const std::string& section,
+                                              const std::string& key,
+                                              const std::string& value) const {
+  if (key.find_first_of("\t\n") != std::string::npos ||
+      value.find_first_of("\t\n") != std::string::npos) {
+    throw ParsingException("Tab character in override \"" + key + "\"",
+                           __FILE__, __LINE__);
+  }
+  return section + "\t" + key + "\t" + value + "\n";
+}
+
+void suPHP::Configuration::applyOverrideRecord(const std::string& record) {
+  std::string::size_type start = 0;
+  while (start < record.length()) {
+    std::string::size_type end = record.find('\n', start);
+    std::string::size_type tab1 = record.find('\t', start);
+    std::string::size_type tab2 = record.find('\t', tab1 + 1);
+    if (end == std::string::npos || tab1 >= end || tab2 >= end) {
+      throw ParsingException("Malformed override record", __FILE__, __LINE__);
+    }
+    std::string section = record.substr(start, tab1 - start);
+    std::string key = record.substr(tab1 + 1, tab2 - tab1 - 1);
+    std::string value = record.substr(tab2 + 1, end - tab2 - 1);
+    if (section == "global" && this->isOverridableOption(key)) {
+      this->setOption(key, std::vector<StringView>(1, value));
+    } else if (section == "phprc_paths") {
+      this->phprc_overrides[key] = value;
+    } else {
+      throw ParsingException("Invalid option \"" + key + "\" in override record",
+                             __FILE__, __LINE__);
     }
+    start = end + 1;
   }
 }
 
+void suPHP::Configuration::applyOverrides(const UserInfo& user,
+                                          const std::string& docroot) {
+  if (this->overrides_index.empty()) {
+    return;
+  }
+  File indexFile(this->overrides_index);
+  if (!indexFile.exists()) {
+    return;
+  }
+  UserInfo owner = indexFile.getUser();
+  if (!owner.isSuperUser() || indexFile.hasGroupWriteBit() ||
+      indexFile.hasOthersWriteBit()) {
+    throw SecurityException("Overrides index \"" + indexFile.getPath() +
+                                "\" is not exclusively writeable by root",
+                            __FILE__, __LINE__);
+  }
+
+  // Per-docroot settings are more specific than per-user settings, so
+  // they are applied last
+  IndexFile index(indexFile);
+  std::string record;
+  if (index.lookup("uid:" + Util::intToStr(user.getUid()), record)) {
+    this->applyOverrideRecord(record);
+  }
+  if (!docroot.empty() &&
+      index.lookup(this->overrideDocrootKey(docroot), record)) {
+    this->applyOverrideRecord(record);
+  }
+}
+
+int suPHP::Configuration::compileOverrides() const {
+  API& api = API_Helper::getSystemAPI();
+  std::map<std::string, std::string> records;
+  std::map<std::string, std::string> origins;
+
+  if (this->overrides_dir.empty() || this->overrides_index.empty()) {
+    throw ParsingException(
+        "Options \"overrides_dir\" and \"overrides_index\" have to be set",
+        __FILE__, __LINE__);
+  }
+
+  File dir(this->overrides_dir);
+  const std::vector<std::string> entries = dir.getDirectoryEntries();
+  for (std::vector<std::string>::const_iterator i = entries.begin();
+       i != entries.end(); i++) {
+    if (i->length() <= 5 || i->substr(i->length() - 5) != ".conf") {
+      continue;
+    }
+    File source(dir.getPath() + "/" + *i);
+    IniFile ini;
+    Configuration scratch;
+    std::string payload;
+    ini.parse(source);
+
+    if (!ini.hasSection("match")) {
+      throw ParsingException("No [match] section in " + source.getPath(),
+                             __FILE__, __LINE__);
+    }
+
+    if (ini.hasSection("global")) {
+      const IniSection& sect = ini.getSection("global");
+      const std::vector<StringView>& keys = sect.getKeys();
+      for (std::vector<StringView>::const_iterator k = keys.begin();
+           k != keys.end(); k++) {
+        if (!this->isOverridableOption(*k)) {
+          throw ParsingException("Option \"" + k->str() +
+                                     "\" cannot be overridden in " +
+                                     source.getPath(),
+                                 __FILE__, __LINE__);
+        }
+        // Let the option parser validate the value
+        scratch.setOption(*k, sect.getValues(*k));
+        payload += this->overrideLine("global", *k, sect.getValue(*k));
+      }
+    }
+
+    if (ini.hasSection("phprc_paths")) {
+      const IniSection& sect = ini.getSection("phprc_paths");
+      const std::vector<StringView>& keys = sect.getKeys();
+      for (std::vector<StringView>::const_iterator k = keys.begin();
+           k != keys.end(); k++) {
+        payload += this->overrideLine("phprc_paths", *k, sect.getValue(*k));
+      }
+    }
+
+    const IniSection& match = ini.getSection("match");
+    const std::vector<StringView>& keys = match.getKeys();
+    for (std::vector<StringView>::const_iterator k = keys.begin();
+         k != keys.end(); k++) {
+      const std::vector<StringView>& values = match.getValues(*k);
+      for (std::vector<StringView>::const_iterator v = values.begin();
+           v != values.end(); v++) {
+        std::string key;
+        if (*k == "user") {
+          key = "uid:" + Util::intToStr(api.getUserInfo(*v).getUid());
+        } else if (*k == "uid") {
+          key = "uid:" + Util::intToStr(Util::strToInt(*v));
+        } else if (*k == "docroot" && (*v)[0] == '/') {
+          key = this->overrideDocrootKey(*v);
+        } else {
+          throw ParsingException("Invalid match \"" + k->str() + "=" +
+                                     v->str() +
+                                     "\" in " + source.getPath(),
+                                 __FILE__, __LINE__);
+        }
+        if (origins.find(key) != origins.end()) {
+          throw ParsingException("Match \"" + key + "\" in " +
+                                     source.getPath() + " already used in " +
+                                     origins[key],
+                                 __FILE__, __LINE__);
+        }
+        origins[key] = source.getPath();
+        records[key] = payload;
+      }
+    }
+  }
+
+  IndexFile::write(File(this->overrides_index), records);
+  return records.size();
+}
+
+uint64_t suPHP::Configuration::getGeneration() const {
+  return this->generation;
+}
+
+FileIdentity suPHP::Configuration::getIdentity() const {
+  return this->identity;
+}
+
 std::string suPHP::Configuration::getLogfile() const { return this->logfile; }
 
 LogLevel suPHP::Configuration::getLogLevel() const { return this->loglevel; }
@@ -239,6 +600,30 @@ const std::vector<std::string>& suPHP::Configuration::getDocroots() const {
   return this->docroots;
 }
 
+std::vector<File> suPHP::Configuration::getDocrootDirectories() const {
+  std::set<std::string> prefixes;
+  for (std::vector<std::string>::const_iterator i = this->docroots.begin();
+       i != this->docroots.end(); i++) {
+    std::string prefix = i->substr(0, i->find_first_of("*$"));
+    if (prefix.length() < i->length()) {
+      prefix = prefix.substr(0, prefix.rfind('/'));
+    }
+    prefixes.insert(prefix.empty() ? "/" : prefix);
+  }
+
+  // Leave out directories below another one, which sort after it
+  std::vector<File> directories;
+  std::string parent;
+  for (std::set<std::string>::const_iterator i = prefixes.begin();
+       i != prefixes.end(); i++) {
+    if (parent.empty() || i->compare(0, parent.length(), parent) != 0) {
+      directories.push_back(File(*i));
+      parent = *i == "/" ? *i : *i + "/";
+    }
+  }
+  return directories;
+}
+
 bool suPHP::Configuration::getCheckVHostDocroot() const {
   return this->check_vhost_docroot;
 }
@@ -267,6 +652,10 @@ bool suPHP::Configuration::getFullPHPProcessDisplay() const {
   return this->full_php_process_display;
 }
 
+bool suPHP::Configuration::getScriptDescriptor() const {
+  return this->script_descriptor;
+}
+
 SetidMode suPHP::Configuration::getMode() const { return this->mode; }
 
 bool suPHP::Configuration::getParanoidUIDCheck() const {
@@ -284,20 +673,42 @@ bool suPHP::Configuration::getErrorsToBrowser() const {
 std::string suPHP::Configuration::getEnvPath() const { return this->env_path; }
 
 std::string suPHP::Configuration::getInterpreter(std::string handler) const {
-  if (this->handlers.find(handler) != this->handlers.end()) {
-    return this->handlers.find(handler)->second;
-  } else {
-    throw KeyNotFoundException("Handler \"" + handler + "\" not found",
-                               __FILE__, __LINE__);
+  if (this->ini && this->ini->hasSection("handlers")) {
+    const IniSection& sect = this->ini->getSection("handlers");
+    if (sect.hasKey(handler)) {
+      return this->ini->decodeValues(sect, handler).front();
+    }
+  }
+  throw KeyNotFoundException("Handler \"" + handler + "\" not found",
+                             __FILE__, __LINE__);
+}
+
+std::vector<std::string> suPHP::Configuration::getHandlerNames() const {
+  std::vector<std::string> names;
+  if (this->ini && this->ini->hasSection("handlers")) {
+    const IniSection& sect = this->ini->getSection("handlers");
+    const std::vector<StringView>& keys = sect.getKeys();
+    for (std::vector<StringView>::const_iterator i = keys.begin();
+         i != keys.end(); i++) {
+      if (sect.hasKey(*i)) names.push_back(i->str());
+    }
   }
+  std::sort(names.begin(), names.end());
+  return names;
 }
 
 std::string suPHP::Configuration::getPHPRCPath(std::string handler) const {
-  if (this->phprc_paths.find(handler) != this->phprc_paths.end()) {
-    return this->phprc_paths.find(handler)->second;
-  } else {
-    return std::string();
+  // Entries set by overrides take precedence over the configuration file
+  if (this->phprc_overrides.find(handler) != this->phprc_overrides.end()) {
+    return this->phprc_overrides.find(handler)->second;
+  }
+  if (this->ini && this->ini->hasSection("phprc_paths")) {
+    const IniSection& sect = this->ini->getSection("phprc_paths");
+    if (sect.hasKey(handler)) {
+      return this->ini->decodeValues(sect, handler).front();
+    }
   }
+  return std::string();
 }
 
 int suPHP::Configuration::getMinUid() const { return this->min_uid; }
@@ -309,3 +720,35 @@ int suPHP::Configuration::getUmask() const { return this->umask; }
 std::string suPHP::Configuration::getChrootPath() const {
   return this->chroot_path;
 }
+
+std::string suPHP::Configuration::getCgroupParent() const {
+  return this->cgroup_parent;
+}
+
+int suPHP::Configuration::getCgroupCpuWeight() const {
+  return this->cgroup_cpu_weight;
+}
+
+std::string suPHP::Configuration::getCgroupMemoryMax() const {
+  return this->cgroup_memory_max;
+}
+
+int suPHP::Configuration::getCgroupPidsMax() const {
+  return this->cgroup_pids_max;
+}
+
+std::string suPHP::Configuration::getStageStatistics() const {
+  return this->stage_statistics;
+}
+
+std::string suPHP::Configuration::getScriptIndex() const {
+  return this->script_index;
+}
+
+std::string suPHP::Configuration::getScriptIndexState() const {
+  return this->script_index_state;
+}
+
+std::string suPHP::Configuration::getOverridesIndex() const {
+  return this->overrides_index;
+}
@@ -27,16 +27,22 @@ class Configuration;
 
 #define SUPHP_CONFIGURATION_H
 
+#include <cstdint>
 #include <map>
+#include <memory>
+#include <ostream>
 #include <string>
 #include <vector>
 
 #include "config.h"
 #include "File.hpp"
 #include "IOException.hpp"
+#include "IniFile.hpp"
 #include "KeyNotFoundException.hpp"
 #include "Logger.hpp"
 #include "ParsingException.hpp"
+#include "StringView.hpp"
+#include "UserInfo.hpp"
 
 namespace suPHP {
 
@@ -58,17 +64,29 @@ class Configuration {
   bool userdir_overrides_usergroup;
   bool errors_to_browser;
   std::string env_path;
-  std::map<std::string, std::string> handlers;
-  std::map<std::string, std::string> phprc_paths;
+  std::shared_ptr<IniFile> ini;
+  std::map<std::string, std::string> phprc_overrides;
   LogLevel loglevel;
   int min_uid;
   int min_gid;
   int umask;
   std::string chroot_path;
   bool full_php_process_display;
+  bool script_descriptor;
+  std::string cgroup_parent;
+  int cgroup_cpu_weight;
+  std::string cgroup_memory_max;
+  int cgroup_pids_max;
+  std::string stage_statistics;
+  std::string script_index;
+  std::string script_index_state;
   SetidMode mode;
   bool paranoid_uid_check;
   bool paranoid_gid_check;
+  std::string overrides_dir;
+  std::string overrides_index;
+  uint64_t generation;
+  FileIdentity identity;
 
   /**
    * Converts string to bool
@@ -85,6 +103,106 @@ class Configuration {
    */
   SetidMode strToMode(const std::string& str) const;
 
+  /**
+   * Value types of options in the [global] section
+   */
+  enum OptionType {
+    OPTION_STRING,
+    OPTION_BOOL,
+    OPTION_INT,
+    OPTION_OCTAL,
+    OPTION_DOCROOT,
+    OPTION_LOGLEVEL,
+    OPTION_MODE
+  };
+
+  /**
+   * Flags of options in the [global] section
+   */
+  enum OptionFlags {
+    // May be set by per-user or per-docroot overrides
+    OPTION_OVERRIDABLE = 1,
+    // Left out of dump() while the value is empty
+    OPTION_OMIT_EMPTY = 2
+  };
+
+  /**
+   * Entry of the table of options in the [global] section. Only the
+   * member pointer matching the type is set.
+   */
+  struct OptionSpec {
+    const char* name;
+    OptionType type;
+    std::string Configuration::*stringMember;
+    bool Configuration::*boolMember;
+    int Configuration::*intMember;
+    int flags;
+  };
+
+  /**
+   * Table of options in the [global] section, in dump() order and
+   * terminated by an entry without name
+   */
+  static const OptionSpec options[];
+
+  /**
+   * Returns names of the options in the option table
+   */
+  static std::vector<StringView> getOptionNames();
+
+  /**
+   * Returns option table entry for key or NULL if there is none
+   */
+  static const OptionSpec* findOption(const StringView& key);
+
+  /**
+   * Sets option described by a table entry
+   */
+  void setOption(const OptionSpec& option,
+                 const std::vector<StringView>& values);
+
+  /**
+   * Sets option from [global] section
+   */
+  void setOption(const StringView& key,
+                 const std::vector<StringView>& values);
+
+  /**
+   * Returns value of an option in INI file syntax
+   */
+  std::string formatOption(const OptionSpec& option) const;
+
+  /**
+   * Checks whether option may be set by per-user or per-docroot overrides
+   */
+  bool isOverridableOption(const StringView& key) const;
+
+  /**
+   * Returns the overrides index key for a docroot
+   */
+  std::string overrideDocrootKey(const std::string& docroot) const;
+
+  /**
+   * Serializes a single option for an override record
+   */
+  std::string overrideLine(const std::string& section, const std::string& key,
+                           const std::string& value) const;
+
+  /**
+   * Applies options from an override record
+   */
+  void applyOverrideRecord(const std::string& record);
+
+  /**
+   * Converts LogLevel to string
+   */
+  std::string logLevelToStr(LogLevel level) const;
+
+  /**
+   * Converts SetidMode to string
+   */
+  std::string modeToStr(SetidMode mode) const;
+
  public:
   /**
    * Constructor, initializes configuration with default values.
@@ -96,6 +214,36 @@ class Configuration {
    */
   void readFromFile(File& file);
 
+  /**
+   * Applies per-user and per-docroot overrides from the compiled
+   * overrides index, if one is configured
+   */
+  void applyOverrides(const UserInfo& user, const std::string& docroot);
+
+  /**
+   * Compiles the files in the overrides directory into the overrides
+   * index. Returns the number of keys written.
+   */
+  int compileOverrides() const;
+
+  /**
+   * Writes the effective configuration in INI file syntax
+   */
+  void dump(std::ostream& out) const;
+
+  /**
+   * Returns generation of the configuration, derived from the identity
+   * (device, inode, mtime, size) of the file it was read from.
+   * Anything cached on behalf of this configuration has to be keyed on
+   * this value. Zero if no file has been read.
+   */
+  uint64_t getGeneration() const;
+
+  /**
+   * Returns the identity of the file the configuration was read from
+   */
+  FileIdentity getIdentity() const;
+
   /**
    * Return path to logfile;
    */
@@ -116,6 +264,13 @@ class Configuration {
    */
   const std::vector<std::string>& getDocroots() const;
 
+  /**
+   * Returns the directories the docroots are in: each pattern up to the
+   * directory above its first "*" or variable, without the directories
+   * below another one returned
+   */
+  std::vector<File> getDocrootDirectories() const;
+
   /**
    * Returns wheter suPHP should check if scripts in within the
    * document root of the VHost
@@ -158,6 +313,12 @@ class Configuration {
    */
   bool getFullPHPProcessDisplay() const;
 
+  /**
+   * Returns whether the script is passed to the interpreter as a
+   * descriptor opened by suPHP (/dev/fd/N)
+   */
+  bool getScriptDescriptor() const;
+
   /**
    * Returns the configured mode for UID/GID determination and
    * ownership checks
@@ -187,15 +348,23 @@ class Configuration {
   std::string getEnvPath() const;
 
   /**
-   * Returns phprc_path string for the specified handler
+   * Returns phprc_path string for the specified handler. Only the
+   * requested entry of the [phprc_paths] section is decoded.
    */
   std::string getPHPRCPath(std::string handler) const;
 
   /**
-   * Returns interpreter string for specified handler
+   * Returns interpreter string for specified handler. Only the requested
+   * entry of the [handlers] section is decoded, so errors in other
+   * entries are not reported.
    */
   std::string getInterpreter(std::string handler) const;
 
+  /**
+   * Returns names of all configured handlers
+   */
+  std::vector<std::string> getHandlerNames() const;
+
   /**
    * Returns minimum UID allowed for scripts
    */
@@ -215,6 +384,51 @@ class Configuration {
    * Return chroot path
    */
   std::string getChrootPath() const;
+
+  /**
+   * Returns the cgroup v2 directory under which each target user gets a
+   * cgroup, or an empty string if scripts are not placed in cgroups
+   */
+  std::string getCgroupParent() const;
+
+  /**
+   * Returns the cpu.weight of the cgroup of a user, 0 if not set
+   */
+  int getCgroupCpuWeight() const;
+
+  /**
+   * Returns the memory.max of the cgroup of a user, empty if not set
+   */
+  std::string getCgroupMemoryMax() const;
+
+  /**
+   * Returns the pids.max of the cgroup of a user, 0 if not set
+   */
+  int getCgroupPidsMax() const;
+
+  /**
+   * Returns the file shared with mod_suphp in which the time spent in
+   * each stage is recorded, or an empty string if it is not recorded
+   */
+  std::string getStageStatistics() const;
+
+  /**
+   * Returns the index written by "suphp --index", or an empty string if
+   * no index is used
+   */
+  std::string getScriptIndex() const;
+
+  /**
+   * Returns the file shared with suphp-cached, or an empty string if the
+   * docroots are not watched
+   */
+  std::string getScriptIndexState() const;
+
+  /**
+   * Returns the compiled overrides index, or an empty string if the
+   * options are not overridden per user or docroot
+   */
+  std::string getOverridesIndex() const;
 };
 }  // namespace suPHP
 
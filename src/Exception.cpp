@@ -52,12 +52,14 @@ suPHP::Exception::Exception(std::string message, Exception& cause,
   this->line = line;
 }
 
-std::string suPHP::Exception::getMessage() { return this->message; }
+std::string suPHP::Exception::formatMessage() const { return this->message; }
+
+std::string suPHP::Exception::getMessage() { return this->formatMessage(); }
 
 std::string suPHP::Exception::toString() const {
   std::ostringstream ostr;
   ostr << std::string(this->getName()) << " in " << this->file << ":"
-       << this->line << ": " << this->message << "\n";
+       << this->line << ": " << this->formatMessage() << "\n";
   if (this->backtrace.length() > 0) {
     ostr << "Caused by " << this->backtrace;
   }
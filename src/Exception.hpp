@@ -38,6 +38,12 @@ class Exception {
   std::string file;
   virtual std::string getName() const = 0;
 
+ protected:
+  /**
+   * Returns the message, derived classes may format it on demand
+   */
+  virtual std::string formatMessage() const;
+
  public:
   /**
    * Constructor without message.
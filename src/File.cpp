@@ -47,6 +47,10 @@ bool suPHP::File::exists() const {
   return API_Helper::getSystemAPI().File_exists(*this);
 }
 
+FileIdentity suPHP::File::getIdentity() const {
+  return API_Helper::getSystemAPI().File_getIdentity(*this);
+}
+
 string suPHP::File::getRealPath() const {
   return API_Helper::getSystemAPI().File_getRealPath(*this);
 }
@@ -107,3 +111,11 @@ GroupInfo suPHP::File::getGroup() const {
 bool suPHP::File::isSymlink() const {
   return API_Helper::getSystemAPI().File_isSymlink(*this);
 }
+
+bool suPHP::File::isDirectory() const {
+  return API_Helper::getSystemAPI().File_isDirectory(*this);
+}
+
+vector<string> suPHP::File::getDirectoryEntries() const {
+  return API_Helper::getSystemAPI().File_getDirectoryEntries(*this);
+}
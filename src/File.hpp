@@ -43,6 +43,7 @@ enum FileMode {
 #include <iostream>
 #include <memory>
 #include <string>
+#include <vector>
 
 #include "GroupInfo.hpp"
 #include "IOException.hpp"
@@ -50,6 +51,19 @@ enum FileMode {
 #include "UserInfo.hpp"
 
 namespace suPHP {
+/**
+ * Identity of a file on disk (device, inode, modification time, size).
+ * Two identities compare equal only if the file has not been replaced
+ * or modified in between.
+ */
+struct FileIdentity {
+  unsigned long long device;
+  unsigned long long inode;
+  long long mtime;
+  long long mtime_nsec;
+  long long size;
+};
+
 /**
  * Class encapsulating file information and access.
  */
@@ -79,6 +93,11 @@ class File {
    */
   bool exists() const;
 
+  /**
+   * Returns identity of file (symlinks are followed)
+   */
+  FileIdentity getIdentity() const;
+
   /**
    * Returns real path to file (without symlinks in path)
    */
@@ -148,6 +167,16 @@ class File {
    * Checks whether this file is a symlink
    */
   bool isSymlink() const;
+
+  /**
+   * Checks whether this file is a directory (symlinks are not followed)
+   */
+  bool isDirectory() const;
+
+  /**
+   * Returns names of the entries of this directory
+   */
+  std::vector<std::string> getDirectoryEntries() const;
 };
 }  // namespace suPHP
 
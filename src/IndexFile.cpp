@@ -0,0 +1,153 @@
+/*
+  suPHP - (c)2002-2013 Sebastian Marsching <sebastian@marsching.com>
+          (c)2018 John Lightsey <john@nixnuts.net>
+
+  This file is part of suPHP.
+
+  suPHP is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  suPHP is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with suPHP; if not, write to the Free Software Foundation, Inc.,
+  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+#include "Util.hpp"
+
+#include "IndexFile.hpp"
+
+using namespace suPHP;
+
+namespace {
+const char INDEX_MAGIC[8] = {'S', 'U', 'P', 'H', 'P', 'I', 'D', 'X'};
+const uint32_t INDEX_VERSION = 1;
+
+struct IndexHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t bucketCount;
+};
+
+struct IndexBucket {
+  uint64_t hash;
+  uint32_t offset;  // zero marks an empty bucket
+  uint32_t keyLength;
+  uint32_t valueLength;
+  uint32_t reserved;
+};
+}  // namespace
+
+suPHP::IndexFile::IndexFile(const File& file)
+    : file(file), stream(file.getInputStream()), bucketCount(0) {
+  IndexHeader header;
+  this->readAt(0, &header, sizeof(header));
+  if (::memcmp(header.magic, INDEX_MAGIC, sizeof(INDEX_MAGIC)) != 0 ||
+      header.version != INDEX_VERSION || header.bucketCount == 0) {
+    throw IOException("File " + file.getPath() + " is not a valid index",
+                      __FILE__, __LINE__);
+  }
+  this->bucketCount = header.bucketCount;
+}
+
+void suPHP::IndexFile::readAt(uint64_t offset, void* buffer,
+                              std::size_t length) const {
+  this->stream->clear();
+  this->stream->seekg(offset);
+  this->stream->read(static_cast<char*>(buffer), length);
+  if (this->stream->gcount() != static_cast<std::streamsize>(length)) {
+    throw IOException("Index file " + this->file.getPath() + " is truncated",
+                      __FILE__, __LINE__);
+  }
+}
+
+bool suPHP::IndexFile::lookup(const std::string& key,
+                              std::string& value) const {
+  uint64_t hash = Util::hashBytes(key.data(), key.length());
+  for (uint32_t probe = 0; probe < this->bucketCount; probe++) {
+    IndexBucket bucket;
+    uint32_t slot = (hash + probe) % this->bucketCount;
+    this->readAt(sizeof(IndexHeader) + slot * sizeof(IndexBucket), &bucket,
+                 sizeof(bucket));
+    if (bucket.offset == 0) {
+      return false;
+    }
+    if (bucket.hash != hash || bucket.keyLength != key.length()) {
+      continue;
+    }
+    std::vector<char> record(bucket.keyLength + bucket.valueLength);
+    if (!record.empty()) {
+      this->readAt(bucket.offset, &record[0], record.size());
+    }
+    if (std::string(record.begin(), record.begin() + bucket.keyLength) ==
+        key) {
+      value.assign(record.begin() + bucket.keyLength, record.end());
+      return true;
+    }
+  }
+  return false;
+}
+
+void suPHP::IndexFile::write(
+    const File& file, const std::map<std::string, std::string>& records) {
+  // Keep the load factor below one half, so probe sequences stay short
+  uint32_t bucketCount = records.size() * 2 + 1;
+  std::vector<IndexBucket> buckets(bucketCount);
+  std::string data;
+  uint64_t dataOffset =
+      sizeof(IndexHeader) + bucketCount * sizeof(IndexBucket);
+
+  ::memset(&buckets[0], 0, bucketCount * sizeof(IndexBucket));
+  for (std::map<std::string, std::string>::const_iterator i = records.begin();
+       i != records.end(); i++) {
+    uint64_t hash = Util::hashBytes(i->first.data(), i->first.length());
+    uint32_t slot = hash % bucketCount;
+    while (buckets[slot].offset != 0) {
+      slot = (slot + 1) % bucketCount;
+    }
+    if (dataOffset + data.length() + i->first.length() + i->second.length() >
+        UINT32_MAX) {
+      throw IOException("Too much data for index " + file.getPath(), __FILE__,
+                        __LINE__);
+    }
+    buckets[slot].hash = hash;
+    buckets[slot].offset = dataOffset + data.length();
+    buckets[slot].keyLength = i->first.length();
+    buckets[slot].valueLength = i->second.length();
+    data.append(i->first);
+    data.append(i->second);
+  }
+
+  IndexHeader header;
+  ::memcpy(header.magic, INDEX_MAGIC, sizeof(INDEX_MAGIC));
+  header.version = INDEX_VERSION;
+  header.bucketCount = bucketCount;
+
+  std::string tempPath = file.getPath() + ".tmp";
+  std::ofstream out(tempPath.c_str(), std::ios::binary | std::ios::trunc);
+  out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+  out.write(reinterpret_cast<const char*>(&buckets[0]),
+            bucketCount * sizeof(IndexBucket));
+  out.write(data.data(), data.length());
+  out.close();
+  if (out.fail()) {
+    std::remove(tempPath.c_str());
+    throw IOException("Could not write index file " + tempPath, __FILE__,
+                      __LINE__);
+  }
+  if (std::rename(tempPath.c_str(), file.getPath().c_str()) != 0) {
+    std::remove(tempPath.c_str());
+    throw IOException("Could not replace index file " + file.getPath(),
+                      __FILE__, __LINE__);
+  }
+}
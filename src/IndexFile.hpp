@@ -0,0 +1,72 @@
+/*
+  suPHP - (c)2002-2013 Sebastian Marsching <sebastian@marsching.com>
+          (c)2018 John Lightsey <john@nixnuts.net>
+
+  This file is part of suPHP.
+
+  suPHP is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  suPHP is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with suPHP; if not, write to the Free Software Foundation, Inc.,
+  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#ifndef SUPHP_INDEXFILE_H
+#define SUPHP_INDEXFILE_H
+
+#include <cstdint>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <string>
+
+#include "File.hpp"
+#include "IOException.hpp"
+
+namespace suPHP {
+/**
+ * Class providing read access to a compiled key-value index file.
+ *
+ * The file consists of a header, an open-addressing hash table of
+ * fixed-size buckets and the records the buckets point to, so a lookup
+ * reads a constant number of blocks regardless of the number of records.
+ * Index files are written on the host that reads them, so integers are
+ * stored in host byte order.
+ */
+class IndexFile {
+ private:
+  File file;
+  std::unique_ptr<std::ifstream> stream;
+  uint32_t bucketCount;
+
+  void readAt(uint64_t offset, void* buffer, std::size_t length) const;
+
+ public:
+  /**
+   * Constructor, opens index file and reads header
+   */
+  IndexFile(const File& file);
+
+  /**
+   * Looks up key, stores value and returns true if found
+   */
+  bool lookup(const std::string& key, std::string& value) const;
+
+  /**
+   * Writes records to a new index file, replacing an existing one
+   * atomically
+   */
+  static void write(const File& file,
+                    const std::map<std::string, std::string>& records);
+};
+}  // namespace suPHP
+
+#endif  // SUPHP_INDEXFILE_H
@@ -19,8 +19,8 @@
   51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
 */
 
-#include <fstream>
-#include <sstream>
+#include <cstring>
+#include <deque>
 #include <string>
 #include <vector>
 
@@ -31,200 +31,38 @@
 using namespace suPHP;
 using namespace std;
 
-const IniSection& suPHP::IniFile::getSection(const string& name) const {
-  if (this->sections.find(name) != this->sections.end()) {
-    return this->sections.find(name)->second;
-  } else {
-    throw KeyNotFoundException("Section " + name + " not found", __FILE__,
-                               __LINE__);
-  }
-}
-
-bool suPHP::IniFile::hasSection(const string& name) const {
-  if (this->sections.find(name) != this->sections.end()) {
-    return true;
-  } else {
-    return false;
-  }
-}
+namespace {
+bool isBlank(char c) { return c == ' ' || c == '\t'; }
 
-const IniSection& suPHP::IniFile::operator[](const string& name) const {
-  return this->getSection(name);
+StringView trim(const StringView& str) {
+  const char* begin = str.data();
+  const char* end = begin + str.length();
+  while (begin < end && isBlank(*begin)) begin++;
+  while (end > begin && isBlank(*(end - 1))) end--;
+  return StringView(begin, end - begin);
 }
 
-void suPHP::IniFile::parse(const File& file) {
-  auto is = file.getInputStream();
-  IniSection* current_section = NULL;
-  while (!is->eof() && !is->fail()) {
-    string line;
-    string tstr;
-    string::size_type startpos = 0;
-    string::size_type endpos = 0;
-
-    // Read line from file
-    getline(*is, line);
-
-    tstr = line;
-
-    // Find first char not being space or tab
-    startpos = tstr.find_first_not_of(" \t");
-    // Find last char not being space or tab
-    endpos = tstr.find_last_not_of(" \t");
-
-    // Skip empty line, only containing whitespace
-    if (startpos == string::npos) continue;
-
-    // Get trimmed string
-    tstr = tstr.substr(startpos, endpos - startpos + 1);
-
-    // Is line a comment (starting with ";")?
-    if (tstr[0] == ';') {
-      // Comments are not interessting => skip
-      continue;
-
-      // Is line a section mark ("[section]")?
-    } else if (tstr[0] == '[' && tstr[tstr.size() - 1] == ']') {
-      // Extract name of section
-      string name = tstr.substr(1, tstr.size() - 2);
-      // If section is not yet existing, create it
-      if (!this->hasSection(name)) {
-        pair<string, IniSection> p;
-        IniSection sect;
-        p.first = name;
-        p.second = sect;
-        this->sections.insert(p);
-      }
-      // Set current section
-      current_section = &(this->sections.find(name)->second);
-
-      // Is the line a key-value pair?
-    } else if (tstr.find_first_of('=') != string::npos) {
-      string name;
-      vector<string> values;
-      bool append_mode = false;
-
-      string::size_type eqpos = 0;
-
-      // Check wheter we already have a section
-      if (current_section == NULL) {
-        throw ParsingException(
-            "Option line \"" + tstr + "\" before first section", __FILE__,
-            __LINE__);
-      }
-
-      // Extract name
-      eqpos = tstr.find_first_of('=');
-      if (eqpos == string::npos || eqpos < 1 || eqpos == tstr.length() - 1) {
-        throw ParsingException("Malformed line: " + tstr, __FILE__, __LINE__);
-      }
-      if (tstr[eqpos - 1] == '+') {
-        append_mode = true;
-        name = tstr.substr(0, eqpos - 1);
-      } else {
-        name = tstr.substr(0, eqpos);
-      }
-
-      string::size_type temppos;
-      temppos = name.find_first_not_of(" \t");
-      if (temppos == string::npos) {
-        throw ParsingException("Malformed line: " + tstr, __FILE__, __LINE__);
-      }
-      name = name.substr(0, name.find_last_not_of(" \t") + 1);
-
-      bool in_quotes = false;
-      bool last_was_backslash = false;
-      string::size_type token_start = eqpos + 1;
-
-      for (string::size_type i = eqpos + 1; i < tstr.length(); i++) {
-        bool current_is_backslash = false;
-        if (tstr[i] == '"') {
-          if (!last_was_backslash) {
-            in_quotes = !in_quotes;
-          }
-        } else if (tstr[i] == '\\') {
-          if (!last_was_backslash) {
-            current_is_backslash = true;
-          }
-        } else if (tstr[i] == ':') {
-          if (!in_quotes && !last_was_backslash) {
-            // Save token and begin new one
-            string token = tstr.substr(token_start, i - token_start);
-            try {
-              token = parseValue(token);
-            } catch (ParsingException&) {
-              throw ParsingException("Malformed line: " + tstr, __FILE__,
-                                     __LINE__);
-            }
-            if (token.length() == 0) {
-              throw ParsingException("Malformed line: " + tstr, __FILE__,
-                                     __LINE__);
-            }
-            values.push_back(token);
-            token_start = i + 1;
-          }
-        }
-        if (i == tstr.length() - 1) {
-          if (in_quotes) {
-            throw ParsingException("Unended quotes in line: " + tstr, __FILE__,
-                                   __LINE__);
-          } else if (last_was_backslash) {
-            throw ParsingException(
-                "Multiline values are not supported in line: " + tstr, __FILE__,
-                __LINE__);
-          }
-          string token = tstr.substr(token_start, i + 1 - token_start);
-          try {
-            token = parseValue(token);
-          } catch (ParsingException&) {
-            throw ParsingException("Malformed line: " + tstr, __FILE__,
-                                   __LINE__);
-          }
-          if (token.length() == 0) {
-            throw ParsingException("Malformed line: " + tstr, __FILE__,
-                                   __LINE__);
-          }
-          values.push_back(token);
-        }
-        last_was_backslash = current_is_backslash;
-      }
-
-      if (!append_mode) {
-        current_section->removeValues(name);
-      }
-      for (auto i = values.begin(); i != values.end(); i++) {
-        current_section->putValue(name, *i);
-      }
-
-      // Line is something we do not know
-    } else {
-      throw ParsingException("Malformed line \"" + tstr + "\"", __FILE__,
-                             __LINE__);
-    }
+/**
+ * Removes quotes and escape sequences from a value. Decoded values are
+ * stored in storage, plain values reference rawValue.
+ */
+StringView parseValue(const StringView& rawValue,
+                      std::deque<std::string>& storage) {
+  StringView value = trim(rawValue);
+
+  // Plain values are referenced in place
+  if (::memchr(value.data(), '"', value.length()) == NULL &&
+      ::memchr(value.data(), '\\', value.length()) == NULL) {
+    return value;
   }
-  is->close();
-}
 
-string suPHP::IniFile::parseValue(const string& value) const {
   bool in_quotes = false;
   bool last_was_backslash = false;
-  string tempvalue;
   string output;
-
-  string::size_type startpos = value.find_first_not_of(" \t");
-  string::size_type endpos = value.find_last_not_of(" \t");
-  if (startpos == string::npos) {
-    return "";
-  }
-  if (endpos == string::npos) {
-    tempvalue = value;
-  } else {
-    tempvalue = value.substr(startpos, endpos - startpos + 1);
-  }
-
-  for (string::size_type i = 0; i < value.length(); i++) {
+  for (std::size_t i = 0; i < value.length(); i++) {
     bool current_is_backslash = false;
 
-    if (tempvalue[i] == '"') {
+    if (value[i] == '"') {
       if (last_was_backslash) {
         output.append("\"");
       } else {
@@ -232,30 +70,250 @@ string suPHP::IniFile::parseValue(const string& value) const {
           throw ParsingException("Content preceding quoted content", __FILE__,
                                  __LINE__);
         }
-        if (in_quotes && i != tempvalue.length() - 1) {
+        if (in_quotes && i != value.length() - 1) {
           throw ParsingException("Content following quoted content", __FILE__,
                                  __LINE__);
         }
         in_quotes = !in_quotes;
       }
-    } else if (tempvalue[i] == '\\') {
+    } else if (value[i] == '\\') {
       if (last_was_backslash) {
         output.append("\\");
       } else {
         current_is_backslash = true;
       }
-    } else if (tempvalue[i] == ':') {
+    } else if (value[i] == ':') {
       output.append(":");
     } else {
       if (last_was_backslash) {
         throw ParsingException("Illegal character after backslash", __FILE__,
                                __LINE__);
       }
-      output.append(tempvalue.substr(i, 1));
+      output.append(1, value[i]);
     }
 
     last_was_backslash = current_is_backslash;
   }
 
+  storage.push_back(output);
+  return StringView(storage.back());
+}
+
+/**
+ * Splits the value following position start of line into tokens at
+ * colons that are neither quoted nor escaped and decodes the tokens
+ */
+void splitValues(const StringView& line, std::size_t start,
+                 std::deque<std::string>& storage,
+                 std::vector<StringView>& values) {
+  bool in_quotes = false;
+  bool last_was_backslash = false;
+  std::size_t token_start = start;
+  for (std::size_t i = start; i <= line.length(); i++) {
+    if (i == line.length() && last_was_backslash) {
+      throw ParsingException(
+          "Multiline values are not supported in line: " + line.str(),
+          __FILE__, __LINE__);
+    }
+    if (i == line.length() || (line[i] == ':' && !in_quotes &&
+                               !last_was_backslash)) {
+      StringView token;
+      try {
+        token = parseValue(
+            StringView(line.data() + token_start, i - token_start), storage);
+      } catch (ParsingException&) {
+        throw ParsingException("Malformed line: " + line.str(), __FILE__,
+                               __LINE__);
+      }
+      if (token.empty()) {
+        throw ParsingException("Malformed line: " + line.str(), __FILE__,
+                               __LINE__);
+      }
+      values.push_back(token);
+      token_start = i + 1;
+      last_was_backslash = false;
+      continue;
+    }
+    if (line[i] == '"' && !last_was_backslash) {
+      in_quotes = !in_quotes;
+    }
+    last_was_backslash = line[i] == '\\' && !last_was_backslash;
+  }
+  if (in_quotes) {
+    throw ParsingException("Unended quotes in line: " + line.str(), __FILE__,
+                           __LINE__);
+  }
+}
+}  // namespace
+
+const IniSection& suPHP::IniFile::getSection(const StringView& name) const {
+  long pos = this->index.find(name, this->sectionNames);
+  if (pos == -1) {
+    throw KeyNotFoundException("Section " + name.str() + " not found",
+                               __FILE__, __LINE__);
+  }
+  return this->sections[pos];
+}
+
+bool suPHP::IniFile::hasSection(const StringView& name) const {
+  return this->index.find(name, this->sectionNames) != -1;
+}
+
+const IniSection& suPHP::IniFile::operator[](const StringView& name) const {
+  return this->getSection(name);
+}
+
+const vector<StringView>& suPHP::IniFile::getSections() const {
+  return this->sectionNames;
+}
+
+const FileIdentity& suPHP::IniFile::getIdentity() const {
+  if (!this->mapping) {
+    throw IOException("No file has been parsed", __FILE__, __LINE__);
+  }
+  return this->mapping->getIdentity();
+}
+
+void suPHP::IniFile::parse(const File& file) {
+  this->parse(file, std::vector<std::string>());
+}
+
+void suPHP::IniFile::parse(const File& file,
+                           const std::vector<std::string>& lazySections) {
+  this->mapping.reset(new MappedFile(file));
+  this->lazySections = lazySections;
+  this->decodedValues.clear();
+  this->sectionNames.clear();
+  this->sections.clear();
+  this->index = NameIndex();
+
+  const char* pos = this->mapping->getData();
+  const char* end = pos + this->mapping->getSize();
+  long currentSection = -1;
+  while (pos < end) {
+    const char* eol = static_cast<const char*>(::memchr(pos, '\n', end - pos));
+    if (eol == NULL) eol = end;
+    this->parseLine(StringView(pos, eol - pos), currentSection);
+    pos = eol + 1;
+  }
+}
+
+void suPHP::IniFile::parseLine(const StringView& rawLine,
+                               long& currentSection) {
+  StringView line = trim(rawLine);
+
+  // Skip empty line, only containing whitespace
+  if (line.empty()) return;
+
+  // Is line a comment (starting with ";")?
+  if (line[0] == ';') {
+    // Comments are not interessting => skip
+    return;
+  }
+
+  // Is line a section mark ("[section]")?
+  if (line.length() >= 2 && line[0] == '[' &&
+      line[line.length() - 1] == ']') {
+    StringView name(line.data() + 1, line.length() - 2);
+    // If section is not yet existing, create it
+    currentSection = this->index.find(name, this->sectionNames);
+    if (currentSection == -1) {
+      currentSection = this->sections.size();
+      this->sectionNames.push_back(name);
+      this->sections.push_back(IniSection());
+      this->index.add(this->sectionNames);
+      for (std::vector<std::string>::const_iterator i =
+               this->lazySections.begin();
+           i != this->lazySections.end(); i++) {
+        if (name == *i) this->sections.back().lazy = true;
+      }
+    }
+    return;
+  }
+
+  const char* eq =
+      static_cast<const char*>(::memchr(line.data(), '=', line.length()));
+
+  // Line is something we do not know
+  if (eq == NULL) {
+    throw ParsingException("Malformed line \"" + line.str() + "\"", __FILE__,
+                           __LINE__);
+  }
+
+  // Is the line a key-value pair?
+  std::size_t eqpos = eq - line.data();
+  bool append_mode = false;
+
+  // Check wheter we already have a section
+  if (currentSection == -1) {
+    throw ParsingException(
+        "Option line \"" + line.str() + "\" before first section", __FILE__,
+        __LINE__);
+  }
+
+  // Extract name
+  if (eqpos < 1 || eqpos == line.length() - 1) {
+    throw ParsingException("Malformed line: " + line.str(), __FILE__,
+                           __LINE__);
+  }
+  StringView name(line.data(), eqpos);
+  if (line[eqpos - 1] == '+') {
+    append_mode = true;
+    name = StringView(line.data(), eqpos - 1);
+  }
+  name = trim(name);
+  if (name.empty()) {
+    throw ParsingException("Malformed line: " + line.str(), __FILE__,
+                           __LINE__);
+  }
+
+  IniSection& section = this->sections[currentSection];
+  std::vector<StringView> values;
+  if (section.lazy) {
+    // Keep the whole line, so that errors found when decoding can quote it
+    values.push_back(line);
+  } else {
+    splitValues(line, eqpos + 1, this->decodedValues, values);
+  }
+
+  if (!append_mode) {
+    section.removeValues(name);
+  }
+  for (std::vector<StringView>::const_iterator i = values.begin();
+       i != values.end(); i++) {
+    section.putValue(name, *i);
+  }
+}
+
+vector<string> suPHP::IniFile::decodeValues(const IniSection& section,
+                                           const StringView& key) const {
+  const vector<StringView>& raw = section.getValues(key);
+  if (!section.lazy) {
+    return vector<string>(raw.begin(), raw.end());
+  }
+  deque<string> storage;
+  vector<StringView> values;
+  for (vector<StringView>::const_iterator i = raw.begin(); i != raw.end();
+       i++) {
+    const char* eq =
+        static_cast<const char*>(::memchr(i->data(), '=', i->length()));
+    splitValues(*i, eq - i->data() + 1, storage, values);
+  }
+  return vector<string>(values.begin(), values.end());
+}
+
+string suPHP::IniFile::escapeValue(const string& value) {
+  string output;
+  for (string::size_type i = 0; i < value.length(); i++) {
+    if (value[i] == '"' || value[i] == '\\' || value[i] == ':') {
+      output.append("\\");
+    }
+    output.append(1, value[i]);
+  }
+  // Surrounding whitespace is only preserved inside quotes
+  if (value.find_first_of(" \t") == 0 ||
+      value.find_last_of(" \t") == value.length() - 1) {
+    output = "\"" + output + "\"";
+  }
   return output;
 }
@@ -22,7 +22,8 @@
 #ifndef SUPHP_INIFILE_H
 #define SUPHP_INIFILE_H
 
-#include <map>
+#include <deque>
+#include <memory>
 #include <string>
 #include <vector>
 
@@ -30,17 +31,27 @@
 #include "IOException.hpp"
 #include "IniSection.hpp"
 #include "KeyNotFoundException.hpp"
+#include "MappedFile.hpp"
 #include "ParsingException.hpp"
+#include "StringView.hpp"
 
 namespace suPHP {
 /**
  * Class providing access to configuration in a INI file.
+ * The file is mapped into memory and parsed in a single pass. Names and
+ * values reference the mapping directly, only values containing quotes
+ * or escape sequences are copied.
  */
 class IniFile {
  private:
-  std::map<std::string, IniSection> sections;
+  std::unique_ptr<MappedFile> mapping;
+  std::deque<std::string> decodedValues;
+  std::vector<StringView> sectionNames;
+  std::vector<IniSection> sections;
+  NameIndex index;
+  std::vector<std::string> lazySections;
 
-  std::string parseValue(const std::string& value) const;
+  void parseLine(const StringView& line, long& currentSection);
 
  public:
   /**
@@ -48,25 +59,48 @@ class IniFile {
    */
   void parse(const File& file);
 
+  /**
+   * Reads values from INI file. Values in the named sections are only
+   * located, they are split and decoded by decodeValues() when needed.
+   */
+  void parse(const File& file, const std::vector<std::string>& lazySections);
+
+  /**
+   * Returns decoded values corresponding to a key in a section of this
+   * file, decoding them first if the section has been parsed lazily
+   */
+  std::vector<std::string> decodeValues(const IniSection& section,
+                                        const StringView& key) const;
+
   /**
    * Returns section
    */
-  const IniSection& getSection(const std::string& name) const;
+  const IniSection& getSection(const StringView& name) const;
 
   /**
    * Index operator
    */
-  const IniSection& operator[](const std::string& name) const;
+  const IniSection& operator[](const StringView& name) const;
 
   /**
-   * Returns vector containing names of all sections
+   * Returns names of all sections
    */
-  const std::vector<const std::string> getSections();
+  const std::vector<StringView>& getSections() const;
 
   /**
    * Checks wheter a section is existing
    */
-  bool hasSection(const std::string& name) const;
+  bool hasSection(const StringView& name) const;
+
+  /**
+   * Returns identity of the file that has been parsed
+   */
+  const FileIdentity& getIdentity() const;
+
+  /**
+   * Escapes a value so that parsing it yields the original string
+   */
+  static std::string escapeValue(const std::string& value);
 };
 }  // namespace suPHP
 
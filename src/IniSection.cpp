@@ -22,70 +22,92 @@
 #include <string>
 
 #include "KeyNotFoundException.hpp"
+#include "Util.hpp"
 
 #include "IniSection.hpp"
 
 using namespace suPHP;
 
-void suPHP::IniSection::putValue(const std::string key,
-                                 const std::string value) {
-  std::pair<std::string, std::string> p;
-  p.first = key;
-  p.second = value;
-  this->entries.insert(p);
-}
-
-const std::vector<std::string> suPHP::IniSection::getValues(
-    const std::string& key) const {
-  std::vector<std::string> values;
-  std::pair<std::multimap<const std::string, const std::string>::const_iterator,
-            std::multimap<const std::string, const std::string>::const_iterator>
-      range = this->entries.equal_range(key);
-  for (std::multimap<const std::string, const std::string>::const_iterator pos =
-           range.first;
-       pos != range.second; pos++) {
-    values.push_back(pos->second);
+long suPHP::NameIndex::find(const StringView& name,
+                            const std::vector<StringView>& names) const {
+  if (this->slots.empty()) {
+    return -1;
   }
-  if (values.size() == 0) {
-    throw KeyNotFoundException("No value for key " + key + " found", __FILE__,
-                               __LINE__);
+  std::size_t mask = this->slots.size() - 1;
+  std::size_t slot = Util::hashBytes(name.data(), name.length()) & mask;
+  while (this->slots[slot] != 0) {
+    if (names[this->slots[slot] - 1] == name) {
+      return this->slots[slot] - 1;
+    }
+    slot = (slot + 1) & mask;
   }
-  return values;
+  return -1;
 }
 
-std::string suPHP::IniSection::getValue(const std::string& key) const {
-  std::vector<std::string> values;
-  if (this->entries.find(key) != this->entries.end()) {
-    return this->entries.find(key)->second;
-  } else {
-    throw KeyNotFoundException("No value for key " + key + " found", __FILE__,
-                               __LINE__);
+void suPHP::NameIndex::add(const std::vector<StringView>& names) {
+  // Keep the load factor below one half; the table size is a power of two
+  if (names.size() * 2 > this->slots.size()) {
+    std::size_t size = this->slots.empty() ? 16 : this->slots.size() * 2;
+    this->slots.assign(size, 0);
+    for (std::size_t i = 0; i + 1 < names.size(); i++) {
+      std::size_t slot = Util::hashBytes(names[i].data(), names[i].length()) &
+                         (size - 1);
+      while (this->slots[slot] != 0) slot = (slot + 1) & (size - 1);
+      this->slots[slot] = i + 1;
+    }
   }
+  std::size_t mask = this->slots.size() - 1;
+  const StringView& name = names.back();
+  std::size_t slot = Util::hashBytes(name.data(), name.length()) & mask;
+  while (this->slots[slot] != 0) slot = (slot + 1) & mask;
+  this->slots[slot] = names.size();
 }
 
-const std::vector<std::string> suPHP::IniSection::getKeys() const {
-  std::vector<std::string> keys;
-  for (std::multimap<const std::string, const std::string>::const_iterator pos =
-           this->entries.begin();
-       pos != this->entries.end(); pos++) {
-    keys.push_back(pos->first);
+suPHP::IniSection::IniSection() : lazy(false) {}
+
+void suPHP::IniSection::putValue(const StringView& key,
+                                 const StringView& value) {
+  long pos = this->index.find(key, this->keys);
+  if (pos == -1) {
+    pos = this->keys.size();
+    this->keys.push_back(key);
+    this->values.push_back(std::vector<StringView>());
+    this->index.add(this->keys);
   }
-  return keys;
+  this->values[pos].push_back(value);
 }
 
-bool suPHP::IniSection::hasKey(const std::string& key) const {
-  if (this->entries.find(key) != this->entries.end()) {
-    return true;
-  } else {
-    return false;
+const std::vector<StringView>& suPHP::IniSection::getValues(
+    const StringView& key) const {
+  long pos = this->index.find(key, this->keys);
+  if (pos == -1 || this->values[pos].empty()) {
+    throw KeyNotFoundException("No value for key " + key.str() + " found",
+                               __FILE__, __LINE__);
   }
+  return this->values[pos];
+}
+
+StringView suPHP::IniSection::getValue(const StringView& key) const {
+  return this->getValues(key).front();
 }
 
-const std::vector<std::string> suPHP::IniSection::operator[](
-    const std::string& key) const {
+const std::vector<StringView>& suPHP::IniSection::getKeys() const {
+  return this->keys;
+}
+
+bool suPHP::IniSection::hasKey(const StringView& key) const {
+  long pos = this->index.find(key, this->keys);
+  return pos != -1 && !this->values[pos].empty();
+}
+
+const std::vector<StringView>& suPHP::IniSection::operator[](
+    const StringView& key) const {
   return this->getValues(key);
 }
 
-void suPHP::IniSection::removeValues(const std::string& key) {
-  this->entries.erase(key);
+void suPHP::IniSection::removeValues(const StringView& key) {
+  long pos = this->index.find(key, this->keys);
+  if (pos != -1) {
+    this->values[pos].clear();
+  }
 }
@@ -22,51 +22,85 @@
 #ifndef SUPHP_INISECTION_H
 #define SUPHP_INISECTION_H
 
-#include <map>
+#include <cstdint>
 #include <string>
 #include <vector>
 
 #include "KeyNotFoundException.hpp"
+#include "StringView.hpp"
 
 namespace suPHP {
 
 class IniFile;
 
+/**
+ * Open-addressing hash table mapping names to their position in a
+ * vector of names.
+ */
+class NameIndex {
+ private:
+  std::vector<uint32_t> slots;  // position + 1, zero marks an empty slot
+
+ public:
+  /**
+   * Returns position of name or -1 if it is not indexed
+   */
+  long find(const StringView& name,
+            const std::vector<StringView>& names) const;
+
+  /**
+   * Indexes the last element of names
+   */
+  void add(const std::vector<StringView>& names);
+};
+
 /**
  * Class providing access to configuration in a INI file.
+ * Keys and values reference memory owned by the IniFile they were parsed
+ * from, so they are only valid as long as that IniFile exists.
+ * In sections parsed lazily the values are the undecoded lines they
+ * were read from, IniFile::decodeValues() decodes them.
  */
 class IniSection {
  private:
-  std::multimap<const std::string, const std::string> entries;
-  void putValue(const std::string key, const std::string value);
-  void removeValues(const std::string& key);
+  std::vector<StringView> keys;
+  std::vector<std::vector<StringView> > values;
+  NameIndex index;
+  bool lazy;
+  void putValue(const StringView& key, const StringView& value);
+  void removeValues(const StringView& key);
 
  public:
+  /**
+   * Constructor
+   */
+  IniSection();
+
   /**
    * Returns values corresponding to key
    */
-  const std::vector<std::string> getValues(const std::string& key) const;
+  const std::vector<StringView>& getValues(const StringView& key) const;
 
   /**
    * Returns first value corresponding to a key
    */
-  std::string getValue(const std::string& key) const;
+  StringView getValue(const StringView& key) const;
 
   /**
-   * Returns keys appearing in this section
+   * Returns keys appearing in this section (in order of appearance)
    */
-  const std::vector<std::string> getKeys() const;
+  const std::vector<StringView>& getKeys() const;
   /**
    * Overloaded index operator, calls getValues()
    */
-  const std::vector<std::string> operator[](const std::string& key) const;
+  const std::vector<StringView>& operator[](const StringView& key) const;
 
   friend class IniFile;
 
   /**
    * Check wheter key is existing within section
    */
-  bool hasKey(const std::string& name) const;
+  bool hasKey(const StringView& name) const;
 };
 }  // namespace suPHP
 
@@ -0,0 +1,82 @@
+/*
+  suPHP - (c)2002-2013 Sebastian Marsching <sebastian@marsching.com>
+          (c)2018 John Lightsey <john@nixnuts.net>
+
+  This file is part of suPHP.
+
+  suPHP is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  suPHP is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with suPHP; if not, write to the Free Software Foundation, Inc.,
+  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "MappedFile.hpp"
+
+using namespace suPHP;
+
+suPHP::MappedFile::MappedFile(const File& file) : data(""), size(0) {
+  struct stat temp;
+  int fd = ::open(file.getPath().c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd == -1) {
+    throw IOException("Could not open file " + file.getPath() +
+                          " for reading: " + ::strerror(errno),
+                      __FILE__, __LINE__);
+  }
+  if (::fstat(fd, &temp) == -1) {
+    int err = errno;
+    ::close(fd);
+    throw IOException(
+        "Could not stat file " + file.getPath() + ": " + ::strerror(err),
+        __FILE__, __LINE__);
+  }
+  this->identity.device = temp.st_dev;
+  this->identity.inode = temp.st_ino;
+  this->identity.mtime = temp.st_mtim.tv_sec;
+  this->identity.mtime_nsec = temp.st_mtim.tv_nsec;
+  this->identity.size = temp.st_size;
+
+  if (temp.st_size > 0) {
+    void* map = ::mmap(NULL, temp.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map == MAP_FAILED) {
+      int err = errno;
+      ::close(fd);
+      throw IOException(
+          "Could not map file " + file.getPath() + ": " + ::strerror(err),
+          __FILE__, __LINE__);
+    }
+    this->data = static_cast<const char*>(map);
+    this->size = temp.st_size;
+  }
+  ::close(fd);
+}
+
+suPHP::MappedFile::~MappedFile() {
+  if (this->size > 0) {
+    ::munmap(const_cast<char*>(this->data), this->size);
+  }
+}
+
+const char* suPHP::MappedFile::getData() const { return this->data; }
+
+std::size_t suPHP::MappedFile::getSize() const { return this->size; }
+
+const FileIdentity& suPHP::MappedFile::getIdentity() const {
+  return this->identity;
+}
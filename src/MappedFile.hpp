@@ -0,0 +1,72 @@
+/*
+  suPHP - (c)2002-2013 Sebastian Marsching <sebastian@marsching.com>
+          (c)2018 John Lightsey <john@nixnuts.net>
+
+  This file is part of suPHP.
+
+  suPHP is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  suPHP is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with suPHP; if not, write to the Free Software Foundation, Inc.,
+  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#ifndef SUPHP_MAPPEDFILE_H
+#define SUPHP_MAPPEDFILE_H
+
+#include <cstddef>
+
+#include "File.hpp"
+#include "IOException.hpp"
+
+namespace suPHP {
+/**
+ * Class providing a read-only memory mapping of a file.
+ */
+class MappedFile {
+ private:
+  const char* data;
+  std::size_t size;
+  FileIdentity identity;
+
+  MappedFile(const MappedFile&) = delete;
+  MappedFile& operator=(const MappedFile&) = delete;
+
+ public:
+  /**
+   * Constructor, maps the whole file
+   */
+  MappedFile(const File& file);
+
+  /**
+   * Destructor, unmaps the file
+   */
+  ~MappedFile();
+
+  /**
+   * Returns pointer to the file contents
+   */
+  const char* getData() const;
+
+  /**
+   * Returns size of the file contents
+   */
+  std::size_t getSize() const;
+
+  /**
+   * Returns identity of the mapped file (taken from the open file, so
+   * it matches the contents even if the path has been replaced since)
+   */
+  const FileIdentity& getIdentity() const;
+};
+}  // namespace suPHP
+
+#endif  // SUPHP_MAPPEDFILE_H
@@ -0,0 +1,136 @@
+/*
+  suPHP - (c)2002-2013 Sebastian Marsching <sebastian@marsching.com>
+          (c)2018 John Lightsey <john@nixnuts.net>
+
+  This file is part of suPHP.
+
+  suPHP is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  suPHP is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with suPHP; if not, write to the Free Software Foundation, Inc.,
+  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#include "LookupException.hpp"
+#include "UserInfo.hpp"
+#include "Util.hpp"
+
+#include "Rejection.hpp"
+
+using namespace suPHP;
+
+namespace {
+// clang-format off
+const char* const reasonNames[REJECTION_REASONS] = {
+  "none",
+  "script_missing",
+  "target_missing",
+  "not_in_vhost_docroot",
+  "not_readable",
+  "symlink_owner",
+  "not_in_docroot",
+  "file_group_writeable",
+  "file_others_writeable",
+  "directory_owner",
+  "directory_group_writeable",
+  "directory_others_writeable",
+  "min_uid",
+  "min_gid",
+  "uid_mismatch",
+  "gid_mismatch",
+  "script_changed"};
+// clang-format on
+}  // namespace
+
+suPHP::Rejection::Rejection()
+    : reason{REJECT_NONE}, path{}, detail{}, expected{0}, actual{0} {}
+
+suPHP::Rejection::Rejection(RejectionReason reason, const std::string& path,
+                            const std::string& detail, int expected,
+                            int actual)
+    : reason{reason},
+      path{path},
+      detail{detail},
+      expected{expected},
+      actual{actual} {}
+
+RejectionReason suPHP::Rejection::getReason() const { return this->reason; }
+
+bool suPHP::Rejection::isRejected() const {
+  return this->reason != REJECT_NONE;
+}
+
+std::string suPHP::Rejection::getMessage() const {
+  switch (this->reason) {
+    case REJECT_NONE:
+      break;
+    case REJECT_SCRIPT_MISSING:
+      return "File " + this->path + " does not exist";
+    case REJECT_TARGET_MISSING:
+      return "File " + this->path + " referenced by symlink " + this->detail +
+             " does not exist";
+    case REJECT_NOT_IN_VHOST_DOCROOT:
+      return "File \"" + this->path + "\" is not in document root of Vhost \"" +
+             this->detail + "\"";
+    case REJECT_NOT_READABLE:
+      return "File \"" + this->path + "\" not readable";
+    case REJECT_SYMLINK_OWNER:
+      return "UID or GID of symlink \"" + this->path +
+             "\" is not matching its target";
+    case REJECT_NOT_IN_DOCROOT:
+      if (this->detail.empty()) {
+        return "Script \"" + this->path + "\" not within configured docroot";
+      }
+      return "Script \"" + this->path + "\" resolving to \"" + this->detail +
+             "\" not within configured docroot";
+    case REJECT_FILE_GROUP_WRITEABLE:
+      return "File \"" + this->path + "\" is writeable by group";
+    case REJECT_FILE_OTHERS_WRITEABLE:
+      return "File \"" + this->path + "\" is writeable by others";
+    case REJECT_DIRECTORY_OWNER:
+      return "Directory " + this->path + " is not owned by " +
+             this->getUsername(this->expected);
+    case REJECT_DIRECTORY_GROUP_WRITEABLE:
+      return "Directory \"" + this->path + "\" is writeable by group";
+    case REJECT_DIRECTORY_OTHERS_WRITEABLE:
+      return "Directory \"" + this->path + "\" is writeable by others";
+    case REJECT_MIN_UID:
+      return "UID of script \"" + this->path + "\" is smaller than min_uid";
+    case REJECT_MIN_GID:
+      return "GID of script \"" + this->path + "\" is smaller than min_gid";
+    case REJECT_UID_MISMATCH:
+      return "Mismatch between target UID (" + Util::intToStr(this->expected) +
+             ") and UID (" + Util::intToStr(this->actual) + ") of file \"" +
+             this->path + "\"";
+    case REJECT_GID_MISMATCH:
+      return "Mismatch between target GID (" + Util::intToStr(this->expected) +
+             ") and GID (" + Util::intToStr(this->actual) + ") of file \"" +
+             this->path + "\"";
+    case REJECT_SCRIPT_CHANGED:
+      return "Script \"" + this->path + "\" changed while checking";
+    case REJECTION_REASONS:
+      break;
+  }
+  return "";
+}
+
+std::string suPHP::Rejection::getUsername(int uid) {
+  try {
+    return UserInfo(uid).getUsername();
+  } catch (LookupException& e) {
+    return "#" + Util::intToStr(uid);
+  }
+}
+
+const char* suPHP::Rejection::getReasonName(RejectionReason reason) {
+  if (reason < 0 || reason >= REJECTION_REASONS) return "unknown";
+  return reasonNames[reason];
+}
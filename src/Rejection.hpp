@@ -0,0 +1,110 @@
+/*
+  suPHP - (c)2002-2013 Sebastian Marsching <sebastian@marsching.com>
+          (c)2018 John Lightsey <john@nixnuts.net>
+
+  This file is part of suPHP.
+
+  suPHP is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  suPHP is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with suPHP; if not, write to the Free Software Foundation, Inc.,
+  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#ifndef SUPHP_REJECTION_H
+#define SUPHP_REJECTION_H
+
+#include <string>
+
+namespace suPHP {
+
+/**
+ * Reasons for refusing to execute a script. The order is shared with
+ * the names in mod_suphp.c, new reasons are added at the end.
+ */
+enum RejectionReason {
+  REJECT_NONE,
+  REJECT_SCRIPT_MISSING,
+  REJECT_TARGET_MISSING,
+  REJECT_NOT_IN_VHOST_DOCROOT,
+  REJECT_NOT_READABLE,
+  REJECT_SYMLINK_OWNER,
+  REJECT_NOT_IN_DOCROOT,
+  REJECT_FILE_GROUP_WRITEABLE,
+  REJECT_FILE_OTHERS_WRITEABLE,
+  REJECT_DIRECTORY_OWNER,
+  REJECT_DIRECTORY_GROUP_WRITEABLE,
+  REJECT_DIRECTORY_OTHERS_WRITEABLE,
+  REJECT_MIN_UID,
+  REJECT_MIN_GID,
+  REJECT_UID_MISMATCH,
+  REJECT_GID_MISMATCH,
+  REJECT_SCRIPT_CHANGED,
+  REJECTION_REASONS
+};
+
+/**
+ * Class describing why a script is not executed. It only keeps the
+ * values the message is made of, the message is formatted when it is
+ * needed.
+ */
+class Rejection {
+ private:
+  RejectionReason reason;
+  std::string path;
+  std::string detail;
+  int expected;
+  int actual;
+
+  /**
+   * Returns the name of the user with uid, or "#uid" if there is none
+   */
+  static std::string getUsername(int uid);
+
+ public:
+  /**
+   * Constructor, no rejection
+   */
+  Rejection();
+
+  /**
+   * Constructor, path is the file or directory concerned, detail and
+   * expected / actual depend on the reason. For REJECT_DIRECTORY_OWNER,
+   * expected is the UID of the owner of the script, its name is only
+   * looked up when the message is formatted.
+   */
+  Rejection(RejectionReason reason, const std::string& path,
+            const std::string& detail = "", int expected = 0,
+            int actual = 0);
+
+  /**
+   * Returns the reason
+   */
+  RejectionReason getReason() const;
+
+  /**
+   * Returns whether the script is refused
+   */
+  bool isRejected() const;
+
+  /**
+   * Returns the message describing the rejection
+   */
+  std::string getMessage() const;
+
+  /**
+   * Returns the name reason is counted under
+   */
+  static const char* getReasonName(RejectionReason reason);
+};
+}  // namespace suPHP
+
+#endif  // SUPHP_REJECTION_H
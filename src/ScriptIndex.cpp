@@ -0,0 +1,167 @@
+/*
+  suPHP - (c)2002-2013 Sebastian Marsching <sebastian@marsching.com>
+          (c)2018 John Lightsey <john@nixnuts.net>
+
+  This file is part of suPHP.
+
+  suPHP is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  suPHP is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with suPHP; if not, write to the Free Software Foundation, Inc.,
+  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+
+#include <errno.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include <cstdint>
+
+#include "Configuration.hpp"
+#include "SystemException.hpp"
+#include "Util.hpp"
+
+#include "ScriptIndex.hpp"
+
+using namespace suPHP;
+
+namespace {
+/**
+ * What the checks look at of a directory, as stored in the index
+ */
+struct ChainEntry {
+  uint64_t device;
+  uint64_t inode;
+  uint32_t uid;
+  uint32_t mode;
+};
+
+ChainEntry makeEntry(const struct stat& temp) {
+  ChainEntry entry;
+  ::memset(&entry, 0, sizeof(entry));
+  entry.device = temp.st_dev;
+  entry.inode = temp.st_ino;
+  entry.uid = temp.st_uid;
+  entry.mode = temp.st_mode;
+  return entry;
+}
+
+/**
+ * Appends the entries of directory to chain: the directory itself and,
+ * if it is a symlink, the directory it points to, whose owner is checked.
+ * Returns whether directory is a symlink.
+ */
+bool appendEntries(const File& directory, std::string& chain) {
+  struct stat temp;
+  if (::lstat(directory.getPath().c_str(), &temp) == -1) {
+    throw SystemException("Could not stat \"" + directory.getPath() +
+                              "\": " + ::strerror(errno),
+                          __FILE__, __LINE__);
+  }
+  ChainEntry entry = makeEntry(temp);
+  chain.append(reinterpret_cast<const char*>(&entry), sizeof(entry));
+  if (!S_ISLNK(temp.st_mode)) {
+    return false;
+  }
+  if (::stat(directory.getPath().c_str(), &temp) == -1) {
+    throw SystemException("Could not stat \"" + directory.getPath() +
+                              "\": " + ::strerror(errno),
+                          __FILE__, __LINE__);
+  }
+  entry = makeEntry(temp);
+  chain.append(reinterpret_cast<const char*>(&entry), sizeof(entry));
+  return true;
+}
+}  // namespace
+
+suPHP::ScriptIndex::ScriptIndex() : index(), state() {}
+
+void suPHP::ScriptIndex::open(const File& file) {
+  this->index.reset(new IndexFile(file));
+}
+
+void suPHP::ScriptIndex::watch(const File& file) {
+  std::unique_ptr<WatchState> state(new WatchState());
+  state->attach(file);
+  this->state.swap(state);
+}
+
+bool suPHP::ScriptIndex::contains(const File& directory, const UserInfo& owner,
+                                  const Configuration& config) const {
+  if (!this->index) {
+    return false;
+  }
+
+  // The epoch is taken before verifying, so a change noticed by the
+  // daemon in the meantime leaves the key untrusted
+  std::string key = getKey(directory, owner, config);
+  uint64_t epoch = 0;
+  bool watched = this->state && this->state->isWatched(directory, epoch);
+  if (watched && this->state->isVerified(key, epoch)) {
+    return true;
+  }
+
+  std::string stored;
+  if (!this->index->lookup(key, stored)) {
+    return false;
+  }
+
+  // Compare while walking up, so a changed directory stops the walk
+  try {
+    std::string chain;
+    bool linked = false;
+    File current = directory;
+    for (;;) {
+      linked |= appendEntries(current, chain);
+      if (stored.compare(0, chain.length(), chain) != 0) {
+        return false;
+      }
+      if (current.getPath() == "/") {
+        if (chain.length() != stored.length()) {
+          return false;
+        }
+        // The daemon does not watch where symlinks point to
+        if (watched && !linked) {
+          this->state->setVerified(key, epoch);
+        }
+        return true;
+      }
+      current = current.getParentDirectory();
+    }
+  } catch (SystemException& e) {
+    // Fall back to the checks, which report the problem
+  }
+  return false;
+}
+
+std::string suPHP::ScriptIndex::getKey(const File& directory,
+                                       const UserInfo& owner,
+                                       const Configuration& config) {
+  // Overrides may deny for some users what the global section allows
+  std::string flags;
+  flags += config.getAllowDirectoryGroupWriteable() ? 'g' : '-';
+  flags += config.getAllowDirectoryOthersWriteable() ? 'o' : '-';
+  return flags + ":" + Util::intToStr(owner.getUid()) + ":" +
+         directory.getPath();
+}
+
+std::string suPHP::ScriptIndex::getChain(const File& directory) {
+  std::string chain;
+  File current = directory;
+  for (;;) {
+    appendEntries(current, chain);
+    if (current.getPath() == "/") {
+      return chain;
+    }
+    current = current.getParentDirectory();
+  }
+}
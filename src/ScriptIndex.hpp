@@ -0,0 +1,94 @@
+/*
+  suPHP - (c)2002-2013 Sebastian Marsching <sebastian@marsching.com>
+          (c)2018 John Lightsey <john@nixnuts.net>
+
+  This file is part of suPHP.
+
+  suPHP is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  suPHP is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with suPHP; if not, write to the Free Software Foundation, Inc.,
+  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+
+#ifndef SUPHP_SCRIPTINDEX_H
+#define SUPHP_SCRIPTINDEX_H
+
+#include <map>
+#include <memory>
+#include <string>
+
+#include "File.hpp"
+#include "IndexFile.hpp"
+#include "UserInfo.hpp"
+#include "WatchState.hpp"
+
+namespace suPHP {
+class Configuration;
+
+/**
+ * Class looking up directories in the index written by "suphp --index".
+ * The index lists the directories that passed the checks of the parent
+ * directories of a script for a target user, together with the device,
+ * inode, owner and mode of the directory and of each directory above it
+ * when they were checked. An entry only applies while none of them has
+ * been replaced, chmod'ed or chown'ed, which takes one lstat() per
+ * directory instead of the checks themselves. While suphp-cached
+ * watches the directories, an entry verified since the last change is
+ * trusted without any lstat().
+ */
+class ScriptIndex {
+ private:
+  std::unique_ptr<IndexFile> index;
+  std::unique_ptr<WatchState> state;
+
+  ScriptIndex(const ScriptIndex&) = delete;
+  ScriptIndex& operator=(const ScriptIndex&) = delete;
+
+ public:
+  /**
+   * Constructor, nothing is found until open() has been called
+   */
+  ScriptIndex();
+
+  /**
+   * Opens the index file
+   */
+  void open(const File& file);
+
+  /**
+   * Maps the state shared with suphp-cached
+   */
+  void watch(const File& file);
+
+  /**
+   * Checks whether the directories from directory up to the root passed
+   * the checks for owner under config and have not changed since
+   */
+  bool contains(const File& directory, const UserInfo& owner,
+                const Configuration& config) const;
+
+  /**
+   * Returns the key of directory and owner under config
+   */
+  static std::string getKey(const File& directory, const UserInfo& owner,
+                            const Configuration& config);
+
+  /**
+   * Returns the device, inode, owner and mode of the directories from
+   * directory up to the root, as they are stored in the index
+   */
+  static std::string getChain(const File& directory);
+};
+}  // namespace suPHP
+
+#endif  // SUPHP_SCRIPTINDEX_H
@@ -39,3 +39,18 @@ suPHP::SoftException::SoftException(Exception& cause, std::string file,
 suPHP::SoftException::SoftException(std::string message, Exception& cause,
                                     std::string file, int line)
     : Exception(message, cause, file, line) {}
+
+suPHP::SoftException::SoftException(const Rejection& rejection,
+                                    std::string file, int line)
+    : Exception(file, line), rejection(rejection) {}
+
+std::string suPHP::SoftException::formatMessage() const {
+  if (this->rejection.getReason() != REJECT_NONE) {
+    return this->rejection.getMessage();
+  }
+  return Exception::formatMessage();
+}
+
+RejectionReason suPHP::SoftException::getReason() const {
+  return this->rejection.getReason();
+}
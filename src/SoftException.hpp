@@ -26,6 +26,7 @@
 #include <string>
 
 #include "Exception.hpp"
+#include "Rejection.hpp"
 
 namespace suPHP {
 /**
@@ -34,8 +35,13 @@ namespace suPHP {
  */
 class SoftException : public Exception {
  private:
+  Rejection rejection;
+
   std::string getName() const;
 
+ protected:
+  std::string formatMessage() const;
+
  public:
   /**
    * Constructor without message.
@@ -57,6 +63,18 @@ class SoftException : public Exception {
    */
   SoftException(std::string message, Exception& cause, std::string file,
                 int line);
+
+  /**
+   * Constructor for a script that is refused, the message is formatted
+   * from the rejection when it is needed.
+   */
+  SoftException(const Rejection& rejection, std::string file, int line);
+
+  /**
+   * Returns the reason the script was refused, REJECT_NONE for other
+   * problems
+   */
+  RejectionReason getReason() const;
 };
 }
 
@@ -0,0 +1,164 @@
+/*
+  suPHP - (c)2002-2013 Sebastian Marsching <sebastian@marsching.com>
+          (c)2018 John Lightsey <john@nixnuts.net>
+
+  This file is part of suPHP.
+
+  suPHP is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  suPHP is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with suPHP; if not, write to the Free Software Foundation, Inc.,
+  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include "StageStatistics.hpp"
+
+using namespace suPHP;
+
+namespace {
+uint64_t now() {
+  struct timeval tv;
+  ::gettimeofday(&tv, NULL);
+  return static_cast<uint64_t>(tv.tv_sec) * 1000000 + tv.tv_usec;
+}
+}  // namespace
+
+suPHP::StageStatistics::StageStatistics() : segment(NULL), last(now()) {}
+
+suPHP::StageStatistics::~StageStatistics() {
+  if (this->segment != NULL) {
+    ::munmap(this->segment, sizeof(Segment));
+  }
+}
+
+void suPHP::StageStatistics::attach(const File& file) {
+  struct stat temp;
+  int fd = ::open(file.getPath().c_str(), O_RDWR | O_CLOEXEC);
+  if (fd == -1) {
+    throw IOException("Could not open file " + file.getPath() + ": " +
+                          ::strerror(errno),
+                      __FILE__, __LINE__);
+  }
+  if (::fstat(fd, &temp) == -1 ||
+      temp.st_size != static_cast<off_t>(sizeof(Segment))) {
+    ::close(fd);
+    throw IOException("File " + file.getPath() +
+                          " has not been created by this version of mod_suphp",
+                      __FILE__, __LINE__);
+  }
+  void* map = ::mmap(NULL, sizeof(Segment), PROT_READ | PROT_WRITE,
+                     MAP_SHARED, fd, 0);
+  int err = errno;
+  ::close(fd);
+  if (map == MAP_FAILED) {
+    throw IOException(
+        "Could not map file " + file.getPath() + ": " + ::strerror(err),
+        __FILE__, __LINE__);
+  }
+
+  Segment* mapped = static_cast<Segment*>(map);
+  if (mapped->magic != MAGIC || mapped->version != FORMAT_VERSION ||
+      mapped->stages != STAGES || mapped->buckets != BUCKETS) {
+    ::munmap(map, sizeof(Segment));
+    throw IOException("File " + file.getPath() +
+                          " has not been created by this version of mod_suphp",
+                      __FILE__, __LINE__);
+  }
+  if (this->segment != NULL) {
+    ::munmap(this->segment, sizeof(Segment));
+  }
+  this->segment = mapped;
+}
+
+void suPHP::StageStatistics::endStage(Stage stage) {
+  uint64_t end = now();
+  this->record(stage, end > this->last ? end - this->last : 0);
+  this->last = end;
+}
+
+void suPHP::StageStatistics::record(Stage stage, uint64_t value) {
+  if (this->segment == NULL) return;
+
+  // Apache and other suphp processes update the file concurrently
+  Histogram& histogram = this->segment->histograms[stage];
+  __sync_fetch_and_add(&histogram.buckets[getBucket(value)], 1);
+  __sync_fetch_and_add(&histogram.sum, value);
+  uint64_t max = histogram.max;
+  while (value > max) {
+    uint64_t seen = __sync_val_compare_and_swap(&histogram.max, max, value);
+    if (seen == max) break;
+    max = seen;
+  }
+  // Incremented last, so a reader seeing count has the bucket as well
+  __sync_fetch_and_add(&histogram.count, 1);
+}
+
+void suPHP::StageStatistics::countRejection(RejectionReason reason) {
+  if (this->segment == NULL || reason == REJECT_NONE) return;
+
+  __sync_fetch_and_add(&this->segment->rejections[reason], 1);
+}
+
+void suPHP::StageStatistics::publishPolicy(const std::string& config,
+                                           const FileIdentity& identity,
+                                           uint32_t flags) {
+  if (this->segment == NULL || config.size() >= POLICY_PATH) return;
+
+  Policy& policy = this->segment->policy;
+  uint32_t seq = policy.seq;
+  if (!(seq & 1) && seq != 0 && policy.flags == flags &&
+      policy.device == identity.device && policy.inode == identity.inode &&
+      policy.mtime == identity.mtime &&
+      policy.mtime_nsec == identity.mtime_nsec &&
+      policy.size == identity.size && config == policy.config) {
+    return;
+  }
+
+  // Another suphp process is publishing the policy
+  if ((seq & 1) || !__sync_bool_compare_and_swap(&policy.seq, seq, seq + 1)) {
+    return;
+  }
+  policy.flags = flags;
+  policy.device = identity.device;
+  policy.inode = identity.inode;
+  policy.mtime = identity.mtime;
+  policy.mtime_nsec = identity.mtime_nsec;
+  policy.size = identity.size;
+  ::memset(policy.config, 0, sizeof(policy.config));
+  ::memcpy(policy.config, config.data(), config.size());
+  __sync_fetch_and_add(&policy.seq, 1);
+}
+
+int suPHP::StageStatistics::getBucket(uint64_t value) {
+  if (value < SUB_BUCKETS) return static_cast<int>(value);
+
+  int shift = 0;
+  while ((value >> shift) >= SUB_BUCKETS) shift++;
+  int bucket = SUB_BUCKETS + (shift - 1) * (SUB_BUCKETS / 2) +
+               static_cast<int>(value >> shift) - SUB_BUCKETS / 2;
+  return bucket < BUCKETS ? bucket : BUCKETS - 1;
+}
+
+uint64_t suPHP::StageStatistics::getBucketStart(int bucket) {
+  if (bucket < SUB_BUCKETS) return bucket;
+
+  int shift = (bucket - SUB_BUCKETS) / (SUB_BUCKETS / 2) + 1;
+  uint64_t sub = (bucket - SUB_BUCKETS) % (SUB_BUCKETS / 2) + SUB_BUCKETS / 2;
+  return sub << shift;
+}
@@ -0,0 +1,159 @@
+/*
+  suPHP - (c)2002-2013 Sebastian Marsching <sebastian@marsching.com>
+          (c)2018 John Lightsey <john@nixnuts.net>
+
+  This file is part of suPHP.
+
+  suPHP is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  suPHP is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with suPHP; if not, write to the Free Software Foundation, Inc.,
+  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#ifndef SUPHP_STAGESTATISTICS_H
+#define SUPHP_STAGESTATISTICS_H
+
+#include <cstdint>
+
+#include "File.hpp"
+#include "IOException.hpp"
+#include "Rejection.hpp"
+
+namespace suPHP {
+
+enum Stage { STAGE_CONFIG, STAGE_VALIDATION, STAGE_EXEC, STAGES };
+
+/**
+ * Class recording the time suphp spends in each stage into latency
+ * histograms in a file shared with mod_suphp (suPHP_StageStatistics),
+ * which creates the file and reports percentiles from it. The scripts
+ * refused are counted by reason in the same file, which also holds the
+ * part of the policy mod_suphp checks before starting suphp.
+ *
+ * Values are microseconds. Values below 32 have a bucket each, larger
+ * values are kept with their 5 most significant bits, so a bucket is at
+ * most 1/16 of its values wide.
+ */
+class StageStatistics {
+ public:
+  enum {
+    MAGIC = 0x54535053,  // "SPST"
+    FORMAT_VERSION = 3,
+    SUB_BUCKETS = 32,
+    BUCKETS = 432,
+    POLICY_PATH = 256
+  };
+
+  /**
+   * Checks of suphp that mod_suphp may do on its own
+   */
+  enum PolicyFlags {
+    POLICY_DENY_FILE_GROUP_WRITEABLE = 1,
+    POLICY_DENY_FILE_OTHERS_WRITEABLE = 2
+  };
+
+  /**
+   * Layout of the shared file, must match mod_suphp.c
+   */
+  struct Histogram {
+    uint64_t count;
+    uint64_t sum;
+    uint64_t max;
+    uint64_t buckets[BUCKETS];
+  };
+
+  /**
+   * Policy of the configuration file config with the identity device to
+   * size. seq is odd while the policy is written.
+   */
+  struct Policy {
+    uint32_t seq;
+    uint32_t flags;
+    uint64_t device;
+    uint64_t inode;
+    int64_t mtime;
+    int64_t mtime_nsec;
+    int64_t size;
+    char config[POLICY_PATH];
+  };
+
+  struct Segment {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t stages;
+    uint32_t buckets;
+    Histogram histograms[STAGES];
+    uint64_t rejections[REJECTION_REASONS];
+    Policy policy;
+  };
+
+ private:
+  Segment* segment;
+  uint64_t last;
+
+  StageStatistics(const StageStatistics&) = delete;
+  StageStatistics& operator=(const StageStatistics&) = delete;
+
+ public:
+  /**
+   * Constructor, starts the first stage, nothing is recorded until
+   * attach() has been called
+   */
+  StageStatistics();
+
+  /**
+   * Destructor, unmaps the shared file
+   */
+  ~StageStatistics();
+
+  /**
+   * Maps the file created by mod_suphp. The mapping stays writable when
+   * the process drops its privileges and is removed by exec().
+   */
+  void attach(const File& file);
+
+  /**
+   * Records the time since the previous stage ended as stage
+   */
+  void endStage(Stage stage);
+
+  /**
+   * Records value microseconds as stage
+   */
+  void record(Stage stage, uint64_t value);
+
+  /**
+   * Counts a script refused for reason
+   */
+  void countRejection(RejectionReason reason);
+
+  /**
+   * Publishes flags, a combination of PolicyFlags, as the policy of the
+   * configuration file config, which had identity when it was read.
+   * Nothing is written if the file already holds this policy.
+   */
+  void publishPolicy(const std::string& config, const FileIdentity& identity,
+                     uint32_t flags);
+
+  /**
+   * Returns the bucket counting value
+   */
+  static int getBucket(uint64_t value);
+
+  /**
+   * Returns the smallest value counted by bucket
+   */
+  static uint64_t getBucketStart(int bucket);
+};
+}  // namespace suPHP
+
+#endif  // SUPHP_STAGESTATISTICS_H
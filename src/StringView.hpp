@@ -0,0 +1,112 @@
+/*
+  suPHP - (c)2002-2013 Sebastian Marsching <sebastian@marsching.com>
+          (c)2018 John Lightsey <john@nixnuts.net>
+
+  This file is part of suPHP.
+
+  suPHP is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  suPHP is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with suPHP; if not, write to the Free Software Foundation, Inc.,
+  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#ifndef SUPHP_STRINGVIEW_H
+#define SUPHP_STRINGVIEW_H
+
+#include <cstddef>
+#include <cstring>
+#include <ostream>
+#include <string>
+
+namespace suPHP {
+/**
+ * Non-owning reference to a range of characters.
+ * The referenced memory has to outlive the view.
+ */
+class StringView {
+ private:
+  const char* ptr;
+  std::size_t len;
+
+ public:
+  /**
+   * Constructor for an empty view
+   */
+  StringView() : ptr(""), len(0) {}
+
+  /**
+   * Constructor referencing a character range
+   */
+  StringView(const char* data, std::size_t length) : ptr(data), len(length) {}
+
+  /**
+   * Constructor referencing a null-terminated string
+   */
+  StringView(const char* str) : ptr(str), len(::strlen(str)) {}
+
+  /**
+   * Constructor referencing the contents of a string
+   */
+  StringView(const std::string& str) : ptr(str.data()), len(str.length()) {}
+
+  /**
+   * Returns pointer to first character (not null-terminated)
+   */
+  const char* data() const { return this->ptr; }
+
+  /**
+   * Returns number of characters
+   */
+  std::size_t length() const { return this->len; }
+
+  /**
+   * Returns number of characters
+   */
+  std::size_t size() const { return this->len; }
+
+  /**
+   * Checks whether view is empty
+   */
+  bool empty() const { return this->len == 0; }
+
+  /**
+   * Returns character at position
+   */
+  char operator[](std::size_t pos) const { return this->ptr[pos]; }
+
+  /**
+   * Returns (copy of) the referenced characters
+   */
+  std::string str() const { return std::string(this->ptr, this->len); }
+
+  /**
+   * Converts to a string (copies the referenced characters)
+   */
+  operator std::string() const { return this->str(); }
+};
+
+inline bool operator==(const StringView& a, const StringView& b) {
+  return a.length() == b.length() &&
+         (a.empty() || ::memcmp(a.data(), b.data(), a.length()) == 0);
+}
+
+inline bool operator!=(const StringView& a, const StringView& b) {
+  return !(a == b);
+}
+
+inline std::ostream& operator<<(std::ostream& os, const StringView& view) {
+  os.write(view.data(), view.length());
+  return os;
+}
+}  // namespace suPHP
+
+#endif  // SUPHP_STRINGVIEW_H
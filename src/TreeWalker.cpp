@@ -0,0 +1,153 @@
+/*
+  suPHP - (c)2002-2013 Sebastian Marsching <sebastian@marsching.com>
+          (c)2018 John Lightsey <john@nixnuts.net>
+
+  This file is part of suPHP.
+
+  suPHP is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  suPHP is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with suPHP; if not, write to the Free Software Foundation, Inc.,
+  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+
+#include <thread>
+
+#include "TreeWalker.hpp"
+
+using namespace suPHP;
+
+suPHP::TreeVisitor::~TreeVisitor() {}
+
+suPHP::TreeWalker::TreeWalker(TreeVisitor& visitor)
+    : visitor(visitor), queues(), queued(0), outstanding(0) {}
+
+suPHP::TreeWalker::~TreeWalker() {
+  for (std::vector<Queue*>::iterator i = this->queues.begin();
+       i != this->queues.end(); i++) {
+    delete *i;
+  }
+}
+
+void suPHP::TreeWalker::walk(const std::vector<File>& roots, int threads) {
+  if (threads <= 0) {
+    threads = std::thread::hardware_concurrency();
+  }
+  if (threads <= 0) {
+    threads = 1;
+  }
+  for (int i = 0; i < threads; i++) {
+    this->queues.push_back(new Queue());
+  }
+  for (std::size_t i = 0; i < roots.size(); i++) {
+    this->queues[i % threads]->directories.push_back(roots[i]);
+  }
+  this->queued = this->outstanding = roots.size();
+
+  std::vector<std::thread*> workers;
+  for (int i = 1; i < threads; i++) {
+    workers.push_back(new std::thread(&TreeWalker::work, this, i));
+  }
+  this->work(0);
+  for (std::vector<std::thread*>::iterator i = workers.begin();
+       i != workers.end(); i++) {
+    (*i)->join();
+    delete *i;
+  }
+}
+
+void suPHP::TreeWalker::work(int self) {
+  Queue& queue = *this->queues[self];
+  std::string path;
+  while (this->take(self, path)) {
+    std::vector<File> subdirectories = this->visit(File(path));
+    if (!subdirectories.empty()) {
+      std::lock_guard<std::mutex> lock(queue.mutex);
+      queue.directories.insert(queue.directories.end(),
+                               subdirectories.begin(), subdirectories.end());
+    }
+
+    std::lock_guard<std::mutex> lock(this->mutex);
+    this->queued += subdirectories.size();
+    this->outstanding += subdirectories.size();
+    this->outstanding--;
+    if (!subdirectories.empty() || this->outstanding == 0) {
+      this->changed.notify_all();
+    }
+  }
+}
+
+bool suPHP::TreeWalker::take(int self, std::string& path) {
+  {
+    std::unique_lock<std::mutex> lock(this->mutex);
+    while (this->queued == 0 && this->outstanding > 0) {
+      this->changed.wait(lock);
+    }
+    if (this->queued == 0) {
+      return false;
+    }
+    // One of the queued directories is now reserved for this thread
+    this->queued--;
+  }
+
+  int count = this->queues.size();
+  for (;;) {
+    for (int i = 0; i < count; i++) {
+      Queue& queue = *this->queues[(self + i) % count];
+      std::lock_guard<std::mutex> lock(queue.mutex);
+      if (queue.directories.empty()) {
+        continue;
+      }
+      if (i == 0) {
+        path = queue.directories.back().getPath();
+        queue.directories.pop_back();
+      } else {
+        path = queue.directories.front().getPath();
+        queue.directories.pop_front();
+      }
+      return true;
+    }
+    // Another thread took a directory from a queue already searched
+    std::this_thread::yield();
+  }
+}
+
+std::vector<File> suPHP::TreeWalker::visit(const File& directory) {
+  std::vector<File> subdirectories;
+  std::vector<File> files;
+  try {
+    const std::vector<std::string> entries = directory.getDirectoryEntries();
+    std::string prefix = directory.getPath();
+    if (prefix != "/") {
+      prefix += "/";
+    }
+    for (std::vector<std::string>::const_iterator i = entries.begin();
+         i != entries.end(); i++) {
+      File entry(prefix + *i);
+      if (entry.isDirectory()) {
+        subdirectories.push_back(entry);
+      } else if (!entry.isSymlink()) {
+        files.push_back(entry);
+      }
+    }
+  } catch (Exception& e) {
+    this->visitor.visitError(directory, e);
+    return std::vector<File>();
+  }
+  try {
+    this->visitor.visitDirectory(directory, files, subdirectories);
+  } catch (Exception& e) {
+    // A file the visitor cannot handle does not end the walk
+    this->visitor.visitError(directory, e);
+  }
+  return subdirectories;
+}
@@ -0,0 +1,125 @@
+/*
+  suPHP - (c)2002-2013 Sebastian Marsching <sebastian@marsching.com>
+          (c)2018 John Lightsey <john@nixnuts.net>
+
+  This file is part of suPHP.
+
+  suPHP is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  suPHP is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with suPHP; if not, write to the Free Software Foundation, Inc.,
+  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+
+#ifndef SUPHP_TREEWALKER_H
+#define SUPHP_TREEWALKER_H
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "Exception.hpp"
+#include "File.hpp"
+
+namespace suPHP {
+
+/**
+ * Interface of the objects TreeWalker passes the directories it finds
+ * to. The methods are called from several threads at once.
+ */
+class TreeVisitor {
+ public:
+  virtual ~TreeVisitor();
+
+  /**
+   * Visits directory, files are its entries that are neither directories
+   * nor symlinks. subdirectories are visited after this call returns.
+   */
+  virtual void visitDirectory(const File& directory,
+                              const std::vector<File>& files,
+                              const std::vector<File>& subdirectories) = 0;
+
+  /**
+   * Reports that directory could not be read
+   */
+  virtual void visitError(const File& directory, Exception& e) = 0;
+};
+
+/**
+ * Class walking directory trees with several threads. Each thread
+ * queues the subdirectories it finds for itself and continues with the
+ * last one queued, so it stays in the same part of the tree. A thread
+ * without directories takes the oldest one queued by another thread,
+ * which is usually the root of a large subtree. Symlinks are not
+ * followed.
+ */
+class TreeWalker {
+ private:
+  /**
+   * Directories queued by one thread
+   */
+  struct Queue {
+    std::mutex mutex;
+    std::deque<File> directories;
+  };
+
+  TreeVisitor& visitor;
+  std::vector<Queue*> queues;
+  std::mutex mutex;
+  std::condition_variable changed;
+  // Directories queued and not taken yet, directories not visited yet
+  int queued;
+  int outstanding;
+
+  TreeWalker(const TreeWalker&) = delete;
+  TreeWalker& operator=(const TreeWalker&) = delete;
+
+  /**
+   * Visits directories as thread self until all have been visited
+   */
+  void work(int self);
+
+  /**
+   * Takes the path of the next directory for thread self, waiting while
+   * other threads may still find some. Returns false when all have been
+   * visited.
+   */
+  bool take(int self, std::string& path);
+
+  /**
+   * Visits directory and returns its subdirectories. Exceptions of the
+   * visitor are passed to its visitError().
+   */
+  std::vector<File> visit(const File& directory);
+
+ public:
+  /**
+   * Constructor
+   */
+  TreeWalker(TreeVisitor& visitor);
+
+  /**
+   * Destructor
+   */
+  ~TreeWalker();
+
+  /**
+   * Visits roots and all directories below them with threads threads,
+   * or as many as there are processors if threads is 0
+   */
+  void walk(const std::vector<File>& roots, int threads = 0);
+};
+}  // namespace suPHP
+
+#endif  // SUPHP_TREEWALKER_H
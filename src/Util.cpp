@@ -19,6 +19,7 @@
   51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
 */
 
+#include <iomanip>
 #include <sstream>
 
 #include "Util.hpp"
@@ -77,3 +78,26 @@ int suPHP::Util::octalStrToInt(const std::string str) {
   }
   return result;
 }
+
+std::string suPHP::Util::intToOctalStr(const int i) {
+  std::ostringstream ostr;
+  ostr << std::oct << std::setw(4) << std::setfill('0') << i;
+  return ostr.str();
+}
+
+std::string suPHP::Util::hashToStr(const uint64_t hash) {
+  std::ostringstream ostr;
+  ostr << std::hex << std::setw(16) << std::setfill('0') << hash;
+  return ostr.str();
+}
+
+uint64_t suPHP::Util::hashBytes(const void* data, std::size_t length,
+                                uint64_t basis) {
+  const unsigned char* bytes = static_cast<const unsigned char*>(data);
+  uint64_t hash = basis;
+  for (std::size_t i = 0; i < length; i++) {
+    hash ^= bytes[i];
+    hash *= 1099511628211ULL;
+  }
+  return hash;
+}
@@ -22,6 +22,8 @@
 #ifndef SUPHP_UTIL_H
 #define SUPHP_UTIL_H
 
+#include <cstddef>
+#include <cstdint>
 #include <string>
 
 namespace suPHP {
@@ -33,6 +35,15 @@ class Util {
   static std::string intToStr(const int i);
   static int strToInt(const std::string istr);
   static int octalStrToInt(const std::string istr);
+  static std::string intToOctalStr(const int i);
+  static std::string hashToStr(const uint64_t hash);
+
+  /**
+   * FNV-1a hash of a byte range. Pass the result of a previous call
+   * as basis to hash several ranges in sequence.
+   */
+  static uint64_t hashBytes(const void* data, std::size_t length,
+                            uint64_t basis = 14695981039346656037ULL);
 };
 }
 
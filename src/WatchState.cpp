@@ -0,0 +1,223 @@
+/*
+  suPHP - (c)2002-2013 Sebastian Marsching <sebastian@marsching.com>
+          (c)2018 John Lightsey <john@nixnuts.net>
+
+  This file is part of suPHP.
+
+  suPHP is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  suPHP is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with suPHP; if not, write to the Free Software Foundation, Inc.,
+  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "Util.hpp"
+
+#include "WatchState.hpp"
+
+using namespace suPHP;
+
+namespace {
+// The daemon and other suphp processes write the file concurrently
+template <typename T>
+T load(const T& value) {
+  return *static_cast<const volatile T*>(&value);
+}
+
+bool isBelow(const std::string& path, const std::string& root) {
+  if (path.compare(0, root.length(), root) != 0) return false;
+  return path.length() == root.length() || root == "/" ||
+         path[root.length()] == '/';
+}
+}  // namespace
+
+suPHP::WatchState::WatchState() : segment(NULL) {}
+
+suPHP::WatchState::~WatchState() {
+  if (this->segment != NULL) {
+    ::munmap(this->segment, sizeof(Segment));
+  }
+}
+
+void suPHP::WatchState::map(const File& file, int fd) {
+  void* map = ::mmap(NULL, sizeof(Segment), PROT_READ | PROT_WRITE,
+                     MAP_SHARED, fd, 0);
+  int err = errno;
+  ::close(fd);
+  if (map == MAP_FAILED) {
+    throw IOException(
+        "Could not map file " + file.getPath() + ": " + ::strerror(err),
+        __FILE__, __LINE__);
+  }
+  if (this->segment != NULL) {
+    ::munmap(this->segment, sizeof(Segment));
+  }
+  this->segment = static_cast<Segment*>(map);
+}
+
+void suPHP::WatchState::create(const File& file,
+                               const std::vector<File>& roots) {
+  std::string joined;
+  for (std::vector<File>::const_iterator i = roots.begin(); i != roots.end();
+       i++) {
+    joined.append(i->getPath());
+    joined.push_back('\0');
+  }
+  if (joined.length() >= ROOTS_LENGTH) {
+    throw IOException("Too many directories to watch", __FILE__, __LINE__);
+  }
+
+  // Replaced rather than truncated, so processes still using the old
+  // file see its heartbeat stop instead of an empty table
+  std::string temporary = file.getPath() + ".new";
+  ::unlink(temporary.c_str());
+  int fd = ::open(temporary.c_str(),
+                  O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC | O_NOFOLLOW, 0644);
+  if (fd == -1) {
+    throw IOException("Could not create file " + temporary + ": " +
+                          ::strerror(errno),
+                      __FILE__, __LINE__);
+  }
+  if (::ftruncate(fd, sizeof(Segment)) == -1) {
+    int err = errno;
+    ::close(fd);
+    ::unlink(temporary.c_str());
+    throw IOException(
+        "Could not resize file " + temporary + ": " + ::strerror(err),
+        __FILE__, __LINE__);
+  }
+  this->map(File(temporary), fd);
+
+  this->segment->magic = MAGIC;
+  this->segment->version = FORMAT_VERSION;
+  this->segment->count = SLOTS;
+  // Empty slots have epoch 0
+  this->segment->epoch = 1;
+  ::memcpy(this->segment->roots, joined.data(), joined.length());
+  if (::rename(temporary.c_str(), file.getPath().c_str()) == -1) {
+    int err = errno;
+    ::unlink(temporary.c_str());
+    throw IOException("Could not rename file " + temporary + ": " +
+                          ::strerror(err),
+                      __FILE__, __LINE__);
+  }
+}
+
+void suPHP::WatchState::attach(const File& file) {
+  struct stat temp;
+  int fd = ::open(file.getPath().c_str(), O_RDWR | O_CLOEXEC);
+  if (fd == -1) {
+    throw IOException("Could not open file " + file.getPath() + ": " +
+                          ::strerror(errno),
+                      __FILE__, __LINE__);
+  }
+  if (::fstat(fd, &temp) == -1 ||
+      temp.st_size != static_cast<off_t>(sizeof(Segment))) {
+    ::close(fd);
+    throw IOException("File " + file.getPath() +
+                          " has not been created by this version of "
+                          "suphp-cached",
+                      __FILE__, __LINE__);
+  }
+  this->map(file, fd);
+
+  if (this->segment->magic != MAGIC ||
+      this->segment->version != FORMAT_VERSION ||
+      this->segment->count != SLOTS) {
+    ::munmap(this->segment, sizeof(Segment));
+    this->segment = NULL;
+    throw IOException("File " + file.getPath() +
+                          " has not been created by this version of "
+                          "suphp-cached",
+                      __FILE__, __LINE__);
+  }
+}
+
+bool suPHP::WatchState::isWatched(const File& directory,
+                                  uint64_t& epoch) const {
+  if (this->segment == NULL) return false;
+
+  // time() does not enter the kernel on Linux
+  int64_t heartbeat = load(this->segment->heartbeat);
+  int64_t now = ::time(NULL);
+  if (heartbeat == 0 || now - heartbeat > TIMEOUT) return false;
+  epoch = load(this->segment->epoch);
+  __sync_synchronize();
+
+  const char* root = this->segment->roots;
+  const char* end = root + ROOTS_LENGTH;
+  while (root < end && *root != '\0') {
+    std::string path(root, ::strnlen(root, end - root));
+    if (isBelow(directory.getPath(), path)) return true;
+    root += path.length() + 1;
+  }
+  return false;
+}
+
+bool suPHP::WatchState::isVerified(const std::string& key,
+                                   uint64_t epoch) const {
+  if (this->segment == NULL || key.length() > KEY_LENGTH) return false;
+
+  const Slot& slot =
+      this->segment->slots[Util::hashBytes(key.data(), key.length()) % SLOTS];
+  uint32_t seq = load(slot.seq);
+  if (seq & 1) return false;
+  __sync_synchronize();
+  bool found = slot.epoch == epoch && slot.length == key.length() &&
+               ::memcmp(slot.key, key.data(), key.length()) == 0;
+  __sync_synchronize();
+  return found && load(slot.seq) == seq;
+}
+
+void suPHP::WatchState::setVerified(const std::string& key,
+                                    uint64_t epoch) {
+  if (this->segment == NULL || key.length() > KEY_LENGTH) return;
+
+  Slot& slot =
+      this->segment->slots[Util::hashBytes(key.data(), key.length()) % SLOTS];
+  uint32_t seq = slot.seq;
+  // Another suphp process is writing the slot
+  if ((seq & 1) || !__sync_bool_compare_and_swap(&slot.seq, seq, seq + 1)) {
+    return;
+  }
+  slot.epoch = epoch;
+  slot.length = key.length();
+  ::memcpy(slot.key, key.data(), key.length());
+  __sync_fetch_and_add(&slot.seq, 1);
+}
+
+void suPHP::WatchState::invalidate() {
+  if (this->segment == NULL) return;
+
+  __sync_fetch_and_add(&this->segment->epoch, 1);
+}
+
+void suPHP::WatchState::beat() {
+  if (this->segment == NULL) return;
+
+  __sync_synchronize();
+  this->segment->heartbeat = ::time(NULL);
+}
+
+void suPHP::WatchState::stop() {
+  if (this->segment == NULL) return;
+
+  this->segment->heartbeat = 0;
+  this->invalidate();
+}
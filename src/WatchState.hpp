@@ -0,0 +1,147 @@
+/*
+  suPHP - (c)2002-2013 Sebastian Marsching <sebastian@marsching.com>
+          (c)2018 John Lightsey <john@nixnuts.net>
+
+  This file is part of suPHP.
+
+  suPHP is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  suPHP is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with suPHP; if not, write to the Free Software Foundation, Inc.,
+  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#ifndef SUPHP_WATCHSTATE_H
+#define SUPHP_WATCHSTATE_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "File.hpp"
+#include "IOException.hpp"
+
+namespace suPHP {
+
+/**
+ * Class sharing the directories found in the script index with
+ * suphp-cached, which watches the docroots with inotify. The file holds
+ * the directories watched, an epoch the daemon increments whenever a
+ * directory below them or above them is chmod'ed, chown'ed, renamed,
+ * created or removed, and a table of index keys with the epoch their
+ * directories were last verified in. While the daemon is alive and the
+ * epoch has not changed, a key in the table is trusted without looking
+ * at the directories again.
+ */
+class WatchState {
+ public:
+  enum {
+    MAGIC = 0x57505053,  // "SPPW"
+    FORMAT_VERSION = 1,
+    SLOTS = 4096,
+    KEY_LENGTH = 240,
+    ROOTS_LENGTH = 4096,
+    // Seconds without a heartbeat after which the daemon is presumed dead
+    TIMEOUT = 5
+  };
+
+  /**
+   * Layout of the shared file. seq of a slot is odd while it is
+   * written, roots are the watched directories separated by NUL.
+   */
+  struct Slot {
+    uint32_t seq;
+    uint32_t length;
+    uint64_t epoch;
+    char key[KEY_LENGTH];
+  };
+
+  struct Segment {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t count;
+    uint32_t reserved;
+    uint64_t epoch;
+    int64_t heartbeat;
+    char roots[ROOTS_LENGTH];
+    Slot slots[SLOTS];
+  };
+
+ private:
+  Segment* segment;
+
+  WatchState(const WatchState&) = delete;
+  WatchState& operator=(const WatchState&) = delete;
+
+  /**
+   * Maps file, which fd refers to
+   */
+  void map(const File& file, int fd);
+
+ public:
+  /**
+   * Constructor, nothing is watched until attach() or create() has been
+   * called
+   */
+  WatchState();
+
+  /**
+   * Destructor, unmaps the shared file
+   */
+  ~WatchState();
+
+  /**
+   * Replaces file by an empty state watching roots, for the daemon.
+   * Nothing is trusted until beat() is called.
+   */
+  void create(const File& file, const std::vector<File>& roots);
+
+  /**
+   * Maps the file created by suphp-cached
+   */
+  void attach(const File& file);
+
+  /**
+   * Checks whether the daemon is alive and watches directory. Sets
+   * epoch to the current epoch, which has to be read before the
+   * directories are verified.
+   */
+  bool isWatched(const File& directory, uint64_t& epoch) const;
+
+  /**
+   * Checks whether key has been verified in epoch
+   */
+  bool isVerified(const std::string& key, uint64_t epoch) const;
+
+  /**
+   * Records that key has been verified in epoch. Keys too long for a
+   * slot are not recorded.
+   */
+  void setVerified(const std::string& key, uint64_t epoch);
+
+  /**
+   * Starts a new epoch, so no key verified before is trusted any more
+   */
+  void invalidate();
+
+  /**
+   * Tells suphp that the daemon is alive, called at least once a second
+   */
+  void beat();
+
+  /**
+   * Tells suphp that the directories are not watched any more
+   */
+  void stop();
+};
+}  // namespace suPHP
+
+#endif  // SUPHP_WATCHSTATE_H
@@ -19,11 +19,22 @@
   51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
 */
 
+/* needed for clone() and pipe2() */
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
 #include "apr.h"
+#include "apr_atomic.h"
 #include "apr_buckets.h"
+#include "apr_date.h"
+#include "apr_hash.h"
+#include "apr_lib.h"
 #include "apr_poll.h"
+#include "apr_shm.h"
 #include "apr_strings.h"
 #include "apr_thread_proc.h"
+#include "apr_version.h"
 
 #define CORE_PRIVATE
 
@@ -43,6 +54,23 @@
 /* needed for get_suexec_identity hook */
 #include "unixd.h"
 
+#ifdef __linux__
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/prctl.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
 module AP_MODULE_DECLARE_DATA suphp_module;
 
 /*********************
@@ -51,6 +79,8 @@ module AP_MODULE_DECLARE_DATA suphp_module;
 
 static apr_status_t suphp_log_script_err(request_rec *r,
                                          apr_file_t *script_err) {
+  const char *token = apr_table_get(r->notes, "suphp-refusal-token");
+  apr_size_t token_len = token ? strlen(token) : 0;
   char argsbuffer[HUGE_STRING_LEN];
   char *newline;
   apr_status_t rv;
@@ -61,6 +91,12 @@ static apr_status_t suphp_log_script_err(request_rec *r,
     if (newline) {
       *newline = '\0';
     }
+    /* The reason suphp refused the script, see suphp_refusal_store() */
+    if (token && !strncmp(argsbuffer, token, token_len) &&
+        argsbuffer[token_len] == ' ') {
+      apr_table_set(r->notes, "suphp-refused", argsbuffer + token_len + 1);
+      continue;
+    }
     ap_log_rerror(APLOG_MARK, APLOG_ERR, 0, r, "%s", argsbuffer);
   }
 
@@ -102,6 +138,19 @@ char *suphp_brigade_read(apr_pool_t *p, apr_bucket_brigade *bb, int bytes) {
   return target_buf;
 }
 
+#define SUPHP_HASH_INIT APR_UINT64_C(0xcbf29ce484222325)
+
+/* Continues the 64 bit FNV-1a hash of the bytes hashed so far */
+static apr_uint64_t suphp_hash(apr_uint64_t hash, const void *data,
+                               apr_size_t len) {
+  const unsigned char *pos = data;
+  while (len--) {
+    hash ^= *pos++;
+    hash *= APR_UINT64_C(0x100000001b3);
+  }
+  return hash;
+}
+
 /**************************
   Configuration processing
  **************************/
@@ -113,6 +162,69 @@ char *suphp_brigade_read(apr_pool_t *p, apr_bucket_brigade *bb, int bytes) {
 #define SUPHP_ENGINE_ON 1
 #define SUPHP_ENGINE_UNDEFINED 2
 
+#define SUPHP_SPAWN_UNDEFINED 0
+#define SUPHP_SPAWN_FORK 1
+#define SUPHP_SPAWN_VFORK 2
+#define SUPHP_SPAWN_DAEMON 3
+
+#define SUPHP_SPAWND_DEFAULT_SOCKET "suphp-spawn.sock"
+
+#define SUPHP_SCRIPT_FD_UNDEFINED 0
+#define SUPHP_SCRIPT_FD_OFF 1
+#define SUPHP_SCRIPT_FD_ON 2
+
+#define SUPHP_CONDITIONAL_CACHE_UNDEFINED 0
+#define SUPHP_CONDITIONAL_CACHE_OFF 1
+#define SUPHP_CONDITIONAL_CACHE_ON 2
+
+#define SUPHP_VALIDATORS_DEFAULT 1024
+
+#define SUPHP_RESPONSE_CACHE_UNDEFINED 0
+#define SUPHP_RESPONSE_CACHE_OFF 1
+#define SUPHP_RESPONSE_CACHE_ON 2
+
+#define SUPHP_RESPONSES_DEFAULT 1024
+#define SUPHP_RESPONSES_QUOTA_DEFAULT 4194304
+
+#define SUPHP_RESOURCE_USAGE_UNDEFINED 0
+#define SUPHP_RESOURCE_USAGE_OFF 1
+#define SUPHP_RESOURCE_USAGE_ON 2
+
+#define SUPHP_LIMIT_TIMEOUT_DEFAULT 10
+#define SUPHP_LIMIT_QUEUE_DEFAULT 32
+#define SUPHP_LIMIT_QUEUE_MAX 64
+
+/* Descriptor number of the script in the suphp process */
+#define SUPHP_SCRIPT_FD 3
+
+#if defined(__linux__) && defined(O_PATH)
+#define SUPHP_HAVE_SCRIPT_FD 1
+#endif
+
+/* suPHP_ConditionalCache settings, set while reading the configuration */
+static int suphp_validators_wanted = 0;
+static apr_uint32_t suphp_validators_conf_size = SUPHP_VALIDATORS_DEFAULT;
+
+/* suPHP_ResponseCache settings, set while reading the configuration */
+static int suphp_responses_wanted = 0;
+static apr_uint32_t suphp_responses_conf_size = SUPHP_RESPONSES_DEFAULT;
+static apr_uint32_t suphp_responses_quota = SUPHP_RESPONSES_QUOTA_DEFAULT;
+static const char *suphp_responses_dir = NULL;
+
+/* suPHP_Statistics, set while reading the configuration */
+static int suphp_stats_wanted = 0;
+
+/* suPHP_StageStatistics, set while reading the configuration */
+static const char *suphp_stages_path = NULL;
+
+/* suPHP_RefusalCache, set while reading the configuration */
+static apr_uint32_t suphp_refusals_ttl = 0;
+
+/* suPHP_UserProcesses settings, set while reading the configuration */
+static apr_uint32_t suphp_limits_max = 0;
+static apr_uint32_t suphp_limits_timeout = SUPHP_LIMIT_TIMEOUT_DEFAULT;
+static apr_uint32_t suphp_limits_queue = SUPHP_LIMIT_QUEUE_DEFAULT;
+
 #ifndef SUPHP_PATH_TO_SUPHP
 #define SUPHP_PATH_TO_SUPHP "/usr/sbin/suphp"
 #endif
@@ -123,10 +235,70 @@ typedef struct {
   int cmode;  // Server of directory configuration?
   char *target_user;
   char *target_group;
-  apr_table_t *handlers;
+  apr_hash_t *handlers;  // Lower-cased handler name -> "1" (on) or "0" (off)
+  int handlers_on;       // Number of handlers that are on
   char *php_path;
+  char *source_cache;  // Directory caching highlighted source (server only)
+  int spawn_method;  // How child processes are created (server only)
+  char *spawn_socket;  // Socket of the spawn daemon (main server only)
+  int script_fd;       // Pass the script to suphp as a descriptor
+  int resource_usage;  // Record resource usage of children (server only)
+  long slow_script;    // Milliseconds after which scripts are logged
+  int conditional_cache;  // Answer conditional requests from the table
+  int response_cache;     // Serve anonymous GET requests from the cache
 } suphp_conf;
 
+/* Sets the state of handler name, which is looked up case-insensitively */
+static void suphp_set_handler(apr_pool_t *p, suphp_conf *cfg,
+                              const char *name, const char *state) {
+  char *key = apr_pstrdup(p, name);
+  const char *old;
+
+  ap_str_tolower(key);
+  old = apr_hash_get(cfg->handlers, key, APR_HASH_KEY_STRING);
+  if (old && *old != '0') cfg->handlers_on--;
+  if (*state != '0') cfg->handlers_on++;
+  apr_hash_set(cfg->handlers, key, APR_HASH_KEY_STRING, state);
+}
+
+/* Merges the handlers once, so requests only need a hash lookup */
+static void suphp_merge_handlers(apr_pool_t *p, suphp_conf *merged,
+                                 suphp_conf *parent, suphp_conf *child) {
+  apr_hash_index_t *hi;
+  const void *key;
+  void *state;
+
+  merged->handlers = apr_hash_overlay(p, child->handlers, parent->handlers);
+  merged->handlers_on = 0;
+  for (hi = apr_hash_first(NULL, merged->handlers); hi;
+       hi = apr_hash_next(hi)) {
+    apr_hash_this(hi, &key, NULL, &state);
+    if (*(const char *)state != '0') merged->handlers_on++;
+  }
+}
+
+/* Returns whether handler name is on in dconf, or if dconf does not
+   mention it, in sconf                                               */
+static int suphp_handler_on(request_rec *r, suphp_conf *sconf,
+                            suphp_conf *dconf) {
+  char buf[128];
+  char *key = buf;
+  const char *state;
+  apr_size_t len;
+  apr_size_t i;
+
+  /* Most requests are not for any handler, nothing to look up then */
+  if (!dconf->handlers_on && !sconf->handlers_on) return 0;
+
+  len = strlen(r->handler);
+  if (len >= sizeof(buf)) key = apr_palloc(r->pool, len + 1);
+  for (i = 0; i <= len; i++) key[i] = apr_tolower(r->handler[i]);
+
+  state = apr_hash_get(dconf->handlers, key, len);
+  if (state == NULL) state = apr_hash_get(sconf->handlers, key, len);
+  return state != NULL && *state != '0';
+}
+
 static void *suphp_create_dir_config(apr_pool_t *p, char *dir) {
   suphp_conf *cfg = (suphp_conf *)apr_pcalloc(p, sizeof(suphp_conf));
 
@@ -136,10 +308,10 @@ static void *suphp_create_dir_config(apr_pool_t *p, char *dir) {
   cfg->cmode = SUPHP_CONFIG_MODE_DIRECTORY;
   cfg->target_user = NULL;
   cfg->target_group = NULL;
+  cfg->conditional_cache = SUPHP_CONDITIONAL_CACHE_UNDEFINED;
+  cfg->response_cache = SUPHP_RESPONSE_CACHE_UNDEFINED;
 
-  /* Create table with 0 initial elements */
-  /* This size may be increased for performance reasons */
-  cfg->handlers = apr_table_make(p, 0);
+  cfg->handlers = apr_hash_make(p);
 
   return (void *)cfg;
 }
@@ -178,7 +350,17 @@ static void *suphp_merge_dir_config(apr_pool_t *p, void *base,
   else
     merged->target_group = NULL;
 
-  merged->handlers = apr_table_overlay(p, child->handlers, parent->handlers);
+  if (child->conditional_cache != SUPHP_CONDITIONAL_CACHE_UNDEFINED)
+    merged->conditional_cache = child->conditional_cache;
+  else
+    merged->conditional_cache = parent->conditional_cache;
+
+  if (child->response_cache != SUPHP_RESPONSE_CACHE_UNDEFINED)
+    merged->response_cache = child->response_cache;
+  else
+    merged->response_cache = parent->response_cache;
+
+  suphp_merge_handlers(p, merged, parent, child);
 
   return (void *)merged;
 }
@@ -188,11 +370,13 @@ static void *suphp_create_server_config(apr_pool_t *p, server_rec *s) {
 
   cfg->engine = SUPHP_ENGINE_UNDEFINED;
   cfg->php_path = NULL;
+  cfg->spawn_method = SUPHP_SPAWN_UNDEFINED;
+  cfg->script_fd = SUPHP_SCRIPT_FD_UNDEFINED;
+  cfg->resource_usage = SUPHP_RESOURCE_USAGE_UNDEFINED;
+  cfg->slow_script = -1;
   cfg->cmode = SUPHP_CONFIG_MODE_SERVER;
 
-  /* Create table with 0 initial elements */
-  /* This size may be increased for performance reasons */
-  cfg->handlers = apr_table_make(p, 0);
+  cfg->handlers = apr_hash_make(p);
 
   return (void *)cfg;
 }
@@ -213,6 +397,31 @@ static void *suphp_merge_server_config(apr_pool_t *p, void *base,
   else
     merged->php_path = apr_pstrdup(p, parent->php_path);
 
+  if (child->source_cache != NULL)
+    merged->source_cache = child->source_cache;
+  else
+    merged->source_cache = parent->source_cache;
+
+  if (child->spawn_method != SUPHP_SPAWN_UNDEFINED)
+    merged->spawn_method = child->spawn_method;
+  else
+    merged->spawn_method = parent->spawn_method;
+
+  if (child->script_fd != SUPHP_SCRIPT_FD_UNDEFINED)
+    merged->script_fd = child->script_fd;
+  else
+    merged->script_fd = parent->script_fd;
+
+  if (child->resource_usage != SUPHP_RESOURCE_USAGE_UNDEFINED)
+    merged->resource_usage = child->resource_usage;
+  else
+    merged->resource_usage = parent->resource_usage;
+
+  if (child->slow_script != -1)
+    merged->slow_script = child->slow_script;
+  else
+    merged->slow_script = parent->slow_script;
+
   if (child->target_user)
     merged->target_user = apr_pstrdup(p, child->target_user);
   else if (parent->target_user)
@@ -227,7 +436,7 @@ static void *suphp_merge_server_config(apr_pool_t *p, void *base,
   else
     merged->target_group = NULL;
 
-  merged->handlers = apr_table_overlay(p, child->handlers, parent->handlers);
+  suphp_merge_handlers(p, merged, parent, child);
 
   return (void *)merged;
 }
@@ -236,6 +445,27 @@ static void *suphp_merge_server_config(apr_pool_t *p, void *base,
   Command handlers
  ******************/
 
+/* Parses arg as a number between min and max for the GLOBAL_ONLY
+   directive of cmd                                             */
+static const char *suphp_parse_global_number(cmd_parms *cmd, const char *arg,
+                                             long min, long max,
+                                             apr_uint32_t *value) {
+  const char *err = ap_check_cmd_context(cmd, GLOBAL_ONLY);
+  char *end;
+  long number;
+
+  if (err != NULL) return err;
+
+  number = strtol(arg, &end, 10);
+  if (*arg == '\0' || *end != '\0' || number < min || number > max) {
+    return apr_psprintf(cmd->pool, "%s must be a number between %ld and %ld",
+                        cmd->cmd->name, min, max);
+  }
+  *value = number;
+
+  return NULL;
+}
+
 static const char *suphp_handle_cmd_engine(cmd_parms *cmd, void *mconfig,
                                            int flag) {
   server_rec *s = cmd->server;
@@ -290,7 +520,7 @@ static const char *suphp_handle_cmd_add_handler(cmd_parms *cmd, void *mconfig,
                                              &suphp_module);
 
   // Mark active handler with '1'
-  apr_table_set(cfg->handlers, arg, "1");
+  suphp_set_handler(cmd->pool, cfg, arg, "1");
 
   return NULL;
 }
@@ -306,7 +536,7 @@ static const char *suphp_handle_cmd_remove_handler(cmd_parms *cmd,
                                              &suphp_module);
 
   // Mark deactivated handler with '0'
-  apr_table_set(cfg->handlers, arg, "0");
+  suphp_set_handler(cmd->pool, cfg, arg, "0");
 
   return NULL;
 }
@@ -323,6 +553,221 @@ static const char *suphp_handle_cmd_phppath(cmd_parms *cmd, void *mconfig,
   return NULL;
 }
 
+static const char *suphp_handle_cmd_source_cache(cmd_parms *cmd,
+                                                 void *mconfig,
+                                                 const char *arg) {
+  suphp_conf *cfg = (suphp_conf *)ap_get_module_config(
+      cmd->server->module_config, &suphp_module);
+
+  cfg->source_cache = ap_server_root_relative(cmd->pool, arg);
+  if (cfg->source_cache == NULL) {
+    return apr_pstrcat(cmd->pool, "Invalid suPHP_SourceCache path ", arg,
+                       NULL);
+  }
+
+  return NULL;
+}
+
+static const char *suphp_handle_cmd_conditional_cache(cmd_parms *cmd,
+                                                      void *mconfig,
+                                                      int flag) {
+  suphp_conf *cfg = (suphp_conf *)mconfig;
+
+  if (flag) {
+    cfg->conditional_cache = SUPHP_CONDITIONAL_CACHE_ON;
+    suphp_validators_wanted = 1;
+  } else {
+    cfg->conditional_cache = SUPHP_CONDITIONAL_CACHE_OFF;
+  }
+
+  return NULL;
+}
+
+static const char *suphp_handle_cmd_conditional_cache_size(cmd_parms *cmd,
+                                                           void *mconfig,
+                                                           const char *arg) {
+  return suphp_parse_global_number(cmd, arg, 0, 1048576,
+                                   &suphp_validators_conf_size);
+}
+
+static const char *suphp_handle_cmd_response_cache(cmd_parms *cmd,
+                                                   void *mconfig, int flag) {
+  suphp_conf *cfg = (suphp_conf *)mconfig;
+
+  if (flag) {
+    cfg->response_cache = SUPHP_RESPONSE_CACHE_ON;
+    suphp_responses_wanted = 1;
+  } else {
+    cfg->response_cache = SUPHP_RESPONSE_CACHE_OFF;
+  }
+
+  return NULL;
+}
+
+static const char *suphp_handle_cmd_response_cache_dir(cmd_parms *cmd,
+                                                       void *mconfig,
+                                                       const char *arg) {
+  const char *err = ap_check_cmd_context(cmd, GLOBAL_ONLY);
+
+  if (err != NULL) return err;
+
+  suphp_responses_dir = ap_server_root_relative(cmd->pool, arg);
+  if (suphp_responses_dir == NULL) {
+    return apr_pstrcat(cmd->pool, "Invalid suPHP_ResponseCacheDir path ", arg,
+                       NULL);
+  }
+
+  return NULL;
+}
+
+static const char *suphp_handle_cmd_response_cache_size(cmd_parms *cmd,
+                                                        void *mconfig,
+                                                        const char *arg) {
+  return suphp_parse_global_number(cmd, arg, 0, 1048576,
+                                   &suphp_responses_conf_size);
+}
+
+static const char *suphp_handle_cmd_response_cache_quota(cmd_parms *cmd,
+                                                         void *mconfig,
+                                                         const char *arg) {
+  return suphp_parse_global_number(cmd, arg, 0, 2147483647,
+                                   &suphp_responses_quota);
+}
+
+static const char *suphp_handle_cmd_statistics(cmd_parms *cmd,
+                                               void *mconfig, int flag) {
+  const char *err = ap_check_cmd_context(cmd, GLOBAL_ONLY);
+
+  if (err != NULL) return err;
+
+  suphp_stats_wanted = flag;
+
+  return NULL;
+}
+
+static const char *suphp_handle_cmd_stage_statistics(cmd_parms *cmd,
+                                                     void *mconfig,
+                                                     const char *arg) {
+  const char *err = ap_check_cmd_context(cmd, GLOBAL_ONLY);
+
+  if (err != NULL) return err;
+
+#ifdef DEFAULT_REL_RUNTIMEDIR
+  suphp_stages_path = ap_runtime_dir_relative(cmd->pool, arg);
+#else
+  suphp_stages_path = ap_server_root_relative(cmd->pool, arg);
+#endif
+  if (suphp_stages_path == NULL) {
+    return apr_pstrcat(cmd->pool, "Invalid suPHP_StageStatistics path ", arg,
+                       NULL);
+  }
+
+  return NULL;
+}
+
+static const char *suphp_handle_cmd_refusal_cache(cmd_parms *cmd,
+                                                  void *mconfig,
+                                                  const char *arg) {
+  return suphp_parse_global_number(cmd, arg, 0, 86400, &suphp_refusals_ttl);
+}
+
+static const char *suphp_handle_cmd_user_processes(cmd_parms *cmd,
+                                                   void *mconfig,
+                                                   const char *arg) {
+  return suphp_parse_global_number(cmd, arg, 0, 65535, &suphp_limits_max);
+}
+
+static const char *suphp_handle_cmd_user_queue_timeout(cmd_parms *cmd,
+                                                       void *mconfig,
+                                                       const char *arg) {
+  return suphp_parse_global_number(cmd, arg, 0, 3600, &suphp_limits_timeout);
+}
+
+static const char *suphp_handle_cmd_user_queue_length(cmd_parms *cmd,
+                                                      void *mconfig,
+                                                      const char *arg) {
+  /* The ticket being served and the queue must fit into abandoned */
+  return suphp_parse_global_number(cmd, arg, 0, SUPHP_LIMIT_QUEUE_MAX - 1,
+                                   &suphp_limits_queue);
+}
+
+static const char *suphp_handle_cmd_spawn_method(cmd_parms *cmd,
+                                                 void *mconfig,
+                                                 const char *arg) {
+  server_rec *s = cmd->server;
+  suphp_conf *cfg;
+
+  cfg = (suphp_conf *)ap_get_module_config(s->module_config, &suphp_module);
+
+  if (!strcasecmp(arg, "fork"))
+    cfg->spawn_method = SUPHP_SPAWN_FORK;
+  else if (!strcasecmp(arg, "vfork"))
+    cfg->spawn_method = SUPHP_SPAWN_VFORK;
+  else if (!strcasecmp(arg, "daemon"))
+    cfg->spawn_method = SUPHP_SPAWN_DAEMON;
+  else
+    return "suPHP_SpawnMethod must be \"fork\", \"vfork\" or \"daemon\"";
+
+  return NULL;
+}
+
+static const char *suphp_handle_cmd_script_fd(cmd_parms *cmd,
+                                              void *mconfig, int flag) {
+  suphp_conf *cfg = (suphp_conf *)ap_get_module_config(
+      cmd->server->module_config, &suphp_module);
+
+#ifndef SUPHP_HAVE_SCRIPT_FD
+  if (flag) return "suPHP_ScriptDescriptor is not supported on this system";
+#endif
+
+  cfg->script_fd = flag ? SUPHP_SCRIPT_FD_ON : SUPHP_SCRIPT_FD_OFF;
+
+  return NULL;
+}
+
+static const char *suphp_handle_cmd_resource_usage(cmd_parms *cmd,
+                                                   void *mconfig, int flag) {
+  suphp_conf *cfg = (suphp_conf *)ap_get_module_config(
+      cmd->server->module_config, &suphp_module);
+
+  cfg->resource_usage =
+      flag ? SUPHP_RESOURCE_USAGE_ON : SUPHP_RESOURCE_USAGE_OFF;
+
+  return NULL;
+}
+
+static const char *suphp_handle_cmd_slow_script(cmd_parms *cmd,
+                                                void *mconfig,
+                                                const char *arg) {
+  suphp_conf *cfg = (suphp_conf *)ap_get_module_config(
+      cmd->server->module_config, &suphp_module);
+  char *end;
+  long ms;
+
+  ms = strtol(arg, &end, 10);
+  if (*arg == '\0' || *end != '\0' || ms < 0) {
+    return "suPHP_SlowScriptTime must be a number of milliseconds";
+  }
+  cfg->slow_script = ms;
+
+  return NULL;
+}
+
+static const char *suphp_handle_cmd_spawn_socket(cmd_parms *cmd,
+                                                 void *mconfig,
+                                                 const char *arg) {
+  const char *err = ap_check_cmd_context(cmd, GLOBAL_ONLY);
+  suphp_conf *cfg;
+
+  if (err != NULL) return err;
+
+  cfg = (suphp_conf *)ap_get_module_config(cmd->server->module_config,
+                                           &suphp_module);
+  cfg->spawn_socket = apr_pstrdup(cmd->pool, arg);
+
+  return NULL;
+}
+
 static const command_rec suphp_cmds[] = {
     AP_INIT_FLAG("suPHP_Engine", suphp_handle_cmd_engine, NULL,
                  RSRC_CONF | ACCESS_CONF,
@@ -340,8 +785,410 @@ static const command_rec suphp_cmds[] = {
                     "Tells mod_suphp not to handle these MIME-types"),
     AP_INIT_TAKE1("suPHP_PHPPath", suphp_handle_cmd_phppath, NULL, RSRC_CONF,
                   "Path to the PHP binary used to render source view"),
+    AP_INIT_TAKE1("suPHP_SourceCache", suphp_handle_cmd_source_cache, NULL,
+                  RSRC_CONF,
+                  "Directory to cache the rendered source view in"),
+    AP_INIT_FLAG("suPHP_ConditionalCache", suphp_handle_cmd_conditional_cache,
+                 NULL, RSRC_CONF | ACCESS_CONF,
+                 "Whether conditional requests are answered from validators "
+                 "recorded earlier"),
+    AP_INIT_TAKE1("suPHP_ConditionalCacheSize",
+                  suphp_handle_cmd_conditional_cache_size, NULL, RSRC_CONF,
+                  "Number of entries of the suPHP_ConditionalCache table"),
+    AP_INIT_FLAG("suPHP_ResponseCache", suphp_handle_cmd_response_cache, NULL,
+                 RSRC_CONF | ACCESS_CONF,
+                 "Whether responses to anonymous GET requests are cached"),
+    AP_INIT_TAKE1("suPHP_ResponseCacheDir",
+                  suphp_handle_cmd_response_cache_dir, NULL, RSRC_CONF,
+                  "Directory the suPHP_ResponseCache keeps responses in"),
+    AP_INIT_TAKE1("suPHP_ResponseCacheSize",
+                  suphp_handle_cmd_response_cache_size, NULL, RSRC_CONF,
+                  "Number of entries of the suPHP_ResponseCache table"),
+    AP_INIT_TAKE1("suPHP_ResponseCacheQuota",
+                  suphp_handle_cmd_response_cache_quota, NULL, RSRC_CONF,
+                  "Bytes of the suPHP_ResponseCache each user may take"),
+    AP_INIT_FLAG("suPHP_Statistics", suphp_handle_cmd_statistics, NULL,
+                 RSRC_CONF,
+                 "Whether statistics are kept for the suphp-status handler"),
+    AP_INIT_TAKE1("suPHP_StageStatistics", suphp_handle_cmd_stage_statistics,
+                  NULL, RSRC_CONF,
+                  "File in which suphp records the time taken by its stages"),
+    AP_INIT_TAKE1("suPHP_RefusalCache", suphp_handle_cmd_refusal_cache, NULL,
+                  RSRC_CONF,
+                  "Seconds for which scripts refused by suphp are refused "
+                  "without starting suphp, 0 to disable"),
+    AP_INIT_TAKE1("suPHP_UserProcesses", suphp_handle_cmd_user_processes,
+                  NULL, RSRC_CONF,
+                  "Number of scripts each user may run at the same time, "
+                  "0 (default) for no limit"),
+    AP_INIT_TAKE1("suPHP_UserQueueTimeout",
+                  suphp_handle_cmd_user_queue_timeout, NULL, RSRC_CONF,
+                  "Seconds a request waits for suPHP_UserProcesses"),
+    AP_INIT_TAKE1("suPHP_UserQueueLength", suphp_handle_cmd_user_queue_length,
+                  NULL, RSRC_CONF,
+                  "Number of requests of each user that may wait for "
+                  "suPHP_UserProcesses"),
+    AP_INIT_FLAG("suPHP_ResourceUsage", suphp_handle_cmd_resource_usage, NULL,
+                 RSRC_CONF,
+                 "Whether the resource usage of scripts is recorded in the "
+                 "notes of the request"),
+    AP_INIT_TAKE1("suPHP_SlowScriptTime", suphp_handle_cmd_slow_script, NULL,
+                  RSRC_CONF,
+                  "Milliseconds after which scripts are logged as slow, "
+                  "0 (default) to log none"),
+    AP_INIT_TAKE1("suPHP_SpawnMethod", suphp_handle_cmd_spawn_method, NULL,
+                  RSRC_CONF,
+                  "How child processes are created, fork (default), vfork "
+                  "or daemon"),
+    AP_INIT_TAKE1("suPHP_SpawnSocket", suphp_handle_cmd_spawn_socket, NULL,
+                  RSRC_CONF, "Path of the socket of the spawn daemon"),
+    AP_INIT_FLAG("suPHP_ScriptDescriptor", suphp_handle_cmd_script_fd, NULL,
+                 RSRC_CONF,
+                 "Whether the script is passed to suphp as an open "
+                 "descriptor"),
     {NULL}};
 
+/***********************************************
+  Statistics (suPHP_Statistics, suphp-status handler)
+
+  Counters in shared memory, updated by the handlers of all processes
+  with atomic operations and shown by the suphp-status handler.
+ ***********************************************/
+
+/* Spawn latency buckets, bucket i counts spawns of 2^i to 2^(i+1)
+   microseconds and the last one all slower spawns                 */
+#define SUPHP_STATS_BUCKETS 24
+#define SUPHP_STATS_USERS 256
+#define SUPHP_STATS_NAME_MAX 32
+
+enum suphp_error {
+  SUPHP_ERROR_FORBIDDEN,
+  SUPHP_ERROR_NOT_FOUND,
+  SUPHP_ERROR_SPAWN,
+  SUPHP_ERROR_HEADERS,
+  SUPHP_ERROR_TIMEOUT,
+  SUPHP_ERROR_BUSY,
+  SUPHP_ERROR_REFUSED,
+  SUPHP_ERRORS
+};
+
+static const char *const suphp_error_names[SUPHP_ERRORS] = {
+    "forbidden", "not_found", "spawn", "headers", "timeout", "busy",
+    "refused"};
+
+struct suphp_stats_user {
+  volatile apr_uint32_t key; /* hash of the name, 0 if the slot is free */
+  volatile apr_uint32_t active;
+  volatile apr_uint64_t scripts;
+  char name[SUPHP_STATS_NAME_MAX];
+};
+
+struct suphp_stats {
+  apr_time_t started;
+  volatile apr_uint64_t requests;
+  volatile apr_uint64_t spawns;
+  volatile apr_uint64_t spawn_usec;
+  volatile apr_uint64_t bytes_in;
+  volatile apr_uint64_t bytes_out;
+  volatile apr_uint64_t errors[SUPHP_ERRORS];
+  volatile apr_uint64_t spawn_latency[SUPHP_STATS_BUCKETS];
+  volatile apr_uint32_t active;
+  struct suphp_stats_user users[SUPHP_STATS_USERS];
+};
+
+static struct suphp_stats *suphp_stats = NULL;
+
+/* Adds n to the counter */
+static void suphp_stats_add(volatile apr_uint64_t *counter, apr_uint64_t n) {
+#if APR_MAJOR_VERSION > 1 || (APR_MAJOR_VERSION == 1 && APR_MINOR_VERSION >= 7)
+  apr_atomic_add64(counter, n);
+#else
+  __sync_fetch_and_add(counter, n);
+#endif
+}
+
+/* Creates the counters if suPHP_Statistics is on */
+static apr_status_t suphp_stats_init(apr_pool_t *pconf, server_rec *s) {
+  apr_shm_t *shm;
+  apr_status_t rv;
+
+  suphp_stats = NULL;
+  if (!suphp_stats_wanted) return APR_SUCCESS;
+
+  rv = apr_shm_create(&shm, sizeof(*suphp_stats), NULL, pconf);
+  if (rv != APR_SUCCESS) {
+    ap_log_error(APLOG_MARK, APLOG_ERR, rv, s,
+                 "couldn't create shared memory for suPHP_Statistics");
+    return rv;
+  }
+
+  suphp_stats = apr_shm_baseaddr_get(shm);
+  memset(suphp_stats, 0, sizeof(*suphp_stats));
+  suphp_stats->started = apr_time_now();
+  return APR_SUCCESS;
+}
+
+static void suphp_stats_error(enum suphp_error error) {
+  if (suphp_stats) suphp_stats_add(&suphp_stats->errors[error], 1);
+}
+
+/* Counts a child that was created in usec microseconds */
+static void suphp_stats_spawn(apr_time_t usec) {
+  apr_uint64_t rest = usec;
+  int bucket = 0;
+
+  if (suphp_stats == NULL) return;
+
+  while (rest >= 2 && bucket < SUPHP_STATS_BUCKETS - 1) {
+    rest >>= 1;
+    bucket++;
+  }
+  suphp_stats_add(&suphp_stats->spawns, 1);
+  suphp_stats_add(&suphp_stats->spawn_usec, usec);
+  suphp_stats_add(&suphp_stats->spawn_latency[bucket], 1);
+}
+
+/* Returns the counters of user, or NULL if the table is full */
+static struct suphp_stats_user *suphp_stats_user(const char *user) {
+  apr_uint64_t hash = suphp_hash(SUPHP_HASH_INIT, user, strlen(user));
+  apr_uint32_t key = (apr_uint32_t)(hash ^ (hash >> 32)) | 1;
+  apr_uint32_t i;
+
+  for (i = 0; i < SUPHP_STATS_USERS; i++) {
+    struct suphp_stats_user *slot =
+        &suphp_stats->users[(key + i) % SUPHP_STATS_USERS];
+    apr_uint32_t cur = apr_atomic_read32(&slot->key);
+
+    if (cur == 0) {
+      cur = apr_atomic_cas32(&slot->key, key, 0);
+      if (cur == 0) {
+        /* The name is only shown, a reader may see it half written */
+        apr_cpystrn(slot->name, user, sizeof(slot->name));
+        return slot;
+      }
+    }
+    if (cur == key) return slot;
+  }
+  return NULL;
+}
+
+static apr_status_t suphp_stats_release(void *data) {
+  struct suphp_stats_user *user = data;
+
+  apr_atomic_dec32(&suphp_stats->active);
+  if (user) apr_atomic_dec32(&user->active);
+  return APR_SUCCESS;
+}
+
+/* Counts a script of user running until p is cleared */
+static void suphp_stats_start(apr_pool_t *p, const char *user) {
+  struct suphp_stats_user *slot = suphp_stats_user(user);
+
+  apr_atomic_inc32(&suphp_stats->active);
+  if (slot) {
+    apr_atomic_inc32(&slot->active);
+    suphp_stats_add(&slot->scripts, 1);
+  }
+  apr_pool_cleanup_register(p, slot, suphp_stats_release,
+                            apr_pool_cleanup_null);
+}
+
+/***********************************************
+  Stage statistics (suPHP_StageStatistics)
+
+  suphp records the time it takes to load its configuration, to
+  validate the request and to prepare the execution of the script into
+  histograms in a file created here by the Apache parent, usually as
+  root, and counts the scripts it refuses by reason. It also publishes
+  there which checks of the script mode its configuration requires, so
+  they are done here before starting suphp. The layout must match
+  StageStatistics.hpp and Rejection.hpp.
+ ***********************************************/
+
+#define SUPHP_STAGES_MAGIC 0x54535053
+#define SUPHP_STAGES_VERSION 3
+#define SUPHP_STAGES 3
+#define SUPHP_STAGES_SUB_BUCKETS 32
+#define SUPHP_STAGES_BUCKETS 432
+
+#define SUPHP_REJECTIONS 17
+#define SUPHP_REJECT_FILE_GROUP_WRITEABLE 7
+#define SUPHP_REJECT_FILE_OTHERS_WRITEABLE 8
+
+#define SUPHP_POLICY_PATH 256
+#define SUPHP_POLICY_DENY_FILE_GROUP_WRITEABLE 1
+#define SUPHP_POLICY_DENY_FILE_OTHERS_WRITEABLE 2
+
+static const char *const suphp_stage_names[SUPHP_STAGES] = {
+    "Config", "Validation", "Exec"};
+
+/* Names of the reasons in the order of RejectionReason, the first one
+   is not counted                                                     */
+static const char *const suphp_rejection_names[SUPHP_REJECTIONS] = {
+    "none",
+    "script_missing",
+    "target_missing",
+    "not_in_vhost_docroot",
+    "not_readable",
+    "symlink_owner",
+    "not_in_docroot",
+    "file_group_writeable",
+    "file_others_writeable",
+    "directory_owner",
+    "directory_group_writeable",
+    "directory_others_writeable",
+    "min_uid",
+    "min_gid",
+    "uid_mismatch",
+    "gid_mismatch",
+    "script_changed"};
+
+struct suphp_stage_histogram {
+  volatile apr_uint64_t count;
+  volatile apr_uint64_t sum;
+  volatile apr_uint64_t max;
+  volatile apr_uint64_t buckets[SUPHP_STAGES_BUCKETS];
+};
+
+/* Policy of the suphp configuration file config, which had the identity
+   device to size when suphp read it. seq is odd while it is written. */
+struct suphp_stage_policy {
+  volatile apr_uint32_t seq;
+  apr_uint32_t flags;
+  apr_uint64_t device;
+  apr_uint64_t inode;
+  apr_int64_t mtime;
+  apr_int64_t mtime_nsec;
+  apr_int64_t size;
+  char config[SUPHP_POLICY_PATH];
+};
+
+struct suphp_stages {
+  apr_uint32_t magic;
+  apr_uint32_t version;
+  apr_uint32_t stages;
+  apr_uint32_t buckets;
+  struct suphp_stage_histogram histograms[SUPHP_STAGES];
+  volatile apr_uint64_t rejections[SUPHP_REJECTIONS];
+  struct suphp_stage_policy policy;
+};
+
+static struct suphp_stages *suphp_stages = NULL;
+
+static apr_status_t suphp_stages_unmap(void *data) {
+  munmap(data, sizeof(struct suphp_stages));
+  return APR_SUCCESS;
+}
+
+/* Creates the file of suPHP_StageStatistics, replacing the file of the
+   previous generation, so suphp only records into the current one     */
+static apr_status_t suphp_stages_init(apr_pool_t *pconf, server_rec *s) {
+  struct suphp_stages *stages;
+  apr_status_t rv;
+  int fd;
+
+  suphp_stages = NULL;
+  if (suphp_stages_path == NULL) return APR_SUCCESS;
+
+  unlink(suphp_stages_path);
+  fd = open(suphp_stages_path, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+  if (fd == -1 || fchmod(fd, 0644) == -1 ||
+      ftruncate(fd, sizeof(*stages)) == -1) {
+    rv = APR_FROM_OS_ERROR(errno);
+    ap_log_error(APLOG_MARK, APLOG_ERR, rv, s,
+                 "couldn't create suPHP_StageStatistics file %s",
+                 suphp_stages_path);
+    if (fd != -1) close(fd);
+    return rv;
+  }
+  stages = mmap(NULL, sizeof(*stages), PROT_READ | PROT_WRITE, MAP_SHARED,
+                fd, 0);
+  rv = APR_FROM_OS_ERROR(errno);
+  close(fd);
+  if (stages == MAP_FAILED) {
+    ap_log_error(APLOG_MARK, APLOG_ERR, rv, s,
+                 "couldn't map suPHP_StageStatistics file %s",
+                 suphp_stages_path);
+    return rv;
+  }
+  apr_pool_cleanup_register(pconf, stages, suphp_stages_unmap,
+                            apr_pool_cleanup_null);
+
+  stages->magic = SUPHP_STAGES_MAGIC;
+  stages->version = SUPHP_STAGES_VERSION;
+  stages->stages = SUPHP_STAGES;
+  stages->buckets = SUPHP_STAGES_BUCKETS;
+  suphp_stages = stages;
+  return APR_SUCCESS;
+}
+
+/* Returns the reason suphp refuses the requested script for because of
+   its mode, according to the policy suphp published, or 0. The policy
+   only applies while the configuration file has not been changed.    */
+static int suphp_stage_policy_check(request_rec *r) {
+  struct suphp_stage_policy *policy;
+  struct suphp_stage_policy copy;
+  struct stat st;
+  apr_uint32_t seq;
+  int reason = 0;
+
+  if (suphp_stages == NULL || !(r->finfo.valid & APR_FINFO_PROT)) return 0;
+
+  policy = &suphp_stages->policy;
+  seq = apr_atomic_read32(&policy->seq);
+  if (seq == 0 || (seq & 1)) return 0;
+  if ((policy->flags & SUPHP_POLICY_DENY_FILE_GROUP_WRITEABLE) &&
+      (r->finfo.protection & APR_GWRITE)) {
+    reason = SUPHP_REJECT_FILE_GROUP_WRITEABLE;
+  } else if ((policy->flags & SUPHP_POLICY_DENY_FILE_OTHERS_WRITEABLE) &&
+             (r->finfo.protection & APR_WWRITE)) {
+    reason = SUPHP_REJECT_FILE_OTHERS_WRITEABLE;
+  }
+  if (reason == 0) return 0;
+
+  /* only scripts suphp would refuse get here, so they pay for the
+     check of the configuration file                               */
+  memcpy(&copy, policy, sizeof(copy));
+  if (apr_atomic_add32(&policy->seq, 0) != seq) return 0;
+  copy.config[SUPHP_POLICY_PATH - 1] = '\0';
+  if (stat(copy.config, &st) == -1 || (apr_uint64_t)st.st_dev != copy.device ||
+      (apr_uint64_t)st.st_ino != copy.inode || st.st_mtime != copy.mtime ||
+      st.st_mtim.tv_nsec != copy.mtime_nsec || st.st_size != copy.size) {
+    return 0;
+  }
+  return reason;
+}
+
+/* Returns the smallest value counted by bucket */
+static apr_uint64_t suphp_stage_bucket_start(int bucket) {
+  int half = SUPHP_STAGES_SUB_BUCKETS / 2;
+
+  if (bucket < SUPHP_STAGES_SUB_BUCKETS) return bucket;
+  return (apr_uint64_t)((bucket - SUPHP_STAGES_SUB_BUCKETS) % half + half)
+         << ((bucket - SUPHP_STAGES_SUB_BUCKETS) / half + 1);
+}
+
+/* Returns the value below which the fraction permille / 1000 of the
+   recorded values lie, as the upper end of the bucket reaching it,
+   but not more than the largest value recorded                       */
+static apr_uint64_t suphp_stage_percentile(
+    const struct suphp_stage_histogram *histogram, apr_uint64_t count,
+    int permille) {
+  apr_uint64_t wanted = (count * permille + 999) / 1000;
+  apr_uint64_t seen = 0;
+  int i;
+
+  for (i = 0; i < SUPHP_STAGES_BUCKETS - 1; i++) {
+    seen += histogram->buckets[i];
+    if (seen >= wanted) break;
+  }
+  if (i == SUPHP_STAGES_BUCKETS - 1 ||
+      suphp_stage_bucket_start(i + 1) - 1 > histogram->max) {
+    return histogram->max;
+  }
+  return suphp_stage_bucket_start(i + 1) - 1;
+}
+
 /*****************************************
   Code for reading script's stdout/stderr
   based on mod_cgi's code
@@ -458,6 +1305,7 @@ static apr_status_t suphp_bucket_read(apr_bucket *b, const char **str,
 
     rv = apr_pollset_poll(data->pollset, timeout, &num, &results);
     if (APR_STATUS_IS_TIMEUP(rv)) {
+      if (timeout != 0) suphp_stats_error(SUPHP_ERROR_TIMEOUT);
       return (timeout == 0) ? APR_EAGAIN : rv;
     } else if (APR_STATUS_IS_EINTR(rv)) {
       continue;
@@ -518,53 +1366,2325 @@ static void suphp_discard_output(apr_bucket_brigade *bb) {
   }
 }
 
-/******************
-  Hooks / handlers
- ******************/
+/*************************
+  Child process creation
+ *************************/
+
+/* Creates the child process with apr_proc_create(), which forks the
+   complete worker process before exec'ing the program               */
+static apr_status_t suphp_spawn_fork(request_rec *r, apr_pool_t *p,
+                                     const char *progname,
+                                     const char *const *argv,
+                                     const char *const *env,
+                                     const char *dir,
+                                     core_dir_config *limits,
+                                     apr_proc_t *proc) {
+  apr_procattr_t *procattr;
+  apr_status_t rv;
 
-static int suphp_script_handler(request_rec *r);
-static int suphp_source_handler(request_rec *r);
+  if (((rv = apr_procattr_create(&procattr, p)) != APR_SUCCESS) ||
+      ((rv = apr_procattr_io_set(procattr, APR_CHILD_BLOCK, APR_CHILD_BLOCK,
+                                 APR_CHILD_BLOCK)) != APR_SUCCESS) ||
+      ((rv = apr_procattr_dir_set(procattr, dir)) != APR_SUCCESS)
+/* set resource limits */
 
-static int suphp_handler(request_rec *r) {
-  suphp_conf *sconf, *dconf;
+#ifdef RLIMIT_CPU
+      || (limits &&
+          (rv = apr_procattr_limit_set(procattr, APR_LIMIT_CPU,
+                                       limits->limit_cpu)) != APR_SUCCESS)
+#endif
+#if defined(RLIMIT_DATA) || defined(RLIMIT_VMEM) || defined(RLIMIT_AS)
+      || (limits &&
+          (rv = apr_procattr_limit_set(procattr, APR_LIMIT_MEM,
+                                       limits->limit_mem)) != APR_SUCCESS)
+#endif
+#ifdef RLIMIT_NPROC
+      || (limits &&
+          (apr_procattr_limit_set(procattr, APR_LIMIT_NPROC,
+                                  limits->limit_nproc)) != APR_SUCCESS)
+#endif
 
-  sconf = ap_get_module_config(r->server->module_config, &suphp_module);
-  dconf = ap_get_module_config(r->per_dir_config, &suphp_module);
+      || ((apr_procattr_cmdtype_set(procattr, APR_PROGRAM)) != APR_SUCCESS) ||
+      ((apr_procattr_error_check_set(procattr, 1)) != APR_SUCCESS) ||
+      ((apr_procattr_detach_set(procattr, 0)) != APR_SUCCESS)) {
+    ap_log_rerror(APLOG_MARK, APLOG_ERR, rv, r,
+                  "couldn't set child process attributes: %s", r->filename);
+    return rv;
+  }
 
-  /* only handle request if mod_suphp is active for this handler */
-  /* check only first byte of value (second has to be \0) */
-  if (apr_table_get(dconf->handlers, r->handler) != NULL) {
-    if (*(apr_table_get(dconf->handlers, r->handler)) != '0') {
-      return suphp_script_handler(r);
+  return apr_proc_create(proc, progname, argv, env, procattr, p);
+}
+
+#ifdef __linux__
+
+#define SUPHP_SPAWN_STACK_SIZE 65536
+
+struct suphp_spawn_args {
+  const char *progname;
+  const char *const *argv;
+  const char *const *env;
+  const char *dir;
+  struct rlimit *limit_cpu;
+  struct rlimit *limit_mem;
+  struct rlimit *limit_nproc;
+  int fds[3];             /* child ends of stdin, stdout and stderr */
+  int script_fd;          /* passed as SUPHP_SCRIPT_FD if not -1 */
+  sigset_t sigmask;       /* signal mask to restore before exec'ing */
+  volatile int error;     /* errno of the step that failed in the child */
+};
+
+/* Runs in the child, which shares the address space of the suspended
+   parent until it has exec'ed, so only async-signal-safe calls are made
+   and nothing but args->error is written                              */
+static int suphp_spawn_exec(void *data) {
+  struct suphp_spawn_args *args = data;
+  struct sigaction sa;
+  int fds[3];
+  int script_fd;
+  int sig;
+  int i;
+
+  /* Handlers of the parent must not run on its memory */
+  for (sig = 1; sig < NSIG; sig++) {
+    if (sigaction(sig, NULL, &sa) == 0 && sa.sa_handler != SIG_IGN &&
+        sa.sa_handler != SIG_DFL) {
+      sa.sa_handler = SIG_DFL;
+      sa.sa_flags = 0;
+      sigemptyset(&sa.sa_mask);
+      sigaction(sig, &sa, NULL);
     }
-  } else {
-    if ((apr_table_get(sconf->handlers, r->handler) != NULL) &&
-        (*(apr_table_get(sconf->handlers, r->handler)) != '0')) {
-      return suphp_script_handler(r);
+  }
+
+  /* A descriptor below SUPHP_SCRIPT_FD would be overwritten by the
+     dup2() of another one before it is used, so all of them are first
+     moved above it. The copies are closed by exec.                   */
+  for (i = 0; i < 3; i++) {
+    fds[i] = fcntl(args->fds[i], F_DUPFD_CLOEXEC, SUPHP_SCRIPT_FD + 1);
+    if (fds[i] == -1) {
+      args->error = errno;
+      _exit(127);
+    }
+  }
+  script_fd = -1;
+  if (args->script_fd != -1) {
+    script_fd = fcntl(args->script_fd, F_DUPFD_CLOEXEC, SUPHP_SCRIPT_FD + 1);
+    if (script_fd == -1) {
+      args->error = errno;
+      _exit(127);
     }
   }
 
+  for (i = 0; i < 3; i++) {
+    if (dup2(fds[i], i) == -1) {
+      args->error = errno;
+      _exit(127);
+    }
+  }
+  if (script_fd != -1 && dup2(script_fd, SUPHP_SCRIPT_FD) == -1) {
+    args->error = errno;
+    _exit(127);
+  }
+
+  if (chdir(args->dir) == -1) {
+    args->error = errno;
+    _exit(127);
+  }
+
+  if ((args->limit_cpu && setrlimit(RLIMIT_CPU, args->limit_cpu) == -1) ||
+      (args->limit_mem && setrlimit(RLIMIT_AS, args->limit_mem) == -1) ||
+      (args->limit_nproc &&
+       setrlimit(RLIMIT_NPROC, args->limit_nproc) == -1)) {
+    args->error = errno;
+    _exit(127);
+  }
+
+  sigprocmask(SIG_SETMASK, &args->sigmask, NULL);
+  execve(args->progname, (char *const *)args->argv,
+         (char *const *)args->env);
+  args->error = errno;
+  _exit(127);
+}
+
+/* Runs suphp_spawn_exec() in a child created with
+   clone(CLONE_VM | CLONE_VFORK), so the page tables of the calling
+   process are not copied. Returns the pid of the child, or -1 with
+   errno set if the child could not be created or failed to exec.   */
+static pid_t suphp_spawn_clone(struct suphp_spawn_args *args) {
+  sigset_t all;
+  char *stack;
+  pid_t pid;
+  int error = 0;
+
+  args->error = 0;
+
+  stack = mmap(NULL, SUPHP_SPAWN_STACK_SIZE, PROT_READ | PROT_WRITE,
+               MAP_PRIVATE | MAP_ANONYMOUS | MAP_STACK, -1, 0);
+  if (stack == MAP_FAILED) {
+    return -1;
+  }
+
+  sigfillset(&all);
+  pthread_sigmask(SIG_BLOCK, &all, &args->sigmask);
+  pid = clone(suphp_spawn_exec, stack + SUPHP_SPAWN_STACK_SIZE,
+              CLONE_VM | CLONE_VFORK | SIGCHLD, args);
+  if (pid == -1) {
+    error = errno;
+  }
+  pthread_sigmask(SIG_SETMASK, &args->sigmask, NULL);
+  munmap(stack, SUPHP_SPAWN_STACK_SIZE);
+
+  if (pid != -1 && args->error != 0) {
+    error = args->error;
+    waitpid(pid, NULL, 0);
+    pid = -1;
+  }
+
+  errno = error;
+  return pid;
+}
+
+/* Creates pipes for stdin, stdout and stderr of a child. The child ends
+   are pipes[0][0], pipes[1][1] and pipes[2][1].                        */
+static apr_status_t suphp_spawn_pipes(int pipes[3][2]) {
+  int error;
+  int i;
+
+  for (i = 0; i < 3; i++) {
+    if (pipe2(pipes[i], O_CLOEXEC) == -1) {
+      error = errno;
+      while (i-- > 0) {
+        close(pipes[i][0]);
+        close(pipes[i][1]);
+      }
+      return APR_FROM_OS_ERROR(error);
+    }
+  }
+
+  return APR_SUCCESS;
+}
+
+/* Closes the child ends of the pipes, and the parent ends as well unless
+   the child has been created, in which case they are handed to proc    */
+static void suphp_spawn_pipes_done(int pipes[3][2], int created,
+                                   apr_proc_t *proc, apr_pool_t *p) {
+  close(pipes[0][0]);
+  close(pipes[1][1]);
+  close(pipes[2][1]);
+
+  if (!created) {
+    close(pipes[0][1]);
+    close(pipes[1][0]);
+    close(pipes[2][0]);
+    return;
+  }
+
+  apr_os_pipe_put_ex(&proc->in, &pipes[0][1], 1, p);
+  apr_os_pipe_put_ex(&proc->out, &pipes[1][0], 1, p);
+  apr_os_pipe_put_ex(&proc->err, &pipes[2][0], 1, p);
+}
+
+/* Creates the child process with clone(CLONE_VM | CLONE_VFORK) */
+static apr_status_t suphp_spawn_vfork(request_rec *r, apr_pool_t *p,
+                                      const char *progname,
+                                      const char *const *argv,
+                                      const char *const *env,
+                                      const char *dir,
+                                      core_dir_config *limits,
+                                      int script_fd, apr_proc_t *proc) {
+  struct suphp_spawn_args args;
+  int pipes[3][2];
+  apr_status_t rv;
+  pid_t pid;
+
+  if ((rv = suphp_spawn_pipes(pipes)) != APR_SUCCESS) {
+    return rv;
+  }
+
+  args.progname = progname;
+  args.argv = argv;
+  args.env = env;
+  args.dir = dir;
+  args.limit_cpu = limits ? limits->limit_cpu : NULL;
+  args.limit_mem = limits ? limits->limit_mem : NULL;
+  args.limit_nproc = limits ? limits->limit_nproc : NULL;
+  args.fds[0] = pipes[0][0];
+  args.fds[1] = pipes[1][1];
+  args.fds[2] = pipes[2][1];
+  args.script_fd = script_fd;
+
+  pid = suphp_spawn_clone(&args);
+  rv = (pid == -1) ? APR_FROM_OS_ERROR(errno) : APR_SUCCESS;
+  proc->pid = pid;
+  suphp_spawn_pipes_done(pipes, pid != -1, proc, p);
+  return rv;
+}
+
+/*******************************************************************
+  Spawn daemon
+
+  With "suPHP_SpawnMethod daemon", a small helper process started
+  at post_config (like mod_cgid's daemon) creates the children. A
+  worker connects to its Unix socket, passes the child ends of the
+  stdio pipes with SCM_RIGHTS and the program, directory, argv,
+  environment and limits as a request, and receives the pid or the
+  error. The helper runs as the Apache user and execs the program the
+  worker names, which is suphp or, for highlighted source, PHP, so it
+  cannot do anything the worker could not do itself.
+
+  Each connection is served by a process of its own, which stays until
+  the child has exited. The worker keeps the connection open until the
+  pool of the request is cleaned up; if the child is still running
+  then, it is sent SIGTERM and SIGKILL three seconds later, as
+  apr_pool_note_subprocess() does for the other methods.
+ *******************************************************************/
+
+#define SUPHP_SPAWND_MAX_REQUEST (1024 * 1024)
+#define SUPHP_SPAWND_BACKLOG 128
+#define SUPHP_SPAWND_TIMEOUT 10
+
+/* Milliseconds a child is given to exit after SIGTERM */
+#define SUPHP_SPAWND_KILL_WAIT 3000
+
+#define SUPHP_SPAWND_LIMIT_CPU 1
+#define SUPHP_SPAWND_LIMIT_MEM 2
+#define SUPHP_SPAWND_LIMIT_NPROC 4
+
+#if HTTP_VERSION(AP_SERVER_MAJORVERSION_NUMBER, AP_SERVER_MINORVERSION_NUMBER) < 2004
+#define ap_unixd_setup_child unixd_setup_child
+#define ap_unixd_config unixd_config
+#endif
+
+/* Followed by length bytes holding progname, dir, argc arguments and
+   envc environment entries, each terminated by a NUL byte           */
+struct suphp_spawnd_request {
+  apr_uint32_t length;
+  apr_uint32_t argc;
+  apr_uint32_t envc;
+  apr_uint32_t limits; /* SUPHP_SPAWND_LIMIT_* set in the request */
+  struct rlimit limit_cpu;
+  struct rlimit limit_mem;
+  struct rlimit limit_nproc;
+};
+
+struct suphp_spawnd_reply {
+  int error;
+  pid_t pid;
+};
+
+static const char *suphp_spawnd_socket = NULL;
+static apr_proc_t *suphp_spawnd_proc = NULL;
+static server_rec *suphp_spawnd_server = NULL;
+static apr_pool_t *suphp_spawnd_pool = NULL;
+
+static int suphp_spawnd_read(int fd, void *buf, size_t len) {
+  char *pos = buf;
+  while (len > 0) {
+    ssize_t n = read(fd, pos, len);
+    if (n == -1 && errno == EINTR) continue;
+    if (n <= 0) return n == 0 ? EPIPE : errno;
+    pos += n;
+    len -= n;
+  }
+  return 0;
+}
+
+static int suphp_spawnd_write(int fd, const void *buf, size_t len) {
+  const char *pos = buf;
+  while (len > 0) {
+    ssize_t n = write(fd, pos, len);
+    if (n == -1 && errno == EINTR) continue;
+    if (n <= 0) return errno;
+    pos += n;
+    len -= n;
+  }
+  return 0;
+}
+
+/* Reads a request and the passed descriptors into args, which refers
+   to memory allocated from p. Returns an errno value on failure.    */
+static int suphp_spawnd_receive(int conn, apr_pool_t *p,
+                                struct suphp_spawn_args *args) {
+  struct suphp_spawnd_request *req = apr_pcalloc(p, sizeof(*req));
+  union {
+    struct cmsghdr align;
+    char buf[CMSG_SPACE(4 * sizeof(int))];
+  } control;
+  struct msghdr msg;
+  struct iovec iov;
+  struct cmsghdr *cmsg;
+  const char **vec;
+  char *strings;
+  char *pos;
+  apr_uint32_t count;
+  apr_uint32_t i;
+  ssize_t n;
+  int error;
+
+  memset(&msg, 0, sizeof(msg));
+  iov.iov_base = req;
+  iov.iov_len = sizeof(*req);
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control.buf;
+  msg.msg_controllen = sizeof(control.buf);
+
+  do {
+    n = recvmsg(conn, &msg, MSG_CMSG_CLOEXEC | MSG_WAITALL);
+  } while (n == -1 && errno == EINTR);
+  if (n == -1) return errno;
+
+  /* The descriptor of the script optionally follows the stdio pipes */
+  cmsg = CMSG_FIRSTHDR(&msg);
+  if (cmsg && cmsg->cmsg_level == SOL_SOCKET &&
+      cmsg->cmsg_type == SCM_RIGHTS) {
+    count = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+    if (count == 3 || count == 4) {
+      memcpy(args->fds, CMSG_DATA(cmsg), 3 * sizeof(int));
+    }
+    if (count == 4) {
+      memcpy(&args->script_fd, CMSG_DATA(cmsg) + 3 * sizeof(int),
+             sizeof(int));
+    } else if (count != 3) {
+      /* Received all the same, so they have to be closed */
+      for (i = 0; i < count; i++) {
+        int fd;
+        memcpy(&fd, CMSG_DATA(cmsg) + i * sizeof(int), sizeof(int));
+        close(fd);
+      }
+    }
+  }
+  if (n != sizeof(*req) || (msg.msg_flags & MSG_CTRUNC) ||
+      args->fds[0] == -1) {
+    return EPROTO;
+  }
+
+  count = 2 + req->argc + req->envc;
+  if (req->length == 0 || req->length > SUPHP_SPAWND_MAX_REQUEST ||
+      req->argc == 0 || count > req->length) {
+    return EPROTO;
+  }
+
+  strings = apr_palloc(p, req->length);
+  if ((error = suphp_spawnd_read(conn, strings, req->length)) != 0) {
+    return error;
+  }
+  if (strings[req->length - 1] != '\0') {
+    return EPROTO;
+  }
+
+  vec = apr_palloc(p, (count + 2) * sizeof(char *));
+  pos = strings;
+  for (i = 0; i < count; i++) {
+    if (pos >= strings + req->length) {
+      return EPROTO;
+    }
+    /* Terminate argv before the environment starts */
+    vec[i < 2 + req->argc ? i : i + 1] = pos;
+    pos += strlen(pos) + 1;
+  }
+  if (pos != strings + req->length) {
+    return EPROTO;
+  }
+  vec[2 + req->argc] = NULL;
+  vec[count + 1] = NULL;
+
+  args->progname = vec[0];
+  args->dir = vec[1];
+  args->argv = vec + 2;
+  args->env = vec + 3 + req->argc;
+  args->limit_cpu =
+      (req->limits & SUPHP_SPAWND_LIMIT_CPU) ? &req->limit_cpu : NULL;
+  args->limit_mem =
+      (req->limits & SUPHP_SPAWND_LIMIT_MEM) ? &req->limit_mem : NULL;
+  args->limit_nproc =
+      (req->limits & SUPHP_SPAWND_LIMIT_NPROC) ? &req->limit_nproc : NULL;
+  return 0;
+}
+
+/* Does nothing, SIGCHLD only has to interrupt ppoll() */
+static void suphp_spawnd_wakeup(int sig) {}
+
+/* Waits until the child pid has exited or the worker has closed conn,
+   in which case the child is killed                                  */
+static void suphp_spawnd_supervise(int conn, pid_t pid) {
+  struct sigaction sa;
+  struct pollfd pfd;
+  struct timespec delay;
+  sigset_t chld;
+  sigset_t unblocked;
+  int i;
+
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_handler = suphp_spawnd_wakeup;
+  sigemptyset(&sa.sa_mask);
+  sigaction(SIGCHLD, &sa, NULL);
+  sigemptyset(&chld);
+  sigaddset(&chld, SIGCHLD);
+  sigprocmask(SIG_BLOCK, &chld, &unblocked);
+
+  /* SIGCHLD is only delivered in ppoll(), so it cannot be missed */
+  while (waitpid(pid, NULL, WNOHANG) == 0) {
+    pfd.fd = conn;
+    pfd.events = POLLIN;
+    pfd.revents = 0;
+    if (ppoll(&pfd, 1, NULL, &unblocked) <= 0) {
+      continue;
+    }
+
+    /* The worker sends nothing more, so the connection has been closed */
+    kill(pid, SIGTERM);
+    delay.tv_sec = 0;
+    delay.tv_nsec = 10000000;
+    for (i = 0; i < SUPHP_SPAWND_KILL_WAIT / 10; i++) {
+      if (waitpid(pid, NULL, WNOHANG) != 0) return;
+      nanosleep(&delay, NULL);
+    }
+    kill(pid, SIGKILL);
+    waitpid(pid, NULL, 0);
+    return;
+  }
+}
+
+static void suphp_spawnd_serve(int conn, apr_pool_t *p) {
+  struct suphp_spawn_args args;
+  struct suphp_spawnd_reply reply;
+  int i;
+
+  memset(&args, 0, sizeof(args));
+  args.fds[0] = args.fds[1] = args.fds[2] = args.script_fd = -1;
+
+  reply.pid = -1;
+  reply.error = suphp_spawnd_receive(conn, p, &args);
+  if (reply.error == 0) {
+    reply.pid = suphp_spawn_clone(&args);
+    reply.error = (reply.pid == -1) ? errno : 0;
+  }
+
+  for (i = 0; i < 3; i++) {
+    if (args.fds[i] != -1) close(args.fds[i]);
+  }
+  if (args.script_fd != -1) close(args.script_fd);
+
+  if (suphp_spawnd_write(conn, &reply, sizeof(reply)) != 0 &&
+      reply.pid != -1) {
+    kill(reply.pid, SIGKILL);
+  }
+  if (reply.pid != -1) {
+    suphp_spawnd_supervise(conn, reply.pid);
+  }
+}
+
+/* Main loop of the spawn daemon, sd is the listening socket */
+static void suphp_spawnd_main(int sd, server_rec *s, apr_pool_t *p) {
+  struct suphp_spawnd_reply reply;
+  struct timeval timeout;
+  sigset_t none;
+  pid_t pid;
+
+  prctl(PR_SET_PDEATHSIG, SIGTERM);
+  signal(SIGCHLD, SIG_IGN); /* children are reaped automatically */
+  signal(SIGPIPE, SIG_IGN);
+  signal(SIGHUP, SIG_DFL);
+  signal(SIGTERM, SIG_DFL);
+  signal(SIGUSR1, SIG_DFL);
+  sigemptyset(&none);
+  sigprocmask(SIG_SETMASK, &none, NULL);
+
+  if (ap_unixd_setup_child() != 0) {
+    ap_log_error(APLOG_MARK, APLOG_ERR, 0, s,
+                 "suPHP spawn daemon couldn't drop privileges");
+    exit(1);
+  }
+
+  timeout.tv_sec = SUPHP_SPAWND_TIMEOUT;
+  timeout.tv_usec = 0;
+
+  while (1) {
+    int conn = accept4(sd, NULL, NULL, SOCK_CLOEXEC);
+    if (conn == -1) {
+      if (errno != EINTR) {
+        ap_log_error(APLOG_MARK, APLOG_ERR, errno, s,
+                     "suPHP spawn daemon couldn't accept connection");
+        apr_sleep(apr_time_from_sec(1));
+      }
+      continue;
+    }
+    setsockopt(conn, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    setsockopt(conn, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+    /* A worker that stalls only holds up its own process */
+    pid = fork();
+    if (pid == 0) {
+      close(sd);
+      suphp_spawnd_serve(conn, p);
+      _exit(0);
+    }
+    if (pid == -1) {
+      reply.error = errno;
+      reply.pid = -1;
+      ap_log_error(APLOG_MARK, APLOG_ERR, reply.error, s,
+                   "suPHP spawn daemon couldn't fork");
+      suphp_spawnd_write(conn, &reply, sizeof(reply));
+    }
+    close(conn);
+  }
+}
+
+static apr_status_t suphp_spawnd_start(apr_pool_t *p, server_rec *s);
+
+static void suphp_spawnd_maint(int reason, void *data, int status) {
+  apr_proc_t *proc = data;
+
+  switch (reason) {
+    case APR_OC_REASON_DEATH:
+    case APR_OC_REASON_LOST:
+      apr_proc_other_child_unregister(data);
+      ap_log_error(APLOG_MARK, APLOG_ERR, 0, suphp_spawnd_server,
+                   "suPHP spawn daemon %" APR_PID_T_FMT
+                   " died, restarting it",
+                   proc->pid);
+      suphp_spawnd_start(suphp_spawnd_pool, suphp_spawnd_server);
+      break;
+    case APR_OC_REASON_RESTART:
+    case APR_OC_REASON_UNREGISTER:
+      apr_proc_other_child_unregister(data);
+      kill(proc->pid, SIGTERM);
+      break;
+  }
+}
+
+static apr_status_t suphp_spawnd_remove_socket(void *data) {
+  unlink((const char *)data);
+  return APR_SUCCESS;
+}
+
+/* Creates the listening socket and forks the spawn daemon */
+static apr_status_t suphp_spawnd_start(apr_pool_t *p, server_rec *s) {
+  struct sockaddr_un addr;
+  apr_proc_t *proc;
+  apr_status_t rv;
+  int sd;
+
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  if (strlen(suphp_spawnd_socket) >= sizeof(addr.sun_path)) {
+    ap_log_error(APLOG_MARK, APLOG_ERR, 0, s,
+                 "suPHP spawn socket path %s is too long",
+                 suphp_spawnd_socket);
+    return APR_EGENERAL;
+  }
+  strcpy(addr.sun_path, suphp_spawnd_socket);
+
+  sd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (sd == -1) {
+    rv = APR_FROM_OS_ERROR(errno);
+    ap_log_error(APLOG_MARK, APLOG_ERR, rv, s,
+                 "couldn't create suPHP spawn socket");
+    return rv;
+  }
+
+  unlink(suphp_spawnd_socket);
+  if (bind(sd, (struct sockaddr *)&addr, sizeof(addr)) == -1 ||
+      listen(sd, SUPHP_SPAWND_BACKLOG) == -1 ||
+      chmod(suphp_spawnd_socket, 0600) == -1 ||
+      chown(suphp_spawnd_socket, ap_unixd_config.user_id, -1) == -1) {
+    rv = APR_FROM_OS_ERROR(errno);
+    ap_log_error(APLOG_MARK, APLOG_ERR, rv, s,
+                 "couldn't set up suPHP spawn socket %s",
+                 suphp_spawnd_socket);
+    close(sd);
+    return rv;
+  }
+
+  proc = apr_pcalloc(p, sizeof(*proc));
+  rv = apr_proc_fork(proc, p);
+  if (rv == APR_INCHILD) {
+    suphp_spawnd_main(sd, s, p);
+    exit(1);
+  }
+  close(sd);
+  if (rv != APR_INPARENT) {
+    ap_log_error(APLOG_MARK, APLOG_ERR, rv, s,
+                 "couldn't start suPHP spawn daemon");
+    return rv;
+  }
+
+  suphp_spawnd_proc = proc;
+  apr_pool_note_subprocess(p, proc, APR_KILL_AFTER_TIMEOUT);
+  apr_proc_other_child_register(proc, suphp_spawnd_maint, proc, NULL, p);
+  return APR_SUCCESS;
+}
+
+/* Connects to the spawn daemon, returns the socket or -1 */
+static int suphp_spawnd_connect(request_rec *r) {
+  struct sockaddr_un addr;
+  int sd;
+
+  if (suphp_spawnd_proc == NULL) {
+    return -1;
+  }
+
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  apr_cpystrn(addr.sun_path, suphp_spawnd_socket, sizeof(addr.sun_path));
+
+  sd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (sd == -1) {
+    return -1;
+  }
+  if (connect(sd, (struct sockaddr *)&addr, sizeof(addr)) == -1) {
+    ap_log_rerror(APLOG_MARK, APLOG_WARNING, errno, r,
+                  "couldn't connect to suPHP spawn daemon at %s",
+                  suphp_spawnd_socket);
+    close(sd);
+    return -1;
+  }
+  return sd;
+}
+
+/* Closes the connection to the spawn daemon, which then kills the child
+   if it is still running                                              */
+static apr_status_t suphp_spawnd_disconnect(void *data) {
+  close(*(int *)data);
+  return APR_SUCCESS;
+}
+
+/* Has the spawn daemon connected to sd create the child process */
+static apr_status_t suphp_spawn_daemon(request_rec *r, apr_pool_t *p, int sd,
+                                       const char *progname,
+                                       const char *const *argv,
+                                       const char *const *env,
+                                       const char *dir,
+                                       core_dir_config *limits,
+                                       int script_fd, apr_proc_t *proc) {
+  struct suphp_spawnd_request req;
+  struct suphp_spawnd_reply reply;
+  union {
+    struct cmsghdr align;
+    char buf[CMSG_SPACE(4 * sizeof(int))];
+  } control;
+  struct msghdr msg;
+  struct iovec iov;
+  struct cmsghdr *cmsg;
+  struct timeval timeout;
+  int pipes[3][2];
+  int fds[4];
+  int nfds = (script_fd != -1) ? 4 : 3;
+  char *strings;
+  char *pos;
+  apr_size_t length;
+  apr_status_t rv;
+  int error;
+  int i;
+
+  memset(&req, 0, sizeof(req));
+  length = strlen(progname) + strlen(dir) + 2;
+  for (i = 0; argv[i]; i++) {
+    length += strlen(argv[i]) + 1;
+    req.argc++;
+  }
+  for (i = 0; env[i]; i++) {
+    length += strlen(env[i]) + 1;
+    req.envc++;
+  }
+  if (length > SUPHP_SPAWND_MAX_REQUEST) {
+    return APR_FROM_OS_ERROR(E2BIG);
+  }
+  req.length = length;
+
+  pos = strings = apr_palloc(p, length);
+  pos = apr_cpystrn(pos, progname, length) + 1;
+  pos = apr_cpystrn(pos, dir, length) + 1;
+  for (i = 0; argv[i]; i++) {
+    pos = apr_cpystrn(pos, argv[i], length) + 1;
+  }
+  for (i = 0; env[i]; i++) {
+    pos = apr_cpystrn(pos, env[i], length) + 1;
+  }
+
+  if (limits && limits->limit_cpu) {
+    req.limits |= SUPHP_SPAWND_LIMIT_CPU;
+    req.limit_cpu = *limits->limit_cpu;
+  }
+  if (limits && limits->limit_mem) {
+    req.limits |= SUPHP_SPAWND_LIMIT_MEM;
+    req.limit_mem = *limits->limit_mem;
+  }
+  if (limits && limits->limit_nproc) {
+    req.limits |= SUPHP_SPAWND_LIMIT_NPROC;
+    req.limit_nproc = *limits->limit_nproc;
+  }
+
+  if ((rv = suphp_spawn_pipes(pipes)) != APR_SUCCESS) {
+    return rv;
+  }
+  fds[0] = pipes[0][0];
+  fds[1] = pipes[1][1];
+  fds[2] = pipes[2][1];
+  fds[3] = script_fd;
+
+  memset(&msg, 0, sizeof(msg));
+  memset(&control, 0, sizeof(control));
+  iov.iov_base = &req;
+  iov.iov_len = sizeof(req);
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control.buf;
+  msg.msg_controllen = CMSG_SPACE(nfds * sizeof(int));
+  cmsg = CMSG_FIRSTHDR(&msg);
+  cmsg->cmsg_level = SOL_SOCKET;
+  cmsg->cmsg_type = SCM_RIGHTS;
+  cmsg->cmsg_len = CMSG_LEN(nfds * sizeof(int));
+  memcpy(CMSG_DATA(cmsg), fds, nfds * sizeof(int));
+
+  timeout.tv_sec = SUPHP_SPAWND_TIMEOUT;
+  timeout.tv_usec = 0;
+  setsockopt(sd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+  setsockopt(sd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+  if (sendmsg(sd, &msg, MSG_NOSIGNAL) != sizeof(req)) {
+    error = errno ? errno : EPIPE;
+  } else if ((error = suphp_spawnd_write(sd, strings, length)) == 0 &&
+             (error = suphp_spawnd_read(sd, &reply, sizeof(reply))) == 0) {
+    error = reply.error;
+  }
+
+  proc->pid = (error == 0) ? reply.pid : -1;
+  suphp_spawn_pipes_done(pipes, error == 0, proc, p);
+  return APR_FROM_OS_ERROR(error);
+}
+
+/* Starts the spawn daemon if any server uses it */
+static apr_status_t suphp_spawnd_init(apr_pool_t *pconf, server_rec *s) {
+  server_rec *sv;
+  suphp_conf *sconf;
+  int enabled = 0;
+
+  suphp_spawnd_proc = NULL;
+  for (sv = s; sv; sv = sv->next) {
+    sconf = ap_get_module_config(sv->module_config, &suphp_module);
+    if (sconf->spawn_method == SUPHP_SPAWN_DAEMON) enabled = 1;
+  }
+  if (!enabled) {
+    return APR_SUCCESS;
+  }
+
+  sconf = ap_get_module_config(s->module_config, &suphp_module);
+  if (sconf->spawn_socket) {
+    suphp_spawnd_socket = ap_server_root_relative(pconf, sconf->spawn_socket);
+  } else {
+#ifdef DEFAULT_REL_RUNTIMEDIR
+    suphp_spawnd_socket =
+        ap_runtime_dir_relative(pconf, SUPHP_SPAWND_DEFAULT_SOCKET);
+#else
+    suphp_spawnd_socket =
+        ap_server_root_relative(pconf, "logs/" SUPHP_SPAWND_DEFAULT_SOCKET);
+#endif
+  }
+  suphp_spawnd_server = s;
+  suphp_spawnd_pool = pconf;
+  apr_pool_cleanup_register(pconf, suphp_spawnd_socket,
+                            suphp_spawnd_remove_socket,
+                            apr_pool_cleanup_null);
+
+  return suphp_spawnd_start(pconf, s);
+}
+
+#endif
+
+/* Returns a copy of env without the entry for name */
+static const char *const *suphp_env_remove(apr_pool_t *p,
+                                           const char *const *env,
+                                           const char *name) {
+  apr_size_t len = strlen(name);
+  const char **copy;
+  int n = 0;
+  int i;
+
+  while (env[n]) n++;
+  copy = apr_palloc(p, (n + 1) * sizeof(char *));
+  for (i = 0, n = 0; env[i]; i++) {
+    if (strncmp(env[i], name, len) || env[i][len] != '=') copy[n++] = env[i];
+  }
+  copy[n] = NULL;
+  return copy;
+}
+
+/* Creates the child process running progname in the directory of the
+   requested file, with pipes for its stdin, stdout and stderr. Resource
+   limits are only applied if limits is not NULL. If script_fd is not -1,
+   it is passed as SUPHP_SCRIPT_FD, unless the child has to be created
+   with fork, in which case SUPHP_SCRIPT_FD is removed from env. If own
+   is not NULL and the child can be reaped with wait4(), it is set to
+   whether the child is ours to reap, which the caller then does itself
+   instead of the cleanup of p.                                         */
+static apr_status_t suphp_spawn_child(request_rec *r, apr_pool_t *p,
+                                      const char *progname,
+                                      const char *const *argv,
+                                      const char *const *env,
+                                      core_dir_config *limits, int script_fd,
+                                      apr_proc_t *proc, int *own) {
+  suphp_conf *sconf;
+  const char *dir = ap_make_dirstr_parent(r->pool, r->filename);
+  const char *method = "fork";
+  apr_time_t start = apr_time_now();
+  apr_status_t rv;
+  int own_child = 1;
+#ifdef __linux__
+  int sd;
+#endif
+
+  sconf = ap_get_module_config(r->server->module_config, &suphp_module);
+
+#ifdef __linux__
+  if (sconf->spawn_method == SUPHP_SPAWN_DAEMON &&
+      (sd = suphp_spawnd_connect(r)) != -1) {
+    method = "daemon";
+    own_child = 0;
+    rv = suphp_spawn_daemon(r, p, sd, progname, argv, env, dir, limits,
+                            script_fd, proc);
+    if (rv == APR_SUCCESS) {
+      int *conn = apr_palloc(p, sizeof(*conn));
+      *conn = sd;
+      apr_pool_cleanup_register(p, conn, suphp_spawnd_disconnect,
+                                apr_pool_cleanup_null);
+    } else {
+      close(sd);
+    }
+  } else if (sconf->spawn_method == SUPHP_SPAWN_VFORK) {
+    method = "vfork";
+    rv = suphp_spawn_vfork(r, p, progname, argv, env, dir, limits, script_fd,
+                           proc);
+  } else
+#endif
+  {
+    /* apr_proc_create() cannot pass additional descriptors */
+    if (script_fd != -1) {
+      env = suphp_env_remove(p, env, "SUPHP_SCRIPT_FD");
+    }
+    rv = suphp_spawn_fork(r, p, progname, argv, env, dir, limits, proc);
+  }
+
+  if (rv != APR_SUCCESS) {
+    ap_log_rerror(APLOG_MARK, APLOG_ERR, rv, r,
+                  "couldn't create child process: %s for %s", progname,
+                  r->filename);
+    suphp_stats_error(SUPHP_ERROR_SPAWN);
+    return rv;
+  }
+  suphp_stats_spawn(apr_time_now() - start);
+
+  /* Children of the spawn daemon are reaped by the daemon, and killed by
+     it when p is cleaned up                                           */
+#ifdef __linux__
+  if (own != NULL) {
+    *own = own_child;
+    own_child = 0;
+  }
+#endif
+  if (own_child) {
+    apr_pool_note_subprocess(p, proc, APR_KILL_AFTER_TIMEOUT);
+  }
+  ap_log_rerror(APLOG_MARK, APLOG_DEBUG, 0, r,
+                "created child process %" APR_PID_T_FMT
+                " using %s in %" APR_TIME_T_FMT " microseconds",
+                proc->pid, method, apr_time_now() - start);
+  return APR_SUCCESS;
+}
+
+/******************************
+  Cache of highlighted source
+ ******************************/
+
+/* Returns the cache key of the highlighted source of the requested file,
+   which identifies the file by device, inode, mtime and size and the
+   PHP binary rendering it, or 0 if the file cannot be identified     */
+static apr_uint64_t suphp_source_cache_key(request_rec *r,
+                                           const char *phpexec,
+                                           apr_finfo_t *finfo) {
+  apr_int32_t wanted = APR_FINFO_IDENT | APR_FINFO_MTIME | APR_FINFO_SIZE;
+  apr_uint64_t key = SUPHP_HASH_INIT;
+
+  *finfo = r->finfo;
+  if ((finfo->valid & wanted) != wanted) {
+    apr_stat(finfo, r->filename, wanted, r->pool);
+    if ((finfo->valid & wanted) != wanted) return 0;
+  }
+
+  key = suphp_hash(key, &finfo->device, sizeof(finfo->device));
+  key = suphp_hash(key, &finfo->inode, sizeof(finfo->inode));
+  key = suphp_hash(key, &finfo->mtime, sizeof(finfo->mtime));
+  key = suphp_hash(key, &finfo->size, sizeof(finfo->size));
+  key = suphp_hash(key, phpexec, strlen(phpexec) + 1);
+  return key ? key : 1;
+}
+
+/* Sends the cached highlighted source */
+static int suphp_source_cache_send(request_rec *r, apr_file_t *file) {
+  apr_bucket_brigade *bb;
+  apr_finfo_t finfo;
+  apr_status_t rv;
+
+  rv = apr_file_info_get(&finfo, APR_FINFO_SIZE, file);
+  if (rv != APR_SUCCESS) {
+    ap_log_rerror(APLOG_MARK, APLOG_ERR, rv, r,
+                  "couldn't get size of cached source of %s", r->filename);
+    return HTTP_INTERNAL_SERVER_ERROR;
+  }
+
+  bb = apr_brigade_create(r->pool, r->connection->bucket_alloc);
+  apr_brigade_insert_file(bb, file, 0, finfo.size, r->pool);
+  APR_BRIGADE_INSERT_TAIL(bb,
+                          apr_bucket_eos_create(r->connection->bucket_alloc));
+
+  r->content_type = "text/html";
+  ap_set_content_length(r, finfo.size);
+  ap_pass_brigade(r->output_filters, bb);
+
+  return OK;
+}
+
+/* Creates the cache file for path under a temporary name, so other
+   processes never see a partial file                                */
+static apr_status_t suphp_source_cache_create(request_rec *r,
+                                              const char *path,
+                                              char **tmp_path,
+                                              apr_file_t **file) {
+  apr_status_t rv;
+
+  *tmp_path = apr_pstrcat(r->pool, path, ".XXXXXX", NULL);
+  rv = apr_file_mktemp(
+      file, *tmp_path,
+      APR_CREATE | APR_READ | APR_WRITE | APR_EXCL | APR_BINARY, r->pool);
+  if (rv != APR_SUCCESS) {
+    ap_log_rerror(APLOG_MARK, APLOG_ERR, rv, r,
+                  "couldn't create cache file for %s", path);
+  }
+  return rv;
+}
+
+/* Writes the output of PHP in bb to the cache file created by
+   suphp_source_cache_create() and renames it to path when it is
+   complete. On failure, the file is removed.                     */
+static apr_status_t suphp_source_cache_fill(request_rec *r,
+                                            apr_bucket_brigade *bb,
+                                            const char *path,
+                                            const char *tmp_path,
+                                            apr_file_t *file) {
+  apr_bucket *b;
+  apr_status_t rv = APR_SUCCESS;
+
+  while (!APR_BRIGADE_EMPTY(bb)) {
+    const char *data;
+    apr_size_t len;
+
+    b = APR_BRIGADE_FIRST(bb);
+    if (APR_BUCKET_IS_EOS(b)) break;
+
+    rv = apr_bucket_read(b, &data, &len, APR_BLOCK_READ);
+    if (rv == APR_SUCCESS) {
+      rv = apr_file_write_full(file, data, len, NULL);
+    }
+    if (rv != APR_SUCCESS) break;
+    apr_bucket_delete(b);
+  }
+
+  if (rv == APR_SUCCESS) {
+    rv = apr_file_rename(tmp_path, path, r->pool);
+  }
+  if (rv != APR_SUCCESS) {
+    ap_log_rerror(APLOG_MARK, APLOG_ERR, rv, r,
+                  "couldn't write cached source of %s to %s", r->filename,
+                  path);
+    apr_file_close(file);
+    apr_file_remove(tmp_path, r->pool);
+  }
+  return rv;
+}
+
+/***********************************************
+  Validator cache (suPHP_ConditionalCache)
+
+  Validators (ETag, Last-Modified) sent by scripts are recorded in a
+  direct-mapped table in shared memory, keyed by the URL and the
+  identity of the script file. A conditional request for an unchanged
+  script is answered with 304 without starting suphp. Slots are
+  updated without locks: seq is odd while a writer updates a slot,
+  and readers discard what they copied if seq changed meanwhile.
+ ***********************************************/
+
+#define SUPHP_VALIDATOR_ETAG_MAX 64
+
+struct suphp_validator {
+  volatile apr_uint32_t seq;
+  apr_uint64_t key;
+  apr_time_t last_modified; /* 0 if not sent */
+  char etag[SUPHP_VALIDATOR_ETAG_MAX]; /* empty if not sent */
+};
+
+static struct suphp_validator *suphp_validators = NULL;
+static apr_uint32_t suphp_validators_size = 0;
+
+/* Creates the table if suPHP_ConditionalCache is used anywhere */
+static apr_status_t suphp_validators_init(apr_pool_t *pconf, server_rec *s) {
+  apr_size_t size = suphp_validators_conf_size * sizeof(*suphp_validators);
+  apr_shm_t *shm;
+  apr_status_t rv;
+
+  suphp_validators = NULL;
+  suphp_validators_size = 0;
+  if (!suphp_validators_wanted || suphp_validators_conf_size == 0) {
+    return APR_SUCCESS;
+  }
+
+  rv = apr_shm_create(&shm, size, NULL, pconf);
+  if (rv != APR_SUCCESS) {
+    ap_log_error(APLOG_MARK, APLOG_ERR, rv, s,
+                 "couldn't create shared memory for suPHP_ConditionalCache");
+    return rv;
+  }
+
+  suphp_validators = apr_shm_baseaddr_get(shm);
+  memset(suphp_validators, 0, size);
+  suphp_validators_size = suphp_validators_conf_size;
+  return APR_SUCCESS;
+}
+
+/* Returns the key of the request, made from the URL and the identity of
+   the script file, or 0 if the script file cannot be identified        */
+static apr_uint64_t suphp_request_key(request_rec *r) {
+  apr_int32_t wanted = APR_FINFO_IDENT | APR_FINFO_MTIME | APR_FINFO_SIZE;
+  apr_uint64_t key = SUPHP_HASH_INIT;
+
+  if ((r->finfo.valid & wanted) != wanted) return 0;
+
+  if (r->server->server_hostname) {
+    key = suphp_hash(key, r->server->server_hostname,
+                     strlen(r->server->server_hostname) + 1);
+  }
+  key = suphp_hash(key, r->uri, strlen(r->uri) + 1);
+  if (r->args) {
+    key = suphp_hash(key, r->args, strlen(r->args) + 1);
+  }
+  key = suphp_hash(key, &r->finfo.device, sizeof(r->finfo.device));
+  key = suphp_hash(key, &r->finfo.inode, sizeof(r->finfo.inode));
+  key = suphp_hash(key, &r->finfo.mtime, sizeof(r->finfo.mtime));
+  key = suphp_hash(key, &r->finfo.size, sizeof(r->finfo.size));
+  return key ? key : 1;
+}
+
+/* Returns 1 if the validators recorded for key show that the client's
+   copy is current, in which case they are set in the response, which
+   can be answered with 304                                           */
+static int suphp_validator_check(request_rec *r, apr_uint64_t key) {
+  struct suphp_validator *slot = &suphp_validators[key % suphp_validators_size];
+  struct suphp_validator copy;
+  apr_time_t mtime = r->mtime;
+  apr_uint32_t seq;
+
+  seq = apr_atomic_read32(&slot->seq);
+  if (seq & 1) return 0;
+  memcpy(&copy, slot, sizeof(copy));
+  if (apr_atomic_add32(&slot->seq, 0) != seq || copy.key != key) return 0;
+  copy.etag[SUPHP_VALIDATOR_ETAG_MAX - 1] = '\0';
+
+  if (copy.etag[0]) {
+    apr_table_setn(r->headers_out, "ETag", apr_pstrdup(r->pool, copy.etag));
+  }
+  if (copy.last_modified) {
+    ap_update_mtime(r, copy.last_modified);
+    ap_set_last_modified(r);
+  }
+  if (ap_meets_conditions(r) == HTTP_NOT_MODIFIED) {
+    return 1;
+  }
+
+  /* The script sets its own validators */
+  apr_table_unset(r->headers_out, "ETag");
+  apr_table_unset(r->headers_out, "Last-Modified");
+  r->mtime = mtime;
+  return 0;
+}
+
+/* Records the validators the script sent */
+static void suphp_validator_store(request_rec *r, apr_uint64_t key) {
+  struct suphp_validator *slot = &suphp_validators[key % suphp_validators_size];
+  const char *etag = apr_table_get(r->headers_out, "ETag");
+  const char *lm = apr_table_get(r->headers_out, "Last-Modified");
+  apr_time_t last_modified = lm ? apr_date_parse_http(lm) : 0;
+  apr_uint32_t seq;
+
+  if (last_modified == APR_DATE_BAD) last_modified = 0;
+  if (etag && strlen(etag) >= SUPHP_VALIDATOR_ETAG_MAX) etag = NULL;
+  if (!etag && !last_modified) return;
+
+  /* Leave the slot to a concurrent writer */
+  seq = apr_atomic_read32(&slot->seq);
+  if ((seq & 1) || apr_atomic_cas32(&slot->seq, seq + 1, seq) != seq) return;
+
+  slot->key = key;
+  slot->last_modified = last_modified;
+  memset(slot->etag, 0, sizeof(slot->etag));
+  if (etag) strcpy(slot->etag, etag);
+  apr_atomic_inc32(&slot->seq);
+}
+
+/***********************************************
+  Response cache (suPHP_ResponseCache)
+
+  Responses to anonymous GET requests that scripts mark as fresh with
+  Cache-Control are stored in files in suPHP_ResponseCacheDir, made of
+  the header lines the script sent followed by the body. A table in
+  shared memory maps the URL and the identity of the script to the
+  file and counts the bytes cached for each owner of scripts, so
+  users can only evict their own responses. Slots are updated like those
+  of the validator cache; writers never wait for a busy slot.
+ ***********************************************/
+
+#define SUPHP_RESPONSE_VARY_MAX 128
+#define SUPHP_RESPONSE_HEADERS_MAX 8192
+
+struct suphp_response {
+  volatile apr_uint32_t seq;
+  apr_uint32_t size;  /* of the file, counted against the owner's quota */
+  apr_uint64_t key;   /* of the request, 0 if the slot is free */
+  apr_uint64_t variant; /* key and Vary request headers, names the file */
+  apr_time_t stored;
+  apr_time_t expires;
+  apr_uid_t owner;
+  char vary[SUPHP_RESPONSE_VARY_MAX]; /* lower-cased, comma-separated */
+};
+
+struct suphp_response_owner {
+  volatile apr_uint32_t id; /* uid + 1, 0 if the slot is free */
+  volatile apr_uint32_t bytes;
+};
+
+/* A response being written to the cache */
+struct suphp_response_fill {
+  apr_uint64_t key;
+  apr_uint64_t variant;
+  apr_time_t expires;
+  apr_uid_t owner;
+  const char *vary;
+  char *tmp_path;
+  apr_file_t *file; /* NULL once the response is not going to be cached */
+  apr_size_t size;
+  int complete;
+};
+
+/* Header lines of a script recorded while they are parsed */
+struct suphp_header_reader {
+  apr_bucket_brigade *bb;
+  char *lines;
+  apr_size_t len;
+  int overflow;
+};
+
+/* Header lines of a cached response */
+struct suphp_header_lines {
+  const char *pos;
+  const char *end;
+};
+
+static struct suphp_response *suphp_responses = NULL;
+static struct suphp_response_owner *suphp_response_owners = NULL;
+static apr_uint32_t suphp_responses_size = 0;
+static apr_uint64_t suphp_responses_salt = 0;
+
+/* Removes the files cached by earlier runs, which the new table does
+   not know about                                                      */
+static void suphp_responses_clean(apr_pool_t *p, server_rec *s) {
+  apr_dir_t *dir;
+  apr_finfo_t finfo;
+  apr_status_t rv;
+
+  rv = apr_dir_open(&dir, suphp_responses_dir, p);
+  if (rv != APR_SUCCESS) {
+    ap_log_error(APLOG_MARK, APLOG_WARNING, rv, s,
+                 "couldn't open suPHP_ResponseCacheDir %s",
+                 suphp_responses_dir);
+    return;
+  }
+
+  while ((rv = apr_dir_read(&finfo, APR_FINFO_NAME | APR_FINFO_TYPE, dir)) ==
+             APR_SUCCESS ||
+         rv == APR_INCOMPLETE) {
+    if (finfo.filetype == APR_REG && strstr(finfo.name, ".resp")) {
+      apr_file_remove(
+          apr_pstrcat(p, suphp_responses_dir, "/", finfo.name, NULL), p);
+    }
+  }
+  apr_dir_close(dir);
+}
+
+/* Creates the table if suPHP_ResponseCache is used anywhere */
+static apr_status_t suphp_responses_init(apr_pool_t *pconf, server_rec *s) {
+  apr_size_t size = suphp_responses_conf_size *
+                    (sizeof(*suphp_responses) + sizeof(*suphp_response_owners));
+  apr_shm_t *shm;
+  apr_status_t rv;
+
+  suphp_responses = NULL;
+  suphp_response_owners = NULL;
+  suphp_responses_size = 0;
+  if (!suphp_responses_wanted || suphp_responses_conf_size == 0) {
+    return APR_SUCCESS;
+  }
+
+  if (suphp_responses_dir == NULL) {
+    ap_log_error(APLOG_MARK, APLOG_ERR, 0, s,
+                 "suPHP_ResponseCache needs suPHP_ResponseCacheDir");
+    return APR_EINVAL;
+  }
+
+  rv = apr_shm_create(&shm, size, NULL, pconf);
+  if (rv != APR_SUCCESS) {
+    ap_log_error(APLOG_MARK, APLOG_ERR, rv, s,
+                 "couldn't create shared memory for suPHP_ResponseCache");
+    return rv;
+  }
+
+  suphp_responses = apr_shm_baseaddr_get(shm);
+  memset(suphp_responses, 0, size);
+  suphp_response_owners = (struct suphp_response_owner *)(
+      suphp_responses + suphp_responses_conf_size);
+  suphp_responses_size = suphp_responses_conf_size;
+
+  /* Files of earlier generations never get the name of a new one */
+  suphp_responses_salt = apr_time_now() ^ getpid();
+  suphp_responses_clean(pconf, s);
+  return APR_SUCCESS;
+}
+
+/* Returns whether the response to the request may come from the cache
+   and be stored in it: a GET request without body, credentials or
+   cookies, which does not ask to bypass caches                        */
+static int suphp_response_cacheable(request_rec *r) {
+  const char *cc;
+
+  if (r->method_number != M_GET || r->user ||
+      apr_table_get(r->headers_in, "Authorization") ||
+      apr_table_get(r->headers_in, "Cookie") ||
+      apr_table_get(r->headers_in, "Content-Length") ||
+      apr_table_get(r->headers_in, "Transfer-Encoding")) {
+    return 0;
+  }
+  if (!(r->finfo.valid & APR_FINFO_USER)) return 0;
+
+  cc = apr_table_get(r->headers_in, "Cache-Control");
+  if (cc && (ap_strcasestr(cc, "no-cache") || ap_strcasestr(cc, "no-store"))) {
+    return 0;
+  }
+  cc = apr_table_get(r->headers_in, "Pragma");
+  if (cc && ap_strcasestr(cc, "no-cache")) return 0;
+
+  return 1;
+}
+
+/* Returns the seconds a shared cache may keep a response with the
+   Cache-Control header cc, 0 if it must not be stored                */
+static apr_int64_t suphp_response_lifetime(const char *cc) {
+  apr_int64_t max_age = 0;
+  apr_int64_t s_maxage = -1;
+
+  while (*cc) {
+    const char *name;
+    apr_size_t len;
+
+    while (*cc == ',' || apr_isspace(*cc)) cc++;
+    name = cc;
+    while (*cc && *cc != ',' && *cc != '=' && !apr_isspace(*cc)) cc++;
+    len = cc - name;
+    while (apr_isspace(*cc)) cc++;
+
+    if ((len == 8 && !strncasecmp(name, "no-store", len)) ||
+        (len == 8 && !strncasecmp(name, "no-cache", len)) ||
+        (len == 7 && !strncasecmp(name, "private", len))) {
+      return 0;
+    }
+
+    if (*cc == '=') {
+      const char *value;
+
+      cc++;
+      while (apr_isspace(*cc)) cc++;
+      if (*cc == '"') cc++;
+      value = cc;
+      if (len == 7 && !strncasecmp(name, "max-age", len)) {
+        max_age = apr_strtoi64(value, NULL, 10);
+      } else if (len == 8 && !strncasecmp(name, "s-maxage", len)) {
+        s_maxage = apr_strtoi64(value, NULL, 10);
+      }
+      /* Skip the value, which may be a quoted list */
+      if (value > name && value[-1] == '"') {
+        while (*cc && *cc != '"') cc++;
+        if (*cc) cc++;
+      }
+    }
+    while (*cc && *cc != ',') cc++;
+  }
+
+  if (s_maxage >= 0) max_age = s_maxage;
+  return max_age > 0 ? max_age : 0;
+}
+
+/* Returns the header names of the Vary header vary, lower-cased and
+   separated by commas, or NULL if the response varies on everything
+   or the names do not fit into the table                             */
+static const char *suphp_response_vary(apr_pool_t *p, const char *vary) {
+  char *names;
+  char *out;
+
+  if (vary == NULL) return "";
+  if (strchr(vary, '*') || strlen(vary) >= SUPHP_RESPONSE_VARY_MAX) {
+    return NULL;
+  }
+
+  names = out = apr_palloc(p, strlen(vary) + 1);
+  while (*vary) {
+    if (*vary == ',') {
+      if (out > names && out[-1] != ',') *out++ = ',';
+    } else if (!apr_isspace(*vary)) {
+      *out++ = apr_tolower(*vary);
+    }
+    vary++;
+  }
+  if (out > names && out[-1] == ',') out--;
+  *out = '\0';
+  return names;
+}
+
+/* Returns the key of the variant of the response selected by the
+   request headers named in vary                                   */
+static apr_uint64_t suphp_response_variant(request_rec *r, apr_uint64_t key,
+                                           const char *vary) {
+  apr_uint64_t variant = SUPHP_HASH_INIT;
+
+  variant = suphp_hash(variant, &suphp_responses_salt,
+                       sizeof(suphp_responses_salt));
+  variant = suphp_hash(variant, &key, sizeof(key));
+  while (*vary) {
+    const char *end = strchr(vary, ',');
+    const char *name;
+    const char *value;
+    char present;
+
+    if (end == NULL) end = vary + strlen(vary);
+    name = apr_pstrmemdup(r->pool, vary, end - vary);
+    value = apr_table_get(r->headers_in, name);
+    variant = suphp_hash(variant, name, end - vary + 1);
+    /* A missing header differs from an empty one */
+    present = value != NULL;
+    variant = suphp_hash(variant, &present, 1);
+    if (value) variant = suphp_hash(variant, value, strlen(value) + 1);
+    vary = *end ? end + 1 : end;
+  }
+  return variant;
+}
+
+static const char *suphp_response_path(apr_pool_t *p, apr_uint64_t variant) {
+  return apr_psprintf(p, "%s/%016" APR_UINT64_T_HEX_FMT ".resp",
+                      suphp_responses_dir, variant);
+}
+
+/* Returns the byte count of the owner uid, which is added if create is
+   set, or NULL if the owner is not known or the table is full          */
+static struct suphp_response_owner *suphp_response_owner(apr_uid_t uid,
+                                                         int create) {
+  apr_uint32_t id = (apr_uint32_t)uid + 1;
+  apr_uint32_t start = id * 2654435761U;
+  apr_uint32_t i;
+
+  for (i = 0; i < suphp_responses_size; i++) {
+    struct suphp_response_owner *owner =
+        &suphp_response_owners[(start + i) % suphp_responses_size];
+    apr_uint32_t cur = apr_atomic_read32(&owner->id);
+
+    if (cur == 0) {
+      if (!create) return NULL;
+      cur = apr_atomic_cas32(&owner->id, id, 0);
+    }
+    if (cur == 0 || cur == id) return owner;
+  }
+  return NULL;
+}
+
+/* Frees the response in slot, which the caller has locked. The file is
+   kept if unlink_file is not set, because it is about to be replaced.  */
+static void suphp_response_free(request_rec *r, struct suphp_response *slot,
+                                int unlink_file) {
+  struct suphp_response_owner *owner = suphp_response_owner(slot->owner, 0);
+
+  if (owner) apr_atomic_sub32(&owner->bytes, slot->size);
+  if (unlink_file) {
+    apr_file_remove(suphp_response_path(r->pool, slot->variant), r->pool);
+  }
+  slot->key = 0;
+}
+
+/* Frees responses of uid in other slots than skip until needed bytes
+   fit into the quota, expired ones first                             */
+static void suphp_response_reclaim(request_rec *r, apr_uid_t uid,
+                                   struct suphp_response_owner *owner,
+                                   struct suphp_response *skip,
+                                   apr_size_t needed) {
+  apr_time_t now = apr_time_now();
+  apr_uint32_t i;
+  int pass;
+
+  for (pass = 0; pass < 2; pass++) {
+    for (i = 0; i < suphp_responses_size; i++) {
+      struct suphp_response *slot = &suphp_responses[i];
+      apr_uint32_t seq;
+
+      if (apr_atomic_read32(&owner->bytes) + needed <= suphp_responses_quota) {
+        return;
+      }
+      if (slot == skip || !slot->key || slot->owner != uid ||
+          (pass == 0 && slot->expires > now)) {
+        continue;
+      }
+      seq = apr_atomic_read32(&slot->seq);
+      if ((seq & 1) || apr_atomic_cas32(&slot->seq, seq + 1, seq) != seq) {
+        continue;
+      }
+      if (slot->key && slot->owner == uid) suphp_response_free(r, slot, 1);
+      apr_atomic_inc32(&slot->seq);
+    }
+  }
+}
+
+/* Reads the next line of the header lines of a cached response */
+static int suphp_header_lines_gets(char *buf, int len, void *data) {
+  struct suphp_header_lines *lines = data;
+  const char *eol = memchr(lines->pos, '\n', lines->end - lines->pos);
+  apr_size_t n;
+
+  if (eol == NULL || eol - lines->pos + 1 > len - 1) return 0;
+  n = eol - lines->pos + 1;
+  memcpy(buf, lines->pos, n);
+  buf[n] = '\0';
+  lines->pos += n;
+  return 1;
+}
+
+/* Sends the cached response for key if there is a fresh one for the
+   request, otherwise returns DECLINED                                */
+static int suphp_response_send(request_rec *r, apr_uint64_t key) {
+  struct suphp_response *slot = &suphp_responses[key % suphp_responses_size];
+  struct suphp_response copy;
+  struct suphp_header_lines lines;
+#if MAX_STRING_LEN < 1024
+  char strbuf[1024];
+#else
+  char strbuf[MAX_STRING_LEN];
+#endif
+  apr_bucket_brigade *bb;
+  apr_file_t *file;
+  apr_finfo_t finfo;
+  apr_size_t len;
+  apr_time_t now = apr_time_now();
+  char *headers;
+  apr_uint32_t seq;
+  apr_status_t rv;
+  int ret;
+
+  seq = apr_atomic_read32(&slot->seq);
+  if (seq & 1) return DECLINED;
+  memcpy(&copy, slot, sizeof(copy));
+  if (apr_atomic_add32(&slot->seq, 0) != seq || copy.key != key ||
+      copy.expires <= now) {
+    return DECLINED;
+  }
+  copy.vary[SUPHP_RESPONSE_VARY_MAX - 1] = '\0';
+  if (suphp_response_variant(r, key, copy.vary) != copy.variant) {
+    return DECLINED;
+  }
+
+  /* The file stays readable even if the slot is reused meanwhile */
+  rv = apr_file_open(&file, suphp_response_path(r->pool, copy.variant),
+                     APR_READ | APR_BINARY | APR_SENDFILE_ENABLED,
+                     APR_OS_DEFAULT, r->pool);
+  if (rv != APR_SUCCESS) return DECLINED;
+  rv = apr_file_info_get(&finfo, APR_FINFO_SIZE, file);
+  if (rv != APR_SUCCESS) {
+    apr_file_close(file);
+    return DECLINED;
+  }
+
+  len = finfo.size < SUPHP_RESPONSE_HEADERS_MAX ? (apr_size_t)finfo.size
+                                                : SUPHP_RESPONSE_HEADERS_MAX;
+  headers = apr_palloc(r->pool, len);
+  rv = apr_file_read_full(file, headers, len, NULL);
+  if (rv != APR_SUCCESS) {
+    apr_file_close(file);
+    return DECLINED;
+  }
+
+  lines.pos = headers;
+  lines.end = headers + len;
+  ret = ap_scan_script_header_err_core(r, strbuf, suphp_header_lines_gets,
+                                       &lines);
+  if (ret != OK) {
+    apr_file_close(file);
+    return ret;
+  }
+
+  apr_table_setn(r->headers_out, "Age",
+                 apr_psprintf(r->pool, "%" APR_TIME_T_FMT,
+                              apr_time_sec(now - copy.stored)));
+  len = lines.pos - headers;
+  ap_set_content_length(r, finfo.size - len);
+
+  bb = apr_brigade_create(r->pool, r->connection->bucket_alloc);
+  apr_brigade_insert_file(bb, file, len, finfo.size - len, r->pool);
+  APR_BRIGADE_INSERT_TAIL(bb,
+                          apr_bucket_eos_create(r->connection->bucket_alloc));
+  ap_pass_brigade(r->output_filters, bb);
+
+  return OK;
+}
+
+/* Reads the next header line of the script like
+   ap_scan_script_header_err_brigade() does, and records it          */
+static int suphp_header_reader_gets(char *buf, int len, void *data) {
+  struct suphp_header_reader *reader = data;
+  apr_bucket *e = APR_BRIGADE_FIRST(reader->bb);
+  char *dst = buf;
+  char *dst_end = buf + len - 1;
+  int done = 0;
+
+  while (dst < dst_end && !done && e != APR_BRIGADE_SENTINEL(reader->bb) &&
+         !APR_BUCKET_IS_EOS(e)) {
+    const char *bucket_data;
+    const char *eol;
+    apr_size_t n;
+    apr_bucket *next;
+
+    if (apr_bucket_read(e, &bucket_data, &n, APR_BLOCK_READ) != APR_SUCCESS) {
+      break;
+    }
+    eol = memchr(bucket_data, '\n', n);
+    if (eol) n = eol - bucket_data + 1;
+    if (n > (apr_size_t)(dst_end - dst)) {
+      n = dst_end - dst;
+    } else if (eol) {
+      done = 1;
+    }
+    memcpy(dst, bucket_data, n);
+    dst += n;
+
+    if (n < e->length) apr_bucket_split(e, n);
+    next = APR_BUCKET_NEXT(e);
+    apr_bucket_delete(e);
+    e = next;
+  }
+  *dst = '\0';
+
+  if (done && !reader->overflow) {
+    if (reader->len + (dst - buf) <= SUPHP_RESPONSE_HEADERS_MAX) {
+      memcpy(reader->lines + reader->len, buf, dst - buf);
+      reader->len += dst - buf;
+    } else {
+      reader->overflow = 1;
+    }
+  }
+  return done;
+}
+
+/* Parses the header lines of the script in bb, which are recorded in
+   *lines unless they are too long to be cached, in which case *lines
+   is NULL                                                           */
+static int suphp_response_scan(request_rec *r, apr_bucket_brigade *bb,
+                               char *buffer,
+                               struct suphp_header_reader *reader) {
+  reader->bb = bb;
+  reader->lines = apr_palloc(r->pool, SUPHP_RESPONSE_HEADERS_MAX);
+  reader->len = 0;
+  reader->overflow = 0;
+  return ap_scan_script_header_err_core(r, buffer, suphp_header_reader_gets,
+                                        reader);
+}
+
+/* Returns the response of the script if it is to be cached, after its
+   header lines have been written to a temporary file, otherwise NULL */
+static struct suphp_response_fill *suphp_response_begin(
+    request_rec *r, apr_uint64_t key, struct suphp_header_reader *reader) {
+  struct suphp_response_fill *fill;
+  const char *cc;
+  const char *vary;
+  apr_int64_t lifetime;
+  apr_status_t rv;
+
+  if (r->status != HTTP_OK || r->header_only || reader->overflow ||
+      reader->len > suphp_responses_quota ||
+      apr_table_get(r->err_headers_out, "Set-Cookie") ||
+      apr_table_get(r->headers_out, "Set-Cookie")) {
+    return NULL;
+  }
+
+  /* The headers of the script end up in err_headers_out */
+  cc = apr_table_get(r->err_headers_out, "Cache-Control");
+  if (cc == NULL) cc = apr_table_get(r->headers_out, "Cache-Control");
+  lifetime = cc ? suphp_response_lifetime(cc) : 0;
+  if (lifetime <= 0) return NULL;
+
+  vary = apr_table_get(r->err_headers_out, "Vary");
+  if (vary == NULL) vary = apr_table_get(r->headers_out, "Vary");
+  vary = suphp_response_vary(r->pool, vary);
+  if (vary == NULL) return NULL;
+
+  fill = apr_pcalloc(r->pool, sizeof(*fill));
+  fill->key = key;
+  fill->variant = suphp_response_variant(r, key, vary);
+  fill->expires = apr_time_now() + apr_time_from_sec(lifetime);
+  fill->owner = r->finfo.user;
+  fill->vary = vary;
+  fill->tmp_path = apr_pstrcat(
+      r->pool, suphp_response_path(r->pool, fill->variant), ".XXXXXX", NULL);
+
+  rv = apr_file_mktemp(
+      &fill->file, fill->tmp_path,
+      APR_CREATE | APR_READ | APR_WRITE | APR_EXCL | APR_BINARY, r->pool);
+  if (rv == APR_SUCCESS) {
+    rv = apr_file_write_full(fill->file, reader->lines, reader->len, NULL);
+    if (rv != APR_SUCCESS) {
+      apr_file_close(fill->file);
+      apr_file_remove(fill->tmp_path, r->pool);
+    }
+  }
+  if (rv != APR_SUCCESS) {
+    ap_log_rerror(APLOG_MARK, APLOG_ERR, rv, r,
+                  "couldn't create cache file for %s", r->filename);
+    return NULL;
+  }
+  fill->size = reader->len;
+  return fill;
+}
+
+/* Gives up caching the response */
+static void suphp_response_abandon(request_rec *r,
+                                   struct suphp_response_fill *fill) {
+  if (fill->file) {
+    apr_file_close(fill->file);
+    apr_file_remove(fill->tmp_path, r->pool);
+    fill->file = NULL;
+  }
+}
+
+/* Passes the body of the script in bb to the output filters and copies
+   it to the cache file while it fits into the quota                    */
+static apr_status_t suphp_response_pass(request_rec *r,
+                                        apr_bucket_brigade *bb,
+                                        struct suphp_response_fill *fill) {
+  apr_bucket_brigade *out;
+  apr_status_t rv = APR_SUCCESS;
+
+  out = apr_brigade_create(r->pool, r->connection->bucket_alloc);
+  while (!APR_BRIGADE_EMPTY(bb)) {
+    apr_bucket *b = APR_BRIGADE_FIRST(bb);
+    const char *data;
+    apr_size_t len;
+
+    if (APR_BUCKET_IS_EOS(b)) {
+      fill->complete = 1;
+    } else {
+      rv = apr_bucket_read(b, &data, &len, APR_BLOCK_READ);
+      if (rv != APR_SUCCESS) break;
+      if (fill->file) {
+        fill->size += len;
+        if (fill->size > suphp_responses_quota ||
+            apr_file_write_full(fill->file, data, len, NULL) != APR_SUCCESS) {
+          suphp_response_abandon(r, fill);
+        }
+      }
+    }
+
+    APR_BUCKET_REMOVE(b);
+    APR_BRIGADE_INSERT_TAIL(out, b);
+    rv = ap_pass_brigade(r->output_filters, out);
+    apr_brigade_cleanup(out);
+    if (rv != APR_SUCCESS || fill->complete) break;
+  }
+  return rv;
+}
+
+/* Makes the completely written response the entry of its slot, unless
+   the slot is busy, holds a fresh response of another owner or the
+   owner's quota cannot take it                                       */
+static void suphp_response_commit(request_rec *r,
+                                  struct suphp_response_fill *fill) {
+  struct suphp_response *slot =
+      &suphp_responses[fill->key % suphp_responses_size];
+  struct suphp_response_owner *owner;
+  const char *path;
+  apr_uint32_t seq;
+  apr_time_t now = apr_time_now();
+
+  if (!fill->file) return;
+  if (!fill->complete) {
+    suphp_response_abandon(r, fill);
+    return;
+  }
+
+  seq = apr_atomic_read32(&slot->seq);
+  if ((seq & 1) || apr_atomic_cas32(&slot->seq, seq + 1, seq) != seq) {
+    suphp_response_abandon(r, fill);
+    return;
+  }
+
+  owner = suphp_response_owner(fill->owner, 1);
+  if (owner == NULL ||
+      (slot->key && slot->owner != fill->owner && slot->expires > now)) {
+    apr_atomic_inc32(&slot->seq);
+    suphp_response_abandon(r, fill);
+    return;
+  }
+
+  /* A file of the same name is replaced by the rename */
+  if (slot->key) {
+    suphp_response_free(r, slot, slot->variant != fill->variant);
+  }
+  suphp_response_reclaim(r, fill->owner, owner, slot, fill->size);
+  if (apr_atomic_add32(&owner->bytes, fill->size) + fill->size >
+      suphp_responses_quota) {
+    apr_atomic_sub32(&owner->bytes, fill->size);
+    apr_atomic_inc32(&slot->seq);
+    suphp_response_abandon(r, fill);
+    return;
+  }
+
+  path = suphp_response_path(r->pool, fill->variant);
+  apr_file_close(fill->file);
+  fill->file = NULL;
+  if (apr_file_rename(fill->tmp_path, path, r->pool) != APR_SUCCESS) {
+    apr_atomic_sub32(&owner->bytes, fill->size);
+    apr_file_remove(fill->tmp_path, r->pool);
+    apr_atomic_inc32(&slot->seq);
+    return;
+  }
+
+  slot->key = fill->key;
+  slot->variant = fill->variant;
+  slot->size = fill->size;
+  slot->stored = now;
+  slot->expires = fill->expires;
+  slot->owner = fill->owner;
+  memset(slot->vary, 0, sizeof(slot->vary));
+  strcpy(slot->vary, fill->vary);
+  apr_atomic_inc32(&slot->seq);
+}
+
+/***********************************************
+  Per-user process limit (suPHP_UserProcesses)
+
+  A table in shared memory counts the scripts each target user runs.
+  Requests beyond the limit wait in a queue per user, served in the
+  order of the tickets they draw. The request holding the ticket
+  being served waits for a free process and then passes the turn on.
+  Requests that give up mark their ticket, so it is skipped.
+ ***********************************************/
+
+#define SUPHP_LIMIT_USERS 1024
+
+struct suphp_limit {
+  volatile apr_uint32_t key; /* hash of the user, 0 if the slot is free */
+  volatile apr_uint32_t running;
+  volatile apr_uint32_t next_ticket;
+  volatile apr_uint32_t serving;
+  /* abandoned[t % SUPHP_LIMIT_QUEUE_MAX] == t if ticket t gave up */
+  volatile apr_uint32_t abandoned[SUPHP_LIMIT_QUEUE_MAX];
+};
+
+static struct suphp_limit *suphp_limits = NULL;
+
+/* Creates the table if suPHP_UserProcesses is set */
+static apr_status_t suphp_limits_init(apr_pool_t *pconf, server_rec *s) {
+  apr_size_t size = SUPHP_LIMIT_USERS * sizeof(*suphp_limits);
+  apr_shm_t *shm;
+  apr_status_t rv;
+  apr_uint32_t i, j;
+
+  suphp_limits = NULL;
+  if (suphp_limits_max == 0) return APR_SUCCESS;
+
+  rv = apr_shm_create(&shm, size, NULL, pconf);
+  if (rv != APR_SUCCESS) {
+    ap_log_error(APLOG_MARK, APLOG_ERR, rv, s,
+                 "couldn't create shared memory for suPHP_UserProcesses");
+    return rv;
+  }
+
+  suphp_limits = apr_shm_baseaddr_get(shm);
+  memset(suphp_limits, 0, size);
+  /* No ticket matches the initial marks */
+  for (i = 0; i < SUPHP_LIMIT_USERS; i++) {
+    for (j = 0; j < SUPHP_LIMIT_QUEUE_MAX; j++) {
+      suphp_limits[i].abandoned[j] = j + 1;
+    }
+  }
+  return APR_SUCCESS;
+}
+
+/* Returns the slot of user, or NULL if the table is full */
+static struct suphp_limit *suphp_limit_slot(const char *user) {
+  apr_uint64_t hash = suphp_hash(SUPHP_HASH_INIT, user, strlen(user));
+  apr_uint32_t key = (apr_uint32_t)(hash ^ (hash >> 32)) | 1;
+  apr_uint32_t i;
+
+  for (i = 0; i < SUPHP_LIMIT_USERS; i++) {
+    struct suphp_limit *slot =
+        &suphp_limits[(key + i) % SUPHP_LIMIT_USERS];
+    apr_uint32_t cur = apr_atomic_read32(&slot->key);
+
+    if (cur == 0) cur = apr_atomic_cas32(&slot->key, key, 0);
+    if (cur == 0 || cur == key) return slot;
+  }
+  return NULL;
+}
+
+/* Passes the turn on from ticket, skipping tickets that gave up */
+static void suphp_limit_advance(struct suphp_limit *slot,
+                                apr_uint32_t ticket) {
+  while (apr_atomic_cas32(&slot->serving, ticket + 1, ticket) == ticket) {
+    ticket++;
+    if (apr_atomic_read32(
+            &slot->abandoned[ticket % SUPHP_LIMIT_QUEUE_MAX]) != ticket) {
+      break;
+    }
+  }
+}
+
+/* Gives up ticket. If it is being served, the turn is passed on here,
+   otherwise by the request before it.                                */
+static void suphp_limit_abandon(struct suphp_limit *slot,
+                                apr_uint32_t ticket) {
+  apr_atomic_xchg32(&slot->abandoned[ticket % SUPHP_LIMIT_QUEUE_MAX],
+                    ticket);
+  suphp_limit_advance(slot, ticket);
+}
+
+static apr_status_t suphp_limit_release(void *data) {
+  struct suphp_limit *slot = data;
+
+  apr_atomic_dec32(&slot->running);
+  return APR_SUCCESS;
+}
+
+/* Waits until user may run another script, which is counted until p is
+   cleared. Returns HTTP_SERVICE_UNAVAILABLE if the queue of the user is
+   full or the request waited for suPHP_UserQueueTimeout seconds.        */
+static int suphp_limit_acquire(request_rec *r, apr_pool_t *p,
+                               const char *user) {
+  struct suphp_limit *slot = suphp_limit_slot(user);
+  apr_interval_time_t delay = 1000;
+  apr_time_t deadline;
+  apr_uint32_t serving;
+  apr_uint32_t ticket;
+  apr_uint32_t running;
+
+  if (slot == NULL) return OK;
+
+  deadline = apr_time_now() + apr_time_from_sec(suphp_limits_timeout);
+
+  /* A ticket is only drawn if the queue has room, so the tickets that
+     may be marked never share an entry of abandoned. serving is read
+     first, it only grows and never passes next_ticket.                */
+  do {
+    serving = apr_atomic_read32(&slot->serving);
+    ticket = apr_atomic_read32(&slot->next_ticket);
+    if (ticket - serving > suphp_limits_queue) {
+      ap_log_rerror(APLOG_MARK, APLOG_WARNING, 0, r,
+                    "too many requests waiting for user %s: %s", user,
+                    r->filename);
+      return HTTP_SERVICE_UNAVAILABLE;
+    }
+  } while (apr_atomic_cas32(&slot->next_ticket, ticket + 1, ticket) != ticket);
+
+  for (;;) {
+    if (apr_atomic_read32(&slot->serving) == ticket) {
+      running = apr_atomic_read32(&slot->running);
+      if (running < suphp_limits_max &&
+          apr_atomic_cas32(&slot->running, running + 1, running) == running) {
+        break;
+      }
+    }
+    if (apr_time_now() >= deadline) {
+      suphp_limit_abandon(slot, ticket);
+      ap_log_rerror(APLOG_MARK, APLOG_WARNING, 0, r,
+                    "timed out waiting for a process of user %s: %s", user,
+                    r->filename);
+      return HTTP_SERVICE_UNAVAILABLE;
+    }
+    apr_sleep(delay);
+    if (delay < 32000) delay *= 2;
+  }
+
+  suphp_limit_advance(slot, ticket);
+  apr_pool_cleanup_register(p, slot, suphp_limit_release,
+                            apr_pool_cleanup_null);
+  return OK;
+}
+
+/***********************************************
+  Resource usage (suPHP_ResourceUsage, suPHP_SlowScriptTime)
+ ***********************************************/
+
+/* Milliseconds a child gets to exit after SIGTERM before SIGKILL */
+#define SUPHP_USAGE_KILL_WAIT 3000
+
+/* Resource usage of a request, recorded when its child is reaped */
+struct suphp_usage {
+  request_rec *r;
+  suphp_conf *sconf;
+  apr_proc_t *proc;
+  apr_time_t started;
+  apr_off_t bytes_in;
+  int own;
+  int done;
+  struct suphp_usage *next;
+};
+
+#ifdef __linux__
+/* Reaps the child, which is sent SIGTERM if it is still running and
+   SIGKILL three seconds later, as apr_pool_note_subprocess() does with
+   APR_KILL_AFTER_TIMEOUT. Returns whether ru was filled in.           */
+static int suphp_usage_reap(pid_t pid, struct rusage *ru) {
+  pid_t rv;
+  int status;
+  int i;
+
+  if ((rv = wait4(pid, &status, WNOHANG, ru)) != 0) return rv == pid;
+
+  kill(pid, SIGTERM);
+  for (i = 0; i < SUPHP_USAGE_KILL_WAIT / 10; i++) {
+    apr_sleep(10000);
+    if ((rv = wait4(pid, &status, WNOHANG, ru)) != 0) return rv == pid;
+  }
+  kill(pid, SIGKILL);
+  while ((rv = wait4(pid, &status, 0, ru)) == -1 && errno == EINTR)
+    ;
+  return rv == pid;
+}
+#endif
+
+/* Reaps the child and records its resource usage in the notes of the
+   request, so it can be logged with %{suphp-...}n, and logs the script
+   if it ran for suPHP_SlowScriptTime. Children of the spawn daemon are
+   reaped by the daemon, only wall time and bytes are known for them.  */
+static void suphp_usage_record(struct suphp_usage *usage) {
+  request_rec *r = usage->r;
+  apr_time_t wall;
+  long utime = -1;
+  long stime = -1;
+  long maxrss = -1;
+#ifdef __linux__
+  struct rusage ru;
+#endif
+
+  if (usage->done) return;
+  usage->done = 1;
+
+#ifdef __linux__
+  if (usage->own && suphp_usage_reap(usage->proc->pid, &ru)) {
+    utime = ru.ru_utime.tv_sec * 1000000L + ru.ru_utime.tv_usec;
+    stime = ru.ru_stime.tv_sec * 1000000L + ru.ru_stime.tv_usec;
+    maxrss = ru.ru_maxrss;
+  }
+#endif
+  wall = apr_time_now() - usage->started;
+
+  apr_table_setn(r->notes, "suphp-wall",
+                 apr_psprintf(r->pool, "%" APR_TIME_T_FMT, wall));
+  apr_table_setn(r->notes, "suphp-bytes-in",
+                 apr_psprintf(r->pool, "%" APR_OFF_T_FMT, usage->bytes_in));
+  apr_table_setn(r->notes, "suphp-bytes-out",
+                 apr_psprintf(r->pool, "%" APR_OFF_T_FMT, r->bytes_sent));
+  if (utime != -1) {
+    apr_table_setn(r->notes, "suphp-utime",
+                   apr_psprintf(r->pool, "%ld", utime));
+    apr_table_setn(r->notes, "suphp-stime",
+                   apr_psprintf(r->pool, "%ld", stime));
+    apr_table_setn(r->notes, "suphp-maxrss",
+                   apr_psprintf(r->pool, "%ld", maxrss));
+  }
+
+  if (usage->sconf->slow_script > 0 &&
+      wall >= usage->sconf->slow_script * 1000) {
+    ap_log_rerror(APLOG_MARK, APLOG_WARNING, 0, r,
+                  "slow script %s of uid %ld: %" APR_TIME_T_FMT
+                  " ms, user %ld ms, system %ld ms, max RSS %ld KiB, "
+                  "%" APR_OFF_T_FMT " bytes in, %" APR_OFF_T_FMT
+                  " bytes out",
+                  r->filename, (long)r->finfo.user, wall / 1000,
+                  utime / 1000, stime / 1000, maxrss, usage->bytes_in,
+                  r->bytes_sent);
+  }
+}
+
+static apr_status_t suphp_usage_cleanup(void *data) {
+  suphp_usage_record(data);
+  return APR_SUCCESS;
+}
+
+/* Starts recording the resource usage of the child of r. It is recorded
+   by suphp_usage_log() once the response has been sent, or when p is
+   cleaned up for requests that are not logged.                        */
+static void suphp_usage_watch(request_rec *r, apr_pool_t *p,
+                              struct suphp_usage *usage, apr_proc_t *proc,
+                              apr_time_t started) {
+  void *data;
+
+  usage->r = r;
+  usage->sconf =
+      ap_get_module_config(r->server->module_config, &suphp_module);
+  usage->proc = proc;
+  usage->started = started;
+  apr_pool_userdata_get(&data, "suphp-usage", p);
+  usage->next = data;
+  apr_pool_userdata_setn(usage, "suphp-usage", NULL, p);
+  apr_pool_cleanup_register(p, usage, suphp_usage_cleanup,
+                            apr_pool_cleanup_null);
+}
+
+/***********************************************
+  Refusal cache (suPHP_RefusalCache)
+
+  mod_suphp passes a random token in SUPHP_REFUSAL_TOKEN, which suphp
+  removes before starting the script. When suphp refuses the script, it
+  writes the token and the reason to stderr first, so the line cannot
+  come from the script. The reason is recorded in a direct-mapped table
+  in shared memory, keyed by the script, its directory and the settings
+  passed to suphp, and further requests are refused without starting
+  suphp until either changes or the entry expires. Slots are updated
+  like those of the validator cache.
+ ***********************************************/
+
+#define SUPHP_REFUSALS 1024
+
+struct suphp_refusal {
+  volatile apr_uint32_t seq;
+  apr_uint32_t reason;
+  apr_uint64_t key;
+  apr_time_t expires;
+};
+
+static struct suphp_refusal *suphp_refusals = NULL;
+
+/* Creates the table if suPHP_RefusalCache is set */
+static apr_status_t suphp_refusals_init(apr_pool_t *pconf, server_rec *s) {
+  apr_size_t size = SUPHP_REFUSALS * sizeof(*suphp_refusals);
+  apr_shm_t *shm;
+  apr_status_t rv;
+
+  suphp_refusals = NULL;
+  if (suphp_refusals_ttl == 0) return APR_SUCCESS;
+
+  rv = apr_shm_create(&shm, size, NULL, pconf);
+  if (rv != APR_SUCCESS) {
+    ap_log_error(APLOG_MARK, APLOG_ERR, rv, s,
+                 "couldn't create shared memory for suPHP_RefusalCache");
+    return rv;
+  }
+
+  suphp_refusals = apr_shm_baseaddr_get(shm);
+  memset(suphp_refusals, 0, size);
+  return APR_SUCCESS;
+}
+
+/* Returns the key of what suphp checks for the request: the script and
+   its directory, which change when they are modified, chmod'ed or
+   chown'ed, the document root and the target user, or 0 if the script
+   or its directory cannot be identified                               */
+static apr_uint64_t suphp_refusal_key(request_rec *r, suphp_conf *sconf,
+                                      suphp_conf *dconf,
+                                      const char *ud_user) {
+  apr_int32_t wanted = APR_FINFO_IDENT | APR_FINFO_MTIME | APR_FINFO_CTIME |
+                       APR_FINFO_SIZE | APR_FINFO_OWNER | APR_FINFO_PROT;
+  const char *strings[5];
+  apr_finfo_t dir;
+  apr_uint64_t key = SUPHP_HASH_INIT;
+  int i;
+
+  if ((r->finfo.valid & wanted) != wanted ||
+      apr_stat(&dir, ap_make_dirstr_parent(r->pool, r->filename), wanted,
+               r->pool) != APR_SUCCESS) {
+    return 0;
+  }
+
+  strings[0] = r->filename;
+  strings[1] = ap_document_root(r);
+  strings[2] = dconf->target_user ? dconf->target_user : sconf->target_user;
+  strings[3] = dconf->target_group ? dconf->target_group : sconf->target_group;
+  strings[4] = ud_user;
+  for (i = 0; i < 5; i++) {
+    const char *value = strings[i] ? strings[i] : "";
+    key = suphp_hash(key, value, strlen(value) + 1);
+  }
+  key = suphp_hash(key, r->handler, strlen(r->handler) + 1);
+  key = suphp_hash(key, &r->finfo.device, sizeof(r->finfo.device));
+  key = suphp_hash(key, &r->finfo.inode, sizeof(r->finfo.inode));
+  key = suphp_hash(key, &r->finfo.mtime, sizeof(r->finfo.mtime));
+  key = suphp_hash(key, &r->finfo.ctime, sizeof(r->finfo.ctime));
+  key = suphp_hash(key, &r->finfo.size, sizeof(r->finfo.size));
+  key = suphp_hash(key, &dir.inode, sizeof(dir.inode));
+  key = suphp_hash(key, &dir.mtime, sizeof(dir.mtime));
+  key = suphp_hash(key, &dir.ctime, sizeof(dir.ctime));
+  return key ? key : 1;
+}
+
+/* Returns the reason suphp refused the script with key for, or 0 */
+static apr_uint32_t suphp_refusal_check(apr_uint64_t key) {
+  struct suphp_refusal *slot = &suphp_refusals[key % SUPHP_REFUSALS];
+  struct suphp_refusal copy;
+  apr_uint32_t seq;
+
+  seq = apr_atomic_read32(&slot->seq);
+  if (seq & 1) return 0;
+  memcpy(&copy, slot, sizeof(copy));
+  if (apr_atomic_add32(&slot->seq, 0) != seq || copy.key != key ||
+      copy.expires < apr_time_now()) {
+    return 0;
+  }
+  return copy.reason;
+}
+
+/* Passes a new token to suphp, or none if no random bytes are available */
+static void suphp_refusal_token(request_rec *r) {
+  apr_uint64_t token;
+  const char *value;
+
+  if (apr_generate_random_bytes((unsigned char *)&token, sizeof(token)) !=
+      APR_SUCCESS) {
+    return;
+  }
+  value = apr_psprintf(r->pool, "%016" APR_UINT64_T_HEX_FMT, token);
+  apr_table_setn(r->notes, "suphp-refusal-token", value);
+  apr_table_setn(r->subprocess_env, "SUPHP_REFUSAL_TOKEN", value);
+}
+
+/* Records the reason if suphp wrote that it refused the script */
+static void suphp_refusal_store(request_rec *r, apr_uint64_t key) {
+  struct suphp_refusal *slot = &suphp_refusals[key % SUPHP_REFUSALS];
+  const char *refused = apr_table_get(r->notes, "suphp-refused");
+  apr_uint32_t seq;
+  int reason;
+
+  if (refused == NULL) return;
+  reason = atoi(refused);
+  if (reason <= 0 || reason >= SUPHP_REJECTIONS) return;
+
+  seq = apr_atomic_read32(&slot->seq);
+  if ((seq & 1) || apr_atomic_cas32(&slot->seq, seq + 1, seq) != seq) return;
+
+  slot->key = key;
+  slot->reason = reason;
+  slot->expires = apr_time_now() + apr_time_from_sec(suphp_refusals_ttl);
+  apr_atomic_inc32(&slot->seq);
+
+  ap_log_rerror(APLOG_MARK, APLOG_DEBUG, 0, r,
+                "suphp refused %s (%s), refusing it for %u seconds",
+                r->filename, suphp_rejection_names[slot->reason],
+                suphp_refusals_ttl);
+}
+
+/******************
+  Hooks / handlers
+ ******************/
+
+static int suphp_pre_config(apr_pool_t *pconf, apr_pool_t *plog,
+                            apr_pool_t *ptemp) {
+  suphp_validators_wanted = 0;
+  suphp_validators_conf_size = SUPHP_VALIDATORS_DEFAULT;
+  suphp_responses_wanted = 0;
+  suphp_responses_conf_size = SUPHP_RESPONSES_DEFAULT;
+  suphp_responses_quota = SUPHP_RESPONSES_QUOTA_DEFAULT;
+  suphp_responses_dir = NULL;
+  suphp_stats_wanted = 0;
+  suphp_stages_path = NULL;
+  suphp_refusals_ttl = 0;
+  suphp_limits_max = 0;
+  suphp_limits_timeout = SUPHP_LIMIT_TIMEOUT_DEFAULT;
+  suphp_limits_queue = SUPHP_LIMIT_QUEUE_DEFAULT;
+  return OK;
+}
+
+static int suphp_post_config(apr_pool_t *pconf, apr_pool_t *plog,
+                             apr_pool_t *ptemp, server_rec *s) {
+  const char *userdata_key = "suphp_post_config";
+  void *data;
+
+  /* Like mod_cgid, only set up when the configuration is loaded for the
+     second time                                                         */
+  apr_pool_userdata_get(&data, userdata_key, s->process->pool);
+  if (!data) {
+    apr_pool_userdata_set((const void *)1, userdata_key,
+                          apr_pool_cleanup_null, s->process->pool);
+    return OK;
+  }
+
+  if (suphp_validators_init(pconf, s) != APR_SUCCESS ||
+      suphp_responses_init(pconf, s) != APR_SUCCESS ||
+      suphp_limits_init(pconf, s) != APR_SUCCESS ||
+      suphp_stats_init(pconf, s) != APR_SUCCESS ||
+      suphp_stages_init(pconf, s) != APR_SUCCESS ||
+      suphp_refusals_init(pconf, s) != APR_SUCCESS) {
+    return HTTP_INTERNAL_SERVER_ERROR;
+  }
+#ifdef __linux__
+  if (suphp_spawnd_init(pconf, s) != APR_SUCCESS) {
+    return HTTP_INTERNAL_SERVER_ERROR;
+  }
+#endif
+  return OK;
+}
+
+static int suphp_script_handler(request_rec *r);
+static int suphp_source_handler(request_rec *r);
+static int suphp_status_handler(request_rec *r);
+
+static int suphp_handler(request_rec *r) {
+  suphp_conf *sconf, *dconf;
+
+  sconf = ap_get_module_config(r->server->module_config, &suphp_module);
+  dconf = ap_get_module_config(r->per_dir_config, &suphp_module);
+
+  /* only handle request if mod_suphp is active for this handler */
+  if (suphp_handler_on(r, sconf, dconf)) {
+    return suphp_script_handler(r);
+  }
+
   if (!strcmp(r->handler, "x-httpd-php-source") ||
       !strcmp(r->handler, "application/x-httpd-php-source")) {
     return suphp_source_handler(r);
   }
 
+  if (!strcmp(r->handler, "suphp-status")) {
+    return suphp_status_handler(r);
+  }
+
   return DECLINED;
 }
 
 static int suphp_source_handler(request_rec *r) {
   suphp_conf *conf;
+  suphp_conf *dconf;
   apr_status_t rv;
   apr_pool_t *p = r->main ? r->main->pool : r->pool;
   apr_file_t *file;
   apr_proc_t *proc;
-  apr_procattr_t *procattr;
   char **argv;
   char **env;
   apr_bucket_brigade *bb;
   apr_bucket *b;
   char *phpexec;
   apr_table_t *empty_table = apr_table_make(p, 0);
+  apr_uint64_t cache_key = 0;
+  apr_finfo_t finfo;
+  char *cache_path = NULL;
+  char *tmp_path;
+  int status;
 
   if (strcmp(r->method, "GET")) {
     return DECLINED;
@@ -596,20 +3716,36 @@ static int suphp_source_handler(request_rec *r) {
     return HTTP_INTERNAL_SERVER_ERROR;
   }
 
-  /* set attributes for new process */
+  /* serve the cached output if the file has not changed */
 
-  if (((rv = apr_procattr_create(&procattr, p)) != APR_SUCCESS) ||
-      ((rv = apr_procattr_io_set(procattr, APR_CHILD_BLOCK, APR_CHILD_BLOCK,
-                                 APR_CHILD_BLOCK)) != APR_SUCCESS) ||
-      ((rv = apr_procattr_dir_set(
-            procattr, ap_make_dirstr_parent(r->pool, r->filename))) !=
-       APR_SUCCESS) ||
-      ((apr_procattr_cmdtype_set(procattr, APR_PROGRAM)) != APR_SUCCESS) ||
-      ((apr_procattr_error_check_set(procattr, 1)) != APR_SUCCESS) ||
-      ((apr_procattr_detach_set(procattr, 0)) != APR_SUCCESS)) {
-    ap_log_rerror(APLOG_MARK, APLOG_ERR, rv, r,
-                  "couldn't set child process attributes: %s", r->filename);
-    return HTTP_INTERNAL_SERVER_ERROR;
+  /* the rendered source only changes with the file, so conditional
+     requests can be answered from its identity                      */
+
+  dconf = ap_get_module_config(r->per_dir_config, &suphp_module);
+  if (conf->source_cache ||
+      dconf->conditional_cache == SUPHP_CONDITIONAL_CACHE_ON) {
+    cache_key = suphp_source_cache_key(r, phpexec, &finfo);
+  }
+  if (cache_key) {
+    apr_table_setn(r->headers_out, "ETag",
+                   apr_psprintf(r->pool, "\"%" APR_UINT64_T_HEX_FMT "\"",
+                                cache_key));
+    ap_update_mtime(r, finfo.mtime);
+    ap_set_last_modified(r);
+    if ((status = ap_meets_conditions(r)) != OK) {
+      return status;
+    }
+  }
+
+  if (cache_key && conf->source_cache) {
+    cache_path = apr_psprintf(r->pool, "%s/%016" APR_UINT64_T_HEX_FMT ".html",
+                              conf->source_cache, cache_key);
+    rv = apr_file_open(&file, cache_path,
+                       APR_READ | APR_BINARY | APR_SENDFILE_ENABLED,
+                       APR_OS_DEFAULT, r->pool);
+    if (rv == APR_SUCCESS) {
+      return suphp_source_cache_send(r, file);
+    }
   }
 
   /* create new process */
@@ -623,15 +3759,11 @@ static int suphp_source_handler(request_rec *r) {
   env = ap_create_environment(p, empty_table);
 
   proc = apr_pcalloc(p, sizeof(*proc));
-  rv = apr_proc_create(proc, phpexec, (const char *const *)argv,
-                       (const char *const *)env, procattr, p);
+  rv = suphp_spawn_child(r, p, phpexec, (const char *const *)argv,
+                         (const char *const *)env, NULL, -1, proc, NULL);
   if (rv != APR_SUCCESS) {
-    ap_log_rerror(APLOG_MARK, APLOG_ERR, rv, r,
-                  "couldn't create child process: %s for %s", phpexec,
-                  r->filename);
     return HTTP_INTERNAL_SERVER_ERROR;
   }
-  apr_pool_note_subprocess(p, proc, APR_KILL_AFTER_TIMEOUT);
 
   if (!proc->out) return APR_EBADF;
   apr_file_pipe_timeout_set(proc->out, r->server->timeout);
@@ -673,6 +3805,20 @@ static int suphp_source_handler(request_rec *r) {
   b = apr_bucket_eos_create(r->connection->bucket_alloc);
   APR_BRIGADE_INSERT_TAIL(bb, b);
 
+  /* store output in the cache and send it from there */
+
+  if (cache_path &&
+      suphp_source_cache_create(r, cache_path, &tmp_path, &file) ==
+          APR_SUCCESS) {
+    rv = suphp_source_cache_fill(r, bb, cache_path, tmp_path, file);
+    suphp_log_script_err(r, proc->err);
+    apr_file_close(proc->err);
+    if (rv != APR_SUCCESS) {
+      return HTTP_INTERNAL_SERVER_ERROR;
+    }
+    return suphp_source_cache_send(r, file);
+  }
+
   /* send output to browser (through filters) */
 
   r->content_type = "text/html";
@@ -694,10 +3840,6 @@ static int suphp_script_handler(request_rec *r) {
   suphp_conf *dconf;
   core_dir_config *core_conf;
 
-  apr_finfo_t finfo;
-
-  apr_procattr_t *procattr;
-
   apr_proc_t *proc;
 
   char **argv;
@@ -710,6 +3852,16 @@ static int suphp_script_handler(request_rec *r) {
 #endif
   char *tmpbuf;
   int nph = 0;
+  int script_fd = -1;
+  apr_uint64_t validator_key = 0;
+  apr_uint64_t response_key = 0;
+  apr_uint64_t refusal_key = 0;
+  struct suphp_header_reader headers;
+  struct suphp_response_fill *fill = NULL;
+  int status;
+  apr_time_t started;
+  apr_off_t bytes_in = 0;
+  struct suphp_usage *usage = NULL;
   int eos_reached = 0;
   int child_stopped_reading = 0;
   char *auth_user = NULL;
@@ -739,32 +3891,91 @@ static int suphp_script_handler(request_rec *r) {
        (dconf->engine == SUPHP_ENGINE_OFF)))
     return DECLINED;
 
-  /* check if file is existing and acessible */
+  if (suphp_stats) suphp_stats_add(&suphp_stats->requests, 1);
 
-  rv = apr_stat(&finfo, apr_pstrdup(p, r->filename), APR_FINFO_NORM, p);
+  /* check if file is existing and acessible, the core has stat()ed it
+     already when mapping the URI to it                               */
+
+#ifdef SUPHP_HAVE_SCRIPT_FD
+  if (sconf->script_fd == SUPHP_SCRIPT_FD_ON) {
+    /* O_PATH only needs search permission on the parent directories */
+    script_fd = open(r->filename, O_PATH | O_CLOEXEC);
+    rv = (script_fd == -1) ? APR_FROM_OS_ERROR(errno) : APR_SUCCESS;
+  } else
+#endif
+  if (r->finfo.filetype != APR_NOFILE)
+    rv = APR_SUCCESS;
+  else
+    rv = apr_stat(&r->finfo, r->filename, APR_FINFO_NORM, r->pool);
 
   if (rv == APR_SUCCESS)
     ; /* do nothing */
   else if (rv == EACCES) {
-    return HTTP_FORBIDDEN;
     ap_log_rerror(APLOG_MARK, APLOG_ERR, rv, r, "access to %s denied",
                   r->filename);
+    suphp_stats_error(SUPHP_ERROR_FORBIDDEN);
+    return HTTP_FORBIDDEN;
   } else if (rv == ENOENT) {
     ap_log_rerror(APLOG_MARK, APLOG_ERR, 0, r, "File does not exist: %s",
                   r->filename);
+    suphp_stats_error(SUPHP_ERROR_NOT_FOUND);
     return HTTP_NOT_FOUND;
   } else {
     ap_log_rerror(APLOG_MARK, APLOG_ERR, rv, r, "could not get fileinfo: %s",
                   r->filename);
+    suphp_stats_error(SUPHP_ERROR_NOT_FOUND);
     return HTTP_NOT_FOUND;
   }
 
   if (!(r->finfo.protection & APR_UREAD)) {
     ap_log_rerror(APLOG_MARK, APLOG_ERR, 0, r, "Insufficient permissions: %s",
                   r->filename);
+    if (script_fd != -1) close(script_fd);
+    suphp_stats_error(SUPHP_ERROR_FORBIDDEN);
     return HTTP_FORBIDDEN;
   }
 
+  /* refuse scripts the configuration of suphp does not allow to run */
+
+  if (suphp_stages) {
+    int reason = suphp_stage_policy_check(r);
+
+    if (reason != 0) {
+      ap_log_rerror(APLOG_MARK, APLOG_ERR, 0, r,
+                    "script %s refused by the suphp configuration (%s)",
+                    r->filename, suphp_rejection_names[reason]);
+      if (script_fd != -1) close(script_fd);
+      suphp_stats_error(SUPHP_ERROR_REFUSED);
+      return HTTP_INTERNAL_SERVER_ERROR;
+    }
+  }
+
+  /* answer conditional requests for unchanged scripts directly */
+
+  if (dconf->conditional_cache == SUPHP_CONDITIONAL_CACHE_ON &&
+      suphp_validators && r->method_number == M_GET) {
+    validator_key = suphp_request_key(r);
+  }
+  if (validator_key &&
+      (apr_table_get(r->headers_in, "If-None-Match") ||
+       apr_table_get(r->headers_in, "If-Modified-Since")) &&
+      suphp_validator_check(r, validator_key)) {
+    if (script_fd != -1) close(script_fd);
+    return HTTP_NOT_MODIFIED;
+  }
+
+  /* serve fresh responses to anonymous requests from the cache */
+
+  if (dconf->response_cache == SUPHP_RESPONSE_CACHE_ON && suphp_responses &&
+      suphp_response_cacheable(r)) {
+    response_key = suphp_request_key(r);
+  }
+  if (response_key &&
+      (status = suphp_response_send(r, response_key)) != DECLINED) {
+    if (script_fd != -1) close(script_fd);
+    return status;
+  }
+
   /* Check for userdir request */
   userdir_id = ap_run_get_suexec_identity(r);
   if (userdir_id != NULL && userdir_id->userdir) {
@@ -791,6 +4002,13 @@ static int suphp_script_handler(request_rec *r) {
   apr_table_unset(r->subprocess_env, "SUPHP_GROUP");
   apr_table_unset(r->subprocess_env, "SUPHP_USERDIR_USER");
   apr_table_unset(r->subprocess_env, "SUPHP_USERDIR_GROUP");
+  apr_table_unset(r->subprocess_env, "SUPHP_SCRIPT_FD");
+  apr_table_unset(r->subprocess_env, "SUPHP_REFUSAL_TOKEN");
+
+  if (script_fd != -1) {
+    apr_table_setn(r->subprocess_env, "SUPHP_SCRIPT_FD",
+                   apr_itoa(r->pool, SUPHP_SCRIPT_FD));
+  }
 
   if (dconf->php_config) {
     apr_table_setn(r->subprocess_env, "SUPHP_PHP_CONFIG",
@@ -799,6 +4017,47 @@ static int suphp_script_handler(request_rec *r) {
 
   apr_table_setn(r->subprocess_env, "SUPHP_HANDLER", r->handler);
 
+  /* refuse scripts suphp refused before without starting it */
+
+  if (suphp_refusals) {
+    apr_uint32_t reason;
+
+    refusal_key =
+        suphp_refusal_key(r, sconf, dconf, ud_success ? ud_user : NULL);
+    if (refusal_key && (reason = suphp_refusal_check(refusal_key)) != 0) {
+      ap_log_rerror(APLOG_MARK, APLOG_ERR, 0, r,
+                    "script %s refused by suphp before (%s)", r->filename,
+                    suphp_rejection_names[reason]);
+      if (script_fd != -1) close(script_fd);
+      suphp_stats_error(SUPHP_ERROR_REFUSED);
+      return HTTP_INTERNAL_SERVER_ERROR;
+    }
+    if (refusal_key) suphp_refusal_token(r);
+  }
+
+  /* limit and count the scripts running as the target user */
+
+  if (suphp_limits || suphp_stats) {
+    const char *user;
+
+    if (dconf->target_user)
+      user = dconf->target_user;
+    else if (sconf->target_user)
+      user = sconf->target_user;
+    else if (ud_success)
+      user = ud_user;
+    else
+      user = apr_psprintf(r->pool, "#%ld", (long)r->finfo.user);
+
+    if (suphp_limits && (status = suphp_limit_acquire(r, p, user)) != OK) {
+      if (script_fd != -1) close(script_fd);
+      apr_table_setn(r->err_headers_out, "Retry-After", "1");
+      suphp_stats_error(SUPHP_ERROR_BUSY);
+      return status;
+    }
+    if (suphp_stats) suphp_stats_start(p, user);
+  }
+
   if (r->headers_in) {
     const char *auth = NULL;
     auth = apr_table_get(r->headers_in, "Authorization");
@@ -847,49 +4106,24 @@ static int suphp_script_handler(request_rec *r) {
 
   env = ap_create_environment(p, r->subprocess_env);
 
-  /* set attributes for new process */
-
-  if (((rv = apr_procattr_create(&procattr, p)) != APR_SUCCESS) ||
-      ((rv = apr_procattr_io_set(procattr, APR_CHILD_BLOCK, APR_CHILD_BLOCK,
-                                 APR_CHILD_BLOCK)) != APR_SUCCESS) ||
-      ((rv = apr_procattr_dir_set(
-            procattr, ap_make_dirstr_parent(r->pool, r->filename))) !=
-       APR_SUCCESS)
-/* set resource limits */
-
-#ifdef RLIMIT_CPU
-      || ((rv = apr_procattr_limit_set(procattr, APR_LIMIT_CPU,
-                                       core_conf->limit_cpu)) != APR_SUCCESS)
-#endif
-#if defined(RLIMIT_DATA) || defined(RLIMIT_VMEM) || defined(RLIMIT_AS)
-      || ((rv = apr_procattr_limit_set(procattr, APR_LIMIT_MEM,
-                                       core_conf->limit_mem)) != APR_SUCCESS)
-#endif
-#ifdef RLIMIT_NPROC
-      || ((apr_procattr_limit_set(procattr, APR_LIMIT_NPROC,
-                                  core_conf->limit_nproc)) != APR_SUCCESS)
-#endif
-
-      || ((apr_procattr_cmdtype_set(procattr, APR_PROGRAM)) != APR_SUCCESS) ||
-      ((apr_procattr_error_check_set(procattr, 1)) != APR_SUCCESS) ||
-      ((apr_procattr_detach_set(procattr, 0)) != APR_SUCCESS)) {
-    ap_log_rerror(APLOG_MARK, APLOG_ERR, rv, r,
-                  "couldn't set child process attributes: %s", r->filename);
-    return HTTP_INTERNAL_SERVER_ERROR;
-  }
-
   /* create new process */
 
   proc = apr_pcalloc(p, sizeof(*proc));
-  rv = apr_proc_create(proc, SUPHP_PATH_TO_SUPHP, (const char *const *)argv,
-                       (const char *const *)env, procattr, p);
+  started = apr_time_now();
+  if (sconf->resource_usage == SUPHP_RESOURCE_USAGE_ON ||
+      sconf->slow_script > 0) {
+    usage = apr_pcalloc(p, sizeof(*usage));
+  }
+  rv = suphp_spawn_child(r, p, SUPHP_PATH_TO_SUPHP, (const char *const *)argv,
+                         (const char *const *)env, core_conf, script_fd, proc,
+                         usage ? &usage->own : NULL);
+  if (script_fd != -1) {
+    close(script_fd);
+  }
   if (rv != APR_SUCCESS) {
-    ap_log_rerror(APLOG_MARK, APLOG_ERR, rv, r,
-                  "couldn't create child process: %s for %s",
-                  SUPHP_PATH_TO_SUPHP, r->filename);
     return HTTP_INTERNAL_SERVER_ERROR;
   }
-  apr_pool_note_subprocess(p, proc, APR_KILL_AFTER_TIMEOUT);
+  if (usage) suphp_usage_watch(r, p, usage, proc, started);
 
   if (!proc->out) return APR_EBADF;
   apr_file_pipe_timeout_set(proc->out, r->server->timeout);
@@ -931,6 +4165,8 @@ static int suphp_script_handler(request_rec *r) {
       rv = apr_file_write_full(proc->in, data, len, NULL);
       if (rv != APR_SUCCESS) {
         child_stopped_reading = 1;
+      } else {
+        bytes_in += len;
       }
     }
     apr_brigade_cleanup(bb);
@@ -938,6 +4174,7 @@ static int suphp_script_handler(request_rec *r) {
 
   apr_file_flush(proc->in);
   apr_file_close(proc->in);
+  if (usage) usage->bytes_in = bytes_in;
 
 /* get output from script and check if non-parsed headers are used */
 
@@ -966,13 +4203,22 @@ static int suphp_script_handler(request_rec *r) {
     int ret;
     const char *location;
 
-    ret = ap_scan_script_header_err_brigade(r, bb, strbuf);
+    if (response_key)
+      ret = suphp_response_scan(r, bb, strbuf, &headers);
+    else
+      ret = ap_scan_script_header_err_brigade(r, bb, strbuf);
+    if (validator_key &&
+        ((ret == OK && r->status == HTTP_OK) || ret == HTTP_NOT_MODIFIED)) {
+      suphp_validator_store(r, validator_key);
+    }
     if (ret == HTTP_NOT_MODIFIED) {
       return ret;
     } else if (ret != APR_SUCCESS) {
       suphp_discard_output(bb);
       apr_brigade_destroy(bb);
       suphp_log_script_err(r, proc->err);
+      suphp_stats_error(SUPHP_ERROR_HEADERS);
+      if (refusal_key) suphp_refusal_store(r, refusal_key);
 
       /* ap_scan_script_header_err_brigade does logging itself,
          so simply return                                       */
@@ -1001,9 +4247,16 @@ static int suphp_script_handler(request_rec *r) {
       return HTTP_MOVED_TEMPORARILY;
     }
 
-    /* send output to browser (through filters) */
+    /* send output to browser (through filters), keeping a copy in the
+       cache if the script allows it                                    */
 
-    rv = ap_pass_brigade(r->output_filters, bb);
+    if (response_key) fill = suphp_response_begin(r, response_key, &headers);
+    if (fill) {
+      rv = suphp_response_pass(r, bb, fill);
+      suphp_response_commit(r, fill);
+    } else {
+      rv = ap_pass_brigade(r->output_filters, bb);
+    }
 
     /* write errors to logfile */
 
@@ -1037,11 +4290,211 @@ static int suphp_script_handler(request_rec *r) {
     apr_file_close(proc->err);
   }
 
+  if (suphp_stats) {
+    suphp_stats_add(&suphp_stats->bytes_in, bytes_in);
+    suphp_stats_add(&suphp_stats->bytes_out, r->bytes_sent);
+  }
+
+  return OK;
+}
+
+/* Shows the counters of suPHP_Statistics */
+static void suphp_status_counters(request_rec *r, int plain) {
+  struct suphp_stats *stats = suphp_stats;
+  apr_time_t uptime;
+  apr_uint64_t spawns;
+  int i;
+
+  uptime = apr_time_sec(apr_time_now() - stats->started);
+  if (uptime < 1) uptime = 1;
+  spawns = stats->spawns;
+
+  if (plain) {
+    ap_rprintf(r, "Uptime: %" APR_TIME_T_FMT "\n", uptime);
+    ap_rprintf(r, "Requests: %" APR_UINT64_T_FMT "\n", stats->requests);
+    ap_rprintf(r, "Spawns: %" APR_UINT64_T_FMT "\n", spawns);
+    ap_rprintf(r, "SpawnsPerSec: %.3f\n", (double)spawns / uptime);
+    ap_rprintf(r, "SpawnTimeAvg: %" APR_UINT64_T_FMT "\n",
+               spawns ? stats->spawn_usec / spawns : 0);
+    for (i = 0; i < SUPHP_STATS_BUCKETS; i++) {
+      if (stats->spawn_latency[i] == 0) continue;
+      ap_rprintf(r, "SpawnTime.%lu: %" APR_UINT64_T_FMT "\n", 2UL << i,
+                 stats->spawn_latency[i]);
+    }
+    ap_rprintf(r, "Active: %u\n", apr_atomic_read32(&stats->active));
+    ap_rprintf(r, "BytesIn: %" APR_UINT64_T_FMT "\n", stats->bytes_in);
+    ap_rprintf(r, "BytesOut: %" APR_UINT64_T_FMT "\n", stats->bytes_out);
+    for (i = 0; i < SUPHP_ERRORS; i++) {
+      ap_rprintf(r, "Errors.%s: %" APR_UINT64_T_FMT "\n",
+                 suphp_error_names[i], stats->errors[i]);
+    }
+    for (i = 0; i < SUPHP_STATS_USERS; i++) {
+      struct suphp_stats_user *user = &stats->users[i];
+      char name[SUPHP_STATS_NAME_MAX];
+
+      if (apr_atomic_read32(&user->key) == 0) continue;
+      apr_cpystrn(name, user->name, sizeof(name));
+      ap_rprintf(r, "User.%s.Active: %u\n", name,
+                 apr_atomic_read32(&user->active));
+      ap_rprintf(r, "User.%s.Scripts: %" APR_UINT64_T_FMT "\n", name,
+                 user->scripts);
+    }
+    return;
+  }
+
+  ap_rputs("<table>\n", r);
+  ap_rprintf(r, "<tr><th align=\"left\">Uptime</th>"
+             "<td>%" APR_TIME_T_FMT " seconds</td></tr>\n", uptime);
+  ap_rprintf(r, "<tr><th align=\"left\">Requests</th>"
+             "<td>%" APR_UINT64_T_FMT "</td></tr>\n", stats->requests);
+  ap_rprintf(r, "<tr><th align=\"left\">Spawns</th>"
+             "<td>%" APR_UINT64_T_FMT " (%.3f/s, %" APR_UINT64_T_FMT
+             " us on average)</td></tr>\n", spawns,
+             (double)spawns / uptime, spawns ? stats->spawn_usec / spawns : 0);
+  ap_rprintf(r, "<tr><th align=\"left\">Active scripts</th>"
+             "<td>%u</td></tr>\n", apr_atomic_read32(&stats->active));
+  ap_rprintf(r, "<tr><th align=\"left\">Bytes in / out</th>"
+             "<td>%" APR_UINT64_T_FMT " / %" APR_UINT64_T_FMT
+             "</td></tr>\n", stats->bytes_in, stats->bytes_out);
+  for (i = 0; i < SUPHP_ERRORS; i++) {
+    ap_rprintf(r, "<tr><th align=\"left\">Errors (%s)</th>"
+               "<td>%" APR_UINT64_T_FMT "</td></tr>\n",
+               suphp_error_names[i], stats->errors[i]);
+  }
+
+  ap_rputs("</table>\n<h2>Spawn time</h2>\n<table>\n"
+           "<tr><th>Below</th><th>Spawns</th></tr>\n", r);
+  for (i = 0; i < SUPHP_STATS_BUCKETS; i++) {
+    if (stats->spawn_latency[i] == 0) continue;
+    ap_rprintf(r, "<tr><td>%lu us</td><td>%" APR_UINT64_T_FMT
+               "</td></tr>\n", 2UL << i, stats->spawn_latency[i]);
+  }
+
+  ap_rputs("</table>\n<h2>Users</h2>\n<table>\n"
+           "<tr><th>User</th><th>Active</th><th>Scripts</th></tr>\n", r);
+  for (i = 0; i < SUPHP_STATS_USERS; i++) {
+    struct suphp_stats_user *user = &stats->users[i];
+    char name[SUPHP_STATS_NAME_MAX];
+
+    if (apr_atomic_read32(&user->key) == 0) continue;
+    apr_cpystrn(name, user->name, sizeof(name));
+    ap_rprintf(r, "<tr><td>%s</td><td>%u</td><td>%" APR_UINT64_T_FMT
+               "</td></tr>\n", ap_escape_html(r->pool, name),
+               apr_atomic_read32(&user->active), user->scripts);
+  }
+  ap_rputs("</table>\n", r);
+}
+
+/* Shows count, average and percentiles of the histograms of
+   suPHP_StageStatistics, in microseconds                    */
+static void suphp_status_stages(request_rec *r, int plain) {
+  static const int permille[] = {500, 900, 990, 999};
+  static const char *const labels[] = {"P50", "P90", "P99", "P999"};
+  int i, j;
+
+  if (!plain) {
+    ap_rputs("<h2>Time taken by suphp (us)</h2>\n<table>\n<tr><th>Stage"
+             "</th><th>Count</th><th>Average</th><th>50%</th><th>90%</th>"
+             "<th>99%</th><th>99.9%</th><th>Max</th></tr>\n", r);
+  }
+  for (i = 0; i < SUPHP_STAGES; i++) {
+    const struct suphp_stage_histogram *histogram =
+        &suphp_stages->histograms[i];
+    apr_uint64_t count = histogram->count;
+    apr_uint64_t average = count ? histogram->sum / count : 0;
+
+    if (plain) {
+      ap_rprintf(r, "Stage.%s.Count: %" APR_UINT64_T_FMT "\n",
+                 suphp_stage_names[i], count);
+      ap_rprintf(r, "Stage.%s.Avg: %" APR_UINT64_T_FMT "\n",
+                 suphp_stage_names[i], average);
+    } else {
+      ap_rprintf(r, "<tr><th align=\"left\">%s</th><td>%" APR_UINT64_T_FMT
+                 "</td><td>%" APR_UINT64_T_FMT "</td>",
+                 suphp_stage_names[i], count, average);
+    }
+    for (j = 0; j < 4; j++) {
+      apr_uint64_t value =
+          count ? suphp_stage_percentile(histogram, count, permille[j]) : 0;
+      if (plain) {
+        ap_rprintf(r, "Stage.%s.%s: %" APR_UINT64_T_FMT "\n",
+                   suphp_stage_names[i], labels[j], value);
+      } else {
+        ap_rprintf(r, "<td>%" APR_UINT64_T_FMT "</td>", value);
+      }
+    }
+    if (plain) {
+      ap_rprintf(r, "Stage.%s.Max: %" APR_UINT64_T_FMT "\n",
+                 suphp_stage_names[i], histogram->max);
+    } else {
+      ap_rprintf(r, "<td>%" APR_UINT64_T_FMT "</td></tr>\n", histogram->max);
+    }
+  }
+
+  if (!plain) {
+    ap_rputs("</table>\n<h2>Scripts refused by suphp</h2>\n<table>\n"
+             "<tr><th>Reason</th><th>Count</th></tr>\n", r);
+  }
+  for (i = 1; i < SUPHP_REJECTIONS; i++) {
+    if (plain) {
+      ap_rprintf(r, "Rejections.%s: %" APR_UINT64_T_FMT "\n",
+                 suphp_rejection_names[i], suphp_stages->rejections[i]);
+    } else {
+      ap_rprintf(r, "<tr><td>%s</td><td>%" APR_UINT64_T_FMT "</td></tr>\n",
+                 suphp_rejection_names[i], suphp_stages->rejections[i]);
+    }
+  }
+  if (!plain) ap_rputs("</table>\n", r);
+}
+
+static int suphp_status_handler(request_rec *r) {
+  int plain = r->args && !strcasecmp(r->args, "auto");
+
+  if (r->method_number != M_GET) return DECLINED;
+
+  if (suphp_stats == NULL && suphp_stages == NULL) {
+    ap_log_rerror(APLOG_MARK, APLOG_ERR, 0, r,
+                  "suphp-status needs suPHP_Statistics or "
+                  "suPHP_StageStatistics");
+    return HTTP_NOT_FOUND;
+  }
+
+  ap_set_content_type(r, plain ? "text/plain; charset=ISO-8859-1"
+                               : "text/html; charset=ISO-8859-1");
+  apr_table_setn(r->headers_out, "Cache-Control", "no-cache");
+  if (r->header_only) return OK;
+
+  if (!plain) {
+    ap_rputs(DOCTYPE_HTML_3_2 "<html><head>\n"
+             "<title>suPHP Status</title>\n</head><body>\n"
+             "<h1>suPHP Status</h1>\n", r);
+  }
+  if (suphp_stats) suphp_status_counters(r, plain);
+  if (suphp_stages) suphp_status_stages(r, plain);
+  if (!plain) ap_rputs("</body></html>\n", r);
+
   return OK;
 }
 
+/* Reaps the children of the request after the response has been sent,
+   so their resource usage is in the notes when mod_log_config runs */
+static int suphp_usage_log(request_rec *r) {
+  struct suphp_usage *usage;
+  void *data;
+
+  apr_pool_userdata_get(&data, "suphp-usage", r->pool);
+  for (usage = data; usage != NULL; usage = usage->next) {
+    suphp_usage_record(usage);
+  }
+  return DECLINED;
+}
+
 static void suphp_register_hooks(apr_pool_t *p) {
+  ap_hook_pre_config(suphp_pre_config, NULL, NULL, APR_HOOK_MIDDLE);
+  ap_hook_post_config(suphp_post_config, NULL, NULL, APR_HOOK_MIDDLE);
   ap_hook_handler(suphp_handler, NULL, NULL, APR_HOOK_MIDDLE);
+  ap_hook_log_transaction(suphp_usage_log, NULL, NULL,
+                          APR_HOOK_REALLY_FIRST);
 }
 
 /********************
@@ -0,0 +1,273 @@
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <fstream>
+#include <set>
+#include <sstream>
+#include <string>
+#include "gtest/gtest.h"
+
+#include "Configuration.hpp"
+#include "ParsingException.hpp"
+#include "SecurityException.hpp"
+#include "TemporaryFileTest.hpp"
+#include "UserInfo.hpp"
+
+namespace {
+
+class ConfigurationTest : public suPHP::TemporaryFileTest {
+ protected:
+  ConfigurationTest() : TemporaryFileTest("configuration") {}
+
+  void write(const std::string& content) {
+    std::ofstream out(path.c_str(), std::ios::trunc);
+    out << content;
+  }
+};
+
+TEST_F(ConfigurationTest, ReadsOptions) {
+  write(
+      "[global]\n"
+      "logfile=/tmp/suphp.log\n"
+      "loglevel=warn\n"
+      "docroot=/var/www:/srv\n"
+      "allow_file_group_writeable=yes\n"
+      "mode=owner\n"
+      "umask=0022\n"
+      "min_uid=100\n"
+      "script_descriptor=true\n"
+      "cgroup_parent=/sys/fs/cgroup/suphp\n"
+      "cgroup_memory_max=512M\n"
+      "cgroup_pids_max=64\n"
+      "stage_statistics=/run/apache2/suphp-stages\n"
+      "script_index=/var/lib/suphp/scripts.idx\n"
+      "script_index_state=/run/suphp/watch\n"
+      "[handlers]\n"
+      "x-httpd-php=\"php:/usr/bin/php-cgi\"\n");
+  suPHP::File file(path);
+  suPHP::Configuration config;
+  config.readFromFile(file);
+  ASSERT_EQ("/tmp/suphp.log", config.getLogfile());
+  ASSERT_EQ(suPHP::LOGLEVEL_WARN, config.getLogLevel());
+  ASSERT_EQ(2u, config.getDocroots().size());
+  ASSERT_EQ("/srv", config.getDocroots()[1]);
+  ASSERT_TRUE(config.getAllowFileGroupWriteable());
+  ASSERT_FALSE(config.getAllowFileOthersWriteable());
+  ASSERT_EQ(suPHP::OWNER_MODE, config.getMode());
+  ASSERT_EQ(022, config.getUmask());
+  ASSERT_EQ(100, config.getMinUid());
+  ASSERT_TRUE(config.getScriptDescriptor());
+  ASSERT_EQ("/sys/fs/cgroup/suphp", config.getCgroupParent());
+  ASSERT_EQ(0, config.getCgroupCpuWeight());
+  ASSERT_EQ("512M", config.getCgroupMemoryMax());
+  ASSERT_EQ(64, config.getCgroupPidsMax());
+  ASSERT_EQ("/run/apache2/suphp-stages", config.getStageStatistics());
+  ASSERT_EQ("/var/lib/suphp/scripts.idx", config.getScriptIndex());
+  ASSERT_EQ("/run/suphp/watch", config.getScriptIndexState());
+  ASSERT_EQ("php:/usr/bin/php-cgi", config.getInterpreter("x-httpd-php"));
+}
+
+TEST_F(ConfigurationTest, FindsDocrootDirectories) {
+  write(
+      "[global]\n"
+      "docroot=/srv/www:/home/*/public_html:/srv:/var/www/${USERNAME}\n");
+  suPHP::File file(path);
+  suPHP::Configuration config;
+  config.readFromFile(file);
+  std::vector<suPHP::File> directories = config.getDocrootDirectories();
+  ASSERT_EQ(3u, directories.size());
+  ASSERT_EQ("/home", directories[0].getPath());
+  ASSERT_EQ("/srv", directories[1].getPath());
+  ASSERT_EQ("/var/www", directories[2].getPath());
+}
+
+TEST_F(ConfigurationTest, RejectsInvalidOptions) {
+  suPHP::File file(path);
+  suPHP::Configuration config;
+  write("[global]\nno_such_option=1\n");
+  EXPECT_THROW(config.readFromFile(file), suPHP::ParsingException);
+  write("[global]\ncheck_vhost_docroot=maybe\n");
+  EXPECT_THROW(config.readFromFile(file), suPHP::ParsingException);
+  write("[global]\nloglevel=debug\n");
+  EXPECT_THROW(config.readFromFile(file), suPHP::ParsingException);
+}
+
+TEST_F(ConfigurationTest, DumpRoundTrip) {
+  write(
+      "[global]\n"
+      "env_path=\"/usr/local/bin:/usr/bin \"\n"
+      "paranoid_gid_check=off\n"
+      "chroot=/jail\n"
+      "[phprc_paths]\n"
+      "x-httpd-php=/etc/php\n");
+  suPHP::File file(path);
+  suPHP::Configuration config;
+  config.readFromFile(file);
+  std::ostringstream first;
+  config.dump(first);
+  ASSERT_NE(std::string::npos, first.str().find("chroot=/jail\n"));
+  ASSERT_EQ(std::string::npos, first.str().find("overrides_dir="));
+
+  write(first.str());
+  suPHP::Configuration reread;
+  reread.readFromFile(file);
+  ASSERT_EQ("/usr/local/bin:/usr/bin ", reread.getEnvPath());
+  ASSERT_FALSE(reread.getParanoidGIDCheck());
+  ASSERT_EQ("/etc/php", reread.getPHPRCPath("x-httpd-php"));
+  std::ostringstream second;
+  reread.dump(second);
+  // Only the generation comment differs
+  ASSERT_EQ(first.str().substr(first.str().find('\n')),
+            second.str().substr(second.str().find('\n')));
+}
+
+class OverridesTest : public ConfigurationTest {
+ protected:
+  OverridesTest() : directory("/tmp/suphp-overrides-test.XXXXXX"), names() {
+    mkdtemp(&directory[0]);
+    index = directory + "/overrides.idx";
+    write("[global]\n"
+          "umask=0022\n"
+          "overrides_dir=" + directory + "\n"
+          "overrides_index=" + index + "\n");
+  }
+
+  ~OverridesTest() {
+    for (std::set<std::string>::const_iterator i = names.begin();
+         i != names.end(); i++) {
+      unlink((directory + "/" + *i).c_str());
+    }
+    unlink(index.c_str());
+    rmdir(directory.c_str());
+  }
+
+  void writeOverride(const std::string& name, const std::string& content) {
+    std::ofstream out((directory + "/" + name).c_str(), std::ios::trunc);
+    out << content;
+    names.insert(name);
+  }
+
+  // Reads the configuration and applies the overrides for uid and docroot
+  void apply(suPHP::Configuration& config, int uid,
+             const std::string& docroot) {
+    suPHP::File file(path);
+    config.readFromFile(file);
+    config.applyOverrides(suPHP::UserInfo(uid), docroot);
+  }
+
+  std::string directory;
+  std::string index;
+  std::set<std::string> names;
+};
+
+TEST_F(OverridesTest, AppliesMatchingOverrides) {
+  writeOverride("user.conf",
+                "[match]\n"
+                "uid=1000\n"
+                "[global]\n"
+                "umask=0077\n"
+                "env_path=/home/user/bin\n"
+                "[phprc_paths]\n"
+                "x-httpd-php=/home/user/php\n");
+  writeOverride("site.conf",
+                "[match]\n"
+                "docroot=/srv/www/site/\n"
+                "[global]\n"
+                "umask=0027\n");
+  writeOverride("ignored.txt", "[global]\nmin_uid=0\n");
+  suPHP::File file(path);
+  suPHP::Configuration config;
+  config.readFromFile(file);
+  ASSERT_EQ(2, config.compileOverrides());
+
+  // The index is only used if it is owned by root
+  if (geteuid() != 0) {
+    EXPECT_THROW(apply(config, 1000, "/srv/www/site"),
+                 suPHP::SecurityException);
+    return;
+  }
+
+  suPHP::Configuration user;
+  apply(user, 1000, "/srv/www/other");
+  ASSERT_EQ(077, user.getUmask());
+  ASSERT_EQ("/home/user/bin", user.getEnvPath());
+  ASSERT_EQ("/home/user/php", user.getPHPRCPath("x-httpd-php"));
+
+  // Settings for the docroot take precedence over those for the user
+  suPHP::Configuration both;
+  apply(both, 1000, "/srv/www/site");
+  ASSERT_EQ(027, both.getUmask());
+  ASSERT_EQ("/home/user/bin", both.getEnvPath());
+
+  suPHP::Configuration site;
+  apply(site, 1001, "/srv/www/site");
+  ASSERT_EQ(027, site.getUmask());
+  ASSERT_NE("/home/user/bin", site.getEnvPath());
+
+  suPHP::Configuration none;
+  apply(none, 1001, "");
+  ASSERT_EQ(022, none.getUmask());
+}
+
+TEST_F(OverridesTest, RejectsOptionsThatAreNotOverridable) {
+  writeOverride("user.conf",
+                "[match]\n"
+                "uid=1000\n"
+                "[global]\n"
+                "min_uid=0\n");
+  suPHP::File file(path);
+  suPHP::Configuration config;
+  config.readFromFile(file);
+  EXPECT_THROW(config.compileOverrides(), suPHP::ParsingException);
+  ASSERT_FALSE(suPHP::File(index).exists());
+
+  writeOverride("user.conf",
+                "[match]\n"
+                "uid=1000\n"
+                "[global]\n"
+                "umask=0077\n");
+  writeOverride("other.conf",
+                "[match]\n"
+                "uid=1000\n");
+  EXPECT_THROW(config.compileOverrides(), suPHP::ParsingException);
+}
+
+TEST_F(OverridesTest, UsesIndexUntilRecompiled) {
+  // Without an index the global settings apply
+  suPHP::Configuration missing;
+  apply(missing, 1000, "/srv/www/site");
+  ASSERT_EQ(022, missing.getUmask());
+
+  if (geteuid() != 0) return;
+
+  writeOverride("user.conf",
+                "[match]\n"
+                "uid=1000\n"
+                "[global]\n"
+                "umask=0077\n");
+  suPHP::File file(path);
+  suPHP::Configuration config;
+  config.readFromFile(file);
+  config.compileOverrides();
+
+  // Changed files take effect when they are compiled again
+  writeOverride("user.conf",
+                "[match]\n"
+                "uid=1000\n"
+                "[global]\n"
+                "umask=0007\n");
+  suPHP::Configuration stale;
+  apply(stale, 1000, "");
+  ASSERT_EQ(077, stale.getUmask());
+  config.compileOverrides();
+  suPHP::Configuration current;
+  apply(current, 1000, "");
+  ASSERT_EQ(07, current.getUmask());
+
+  // An index others could write is refused
+  chmod(index.c_str(), 0666);
+  suPHP::Configuration writeable;
+  EXPECT_THROW(apply(writeable, 1000, ""), suPHP::SecurityException);
+}
+}  // namespace
@@ -0,0 +1,50 @@
+#include <map>
+#include <string>
+#include "gtest/gtest.h"
+
+#include "IOException.hpp"
+#include "IndexFile.hpp"
+#include "TemporaryFileTest.hpp"
+#include "Util.hpp"
+
+namespace {
+
+class IndexFileTest : public suPHP::TemporaryFileTest {
+ protected:
+  IndexFileTest() : TemporaryFileTest("indexfile") {}
+};
+
+TEST_F(IndexFileTest, LookupAfterWrite) {
+  std::map<std::string, std::string> records;
+  for (int i = 0; i < 500; i++) {
+    records["uid:" + suPHP::Util::intToStr(1000 + i)] = "value " + suPHP::Util::intToStr(i);
+  }
+  records["docroot:/home/foo/public_html"] = "";
+  suPHP::File file(path);
+  suPHP::IndexFile::write(file, records);
+
+  suPHP::IndexFile index(file);
+  std::string value;
+  ASSERT_TRUE(index.lookup("uid:1000", value));
+  ASSERT_EQ("value 0", value);
+  ASSERT_TRUE(index.lookup("uid:1499", value));
+  ASSERT_EQ("value 499", value);
+  ASSERT_TRUE(index.lookup("docroot:/home/foo/public_html", value));
+  ASSERT_EQ("", value);
+  ASSERT_FALSE(index.lookup("uid:1500", value));
+  ASSERT_FALSE(index.lookup("docroot:/home/foo", value));
+}
+
+TEST_F(IndexFileTest, EmptyIndex) {
+  suPHP::File file(path);
+  suPHP::IndexFile::write(file, std::map<std::string, std::string>());
+  suPHP::IndexFile index(file);
+  std::string value;
+  ASSERT_FALSE(index.lookup("uid:0", value));
+}
+
+TEST_F(IndexFileTest, RejectsInvalidFile) {
+  suPHP::File file(path);
+  EXPECT_THROW(suPHP::IndexFile index(file), suPHP::IOException);
+}
+}  // namespace
@@ -0,0 +1,127 @@
+#include <fstream>
+#include <string>
+#include "gtest/gtest.h"
+
+#include "IniFile.hpp"
+#include "ParsingException.hpp"
+#include "TemporaryFileTest.hpp"
+
+namespace {
+
+class IniFileTest : public suPHP::TemporaryFileTest {
+ protected:
+  IniFileTest() : TemporaryFileTest("inifile") {}
+
+  void parse(const std::string& content) {
+    std::ofstream out(path.c_str(), std::ios::trunc);
+    out << content;
+    out.close();
+    ini.parse(suPHP::File(path));
+  }
+
+  suPHP::IniFile ini;
+};
+
+TEST_F(IniFileTest, SectionsAndKeys) {
+  parse(
+      "; comment\n"
+      "[global]\n"
+      "  key = value  \n"
+      "other=1\n"
+      "\n"
+      "[handlers]\n"
+      "x-httpd-php=\"php:/usr/bin/php\"\n"
+      "[global]\n"
+      "last=yes");
+  ASSERT_TRUE(ini.hasSection("global"));
+  ASSERT_TRUE(ini.hasSection("handlers"));
+  ASSERT_FALSE(ini.hasSection("phprc_paths"));
+  ASSERT_EQ(2u, ini.getSections().size());
+  const suPHP::IniSection& global = ini.getSection("global");
+  ASSERT_EQ(3u, global.getKeys().size());
+  ASSERT_EQ("key", global.getKeys()[0].str());
+  ASSERT_EQ("value", global.getValue("key").str());
+  ASSERT_EQ("1", global.getValue("other").str());
+  ASSERT_EQ("yes", global.getValue("last").str());
+  ASSERT_EQ("php:/usr/bin/php",
+            ini["handlers"].getValue("x-httpd-php").str());
+  ASSERT_FALSE(global.hasKey("missing"));
+  EXPECT_THROW(global.getValues("missing"), suPHP::KeyNotFoundException);
+  EXPECT_THROW(ini.getSection("missing"), suPHP::KeyNotFoundException);
+}
+
+TEST_F(IniFileTest, MultipleValues) {
+  parse(
+      "[global]\n"
+      "docroot=/var/www:${HOME}/public_html\n"
+      "docroot+=/srv/\\\\*\n"
+      "env_path=/bin\\:/usr/bin\n"
+      "replaced=a:b\n"
+      "replaced=c\n");
+  const suPHP::IniSection& global = ini.getSection("global");
+  const std::vector<suPHP::StringView>& docroots = global.getValues("docroot");
+  ASSERT_EQ(3u, docroots.size());
+  ASSERT_EQ("/var/www", docroots[0].str());
+  ASSERT_EQ("${HOME}/public_html", docroots[1].str());
+  ASSERT_EQ("/srv/\\*", docroots[2].str());
+  ASSERT_EQ("/bin:/usr/bin", global.getValue("env_path").str());
+  ASSERT_EQ(1u, global.getValues("replaced").size());
+  ASSERT_EQ("c", global.getValue("replaced").str());
+}
+
+TEST_F(IniFileTest, QuotesAndEscapes) {
+  parse(
+      "[global]\n"
+      "quoted=\" padded \"\n"
+      "escaped=a\\\"b\\\\c\n"
+      "spaced=  value\n");
+  const suPHP::IniSection& global = ini.getSection("global");
+  ASSERT_EQ(" padded ", global.getValue("quoted").str());
+  ASSERT_EQ("a\"b\\c", global.getValue("escaped").str());
+  ASSERT_EQ("value", global.getValue("spaced").str());
+}
+
+TEST_F(IniFileTest, EscapeValueRoundTrip) {
+  std::string value = " a:b\\c\"d ";
+  parse("[global]\nkey=" + suPHP::IniFile::escapeValue(value) + "\n");
+  ASSERT_EQ(value, ini.getSection("global").getValue("key").str());
+}
+
+TEST_F(IniFileTest, MalformedLines) {
+  EXPECT_THROW(parse("key=value\n"), suPHP::ParsingException);
+  EXPECT_THROW(parse("[global]\nnovalue\n"), suPHP::ParsingException);
+  EXPECT_THROW(parse("[global]\nkey=\n"), suPHP::ParsingException);
+  EXPECT_THROW(parse("[global]\n=value\n"), suPHP::ParsingException);
+  EXPECT_THROW(parse("[global]\nkey=a::b\n"), suPHP::ParsingException);
+  EXPECT_THROW(parse("[global]\nkey=\"open\n"), suPHP::ParsingException);
+  EXPECT_THROW(parse("[global]\nkey=a\\b\n"), suPHP::ParsingException);
+  EXPECT_THROW(parse("[global]\nkey=x\"y\"\n"), suPHP::ParsingException);
+  EXPECT_THROW(parse("[global]\nkey=value\\\n"), suPHP::ParsingException);
+}
+TEST_F(IniFileTest, LazySections) {
+  std::ofstream out(path.c_str(), std::ios::trunc);
+  out << "[global]\n"
+         "key=value\n"
+         "[handlers]\n"
+         "good=\"php:/usr/bin/php\"\n"
+         "list=a:b\n"
+         "list+=c\n"
+         "bad=\"unended\n";
+  out.close();
+  ini.parse(suPHP::File(path), std::vector<std::string>(1, "handlers"));
+  ASSERT_EQ("value", ini["global"].getValue("key").str());
+  const suPHP::IniSection& handlers = ini["handlers"];
+  ASSERT_EQ(3u, handlers.getKeys().size());
+  std::vector<std::string> values = ini.decodeValues(handlers, "good");
+  ASSERT_EQ(1u, values.size());
+  ASSERT_EQ("php:/usr/bin/php", values[0]);
+  values = ini.decodeValues(handlers, "list");
+  ASSERT_EQ(3u, values.size());
+  ASSERT_EQ("c", values[2]);
+  EXPECT_THROW(ini.decodeValues(handlers, "bad"), suPHP::ParsingException);
+  EXPECT_THROW(ini.decodeValues(handlers, "missing"),
+               suPHP::KeyNotFoundException);
+  values = ini.decodeValues(ini["global"], "key");
+  ASSERT_EQ("value", values[0]);
+}
+}  // namespace
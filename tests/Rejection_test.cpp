@@ -0,0 +1,50 @@
+#include <string>
+#include "gtest/gtest.h"
+
+#include "Rejection.hpp"
+#include "SoftException.hpp"
+
+namespace {
+
+TEST(RejectionTest, FormatsMessage) {
+  suPHP::Rejection rejection(suPHP::REJECT_UID_MISMATCH, "/var/www/a.php", "",
+                             1000, 1001);
+  ASSERT_EQ(suPHP::REJECT_UID_MISMATCH, rejection.getReason());
+  ASSERT_TRUE(rejection.isRejected());
+  ASSERT_FALSE(suPHP::Rejection().isRejected());
+  ASSERT_EQ(
+      "Mismatch between target UID (1000) and UID (1001) of file "
+      "\"/var/www/a.php\"",
+      rejection.getMessage());
+  ASSERT_STREQ("uid_mismatch",
+               suPHP::Rejection::getReasonName(suPHP::REJECT_UID_MISMATCH));
+  ASSERT_STREQ("script_changed",
+               suPHP::Rejection::getReasonName(suPHP::REJECT_SCRIPT_CHANGED));
+}
+
+TEST(RejectionTest, LooksUpOwnerForMessage) {
+  suPHP::Rejection root(suPHP::REJECT_DIRECTORY_OWNER, "/var/www", "", 0);
+  ASSERT_EQ("Directory /var/www is not owned by root", root.getMessage());
+
+  // A UID without passwd entry does not make formatting fail
+  suPHP::Rejection orphan(suPHP::REJECT_DIRECTORY_OWNER, "/var/www", "",
+                          424242);
+  ASSERT_EQ("Directory /var/www is not owned by #424242",
+            orphan.getMessage());
+}
+
+TEST(RejectionTest, SoftExceptionCarriesReason) {
+  suPHP::SoftException rejected(
+      suPHP::Rejection(suPHP::REJECT_NOT_IN_DOCROOT, "/tmp/a.php"), __FILE__,
+      __LINE__);
+  ASSERT_EQ(suPHP::REJECT_NOT_IN_DOCROOT, rejected.getReason());
+  ASSERT_EQ("Script \"/tmp/a.php\" not within configured docroot",
+            rejected.getMessage());
+  ASSERT_NE(std::string::npos,
+            rejected.toString().find("not within configured docroot"));
+
+  suPHP::SoftException other("Other problem", __FILE__, __LINE__);
+  ASSERT_EQ(suPHP::REJECT_NONE, other.getReason());
+  ASSERT_EQ("Other problem", other.getMessage());
+}
+}  // namespace
@@ -0,0 +1,115 @@
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <map>
+#include <string>
+#include "gtest/gtest.h"
+
+#include "Configuration.hpp"
+#include "IndexFile.hpp"
+#include "ScriptIndex.hpp"
+#include "WatchState.hpp"
+
+namespace {
+
+class ScriptIndexTest : public ::testing::Test {
+ protected:
+  ScriptIndexTest()
+      : root("/tmp/suphp-scriptindex-test.XXXXXX"), path(), owner(getuid()) {
+    mkdtemp(&root[0]);
+    path = root + "/scripts.idx";
+    mkdir((root + "/www").c_str(), 0755);
+  }
+  ~ScriptIndexTest() {
+    unlink(path.c_str());
+    rmdir((root + "/www").c_str());
+    rmdir(root.c_str());
+  }
+
+  // Writes the index as "suphp --index" does for directory
+  void write(const suPHP::File& directory) {
+    std::map<std::string, std::string> records;
+    records[suPHP::ScriptIndex::getKey(directory, owner, config)] =
+        suPHP::ScriptIndex::getChain(directory);
+    suPHP::IndexFile::write(suPHP::File(path), records);
+  }
+
+  std::string root;
+  std::string path;
+  suPHP::UserInfo owner;
+  suPHP::Configuration config;
+};
+
+TEST_F(ScriptIndexTest, FindsUnchangedDirectories) {
+  suPHP::File directory(root + "/www");
+  write(directory);
+
+  suPHP::ScriptIndex index;
+  ASSERT_FALSE(index.contains(directory, owner, config));
+  index.open(suPHP::File(path));
+  ASSERT_TRUE(index.contains(directory, owner, config));
+  ASSERT_FALSE(index.contains(suPHP::File(root), owner, config));
+  ASSERT_FALSE(
+      index.contains(directory, suPHP::UserInfo(getuid() + 1), config));
+}
+
+TEST_F(ScriptIndexTest, IgnoresChangedDirectories) {
+  suPHP::File directory(root + "/www");
+  write(directory);
+  suPHP::ScriptIndex index;
+  index.open(suPHP::File(path));
+
+  // Adding files does not change what is checked
+  std::string script = root + "/www/index.php";
+  close(creat(script.c_str(), 0644));
+  unlink(script.c_str());
+  ASSERT_TRUE(index.contains(directory, owner, config));
+
+  chmod(root.c_str(), 0770);
+  ASSERT_FALSE(index.contains(directory, owner, config));
+  chmod(root.c_str(), 0700);
+  ASSERT_TRUE(index.contains(directory, owner, config));
+
+  // A directory put in place of the checked one is not found
+  rename((root + "/www").c_str(), (root + "/old").c_str());
+  mkdir((root + "/www").c_str(), 0755);
+  ASSERT_FALSE(index.contains(directory, owner, config));
+  rmdir((root + "/old").c_str());
+}
+
+TEST_F(ScriptIndexTest, TrustsWatchedDirectories) {
+  suPHP::File directory(root + "/www");
+  suPHP::File state(root + "/state");
+  write(directory);
+  suPHP::WatchState daemon;
+  daemon.create(state, std::vector<suPHP::File>(1, suPHP::File(root)));
+  suPHP::ScriptIndex index;
+  index.open(suPHP::File(path));
+  index.watch(state);
+
+  // Not trusted before the daemon watches the directories
+  ASSERT_TRUE(index.contains(directory, owner, config));
+  chmod(root.c_str(), 0770);
+  ASSERT_FALSE(index.contains(directory, owner, config));
+  chmod(root.c_str(), 0700);
+
+  // Verified once, then trusted until the daemon notices a change
+  daemon.beat();
+  ASSERT_TRUE(index.contains(directory, owner, config));
+  chmod(root.c_str(), 0770);
+  ASSERT_TRUE(index.contains(directory, owner, config));
+  daemon.invalidate();
+  ASSERT_FALSE(index.contains(directory, owner, config));
+  chmod(root.c_str(), 0700);
+  ASSERT_TRUE(index.contains(directory, owner, config));
+
+  daemon.stop();
+  chmod(root.c_str(), 0770);
+  ASSERT_FALSE(index.contains(directory, owner, config));
+  chmod(root.c_str(), 0700);
+  unlink(state.getPath().c_str());
+}
+}  // namespace
@@ -0,0 +1,130 @@
+#include <string.h>
+
+#include <string>
+#include "gtest/gtest.h"
+
+#include "IOException.hpp"
+#include "StageStatistics.hpp"
+#include "TemporaryFileTest.hpp"
+
+namespace {
+
+class StageStatisticsTest : public suPHP::TemporaryFileTest {
+ protected:
+  StageStatisticsTest() : TemporaryFileTest("stagestatistics") {}
+
+  // Writes the file as mod_suphp creates it
+  void create(const suPHP::StageStatistics::Segment& segment) {
+    FILE* file = fopen(path.c_str(), "w");
+    fwrite(&segment, sizeof(segment), 1, file);
+    fclose(file);
+  }
+
+  void read(suPHP::StageStatistics::Segment& segment) {
+    FILE* file = fopen(path.c_str(), "r");
+    ASSERT_EQ(1u, fread(&segment, sizeof(segment), 1, file));
+    fclose(file);
+  }
+};
+
+TEST(StageStatisticsBuckets, BucketsCoverValues) {
+  for (uint64_t value = 0; value < 100000; value++) {
+    int bucket = suPHP::StageStatistics::getBucket(value);
+    ASSERT_LE(suPHP::StageStatistics::getBucketStart(bucket), value);
+    ASSERT_GT(suPHP::StageStatistics::getBucketStart(bucket + 1), value);
+  }
+  ASSERT_EQ(31, suPHP::StageStatistics::getBucket(31));
+  ASSERT_EQ(32, suPHP::StageStatistics::getBucket(32));
+  ASSERT_EQ(32, suPHP::StageStatistics::getBucket(33));
+  ASSERT_EQ(suPHP::StageStatistics::BUCKETS - 1,
+            suPHP::StageStatistics::getBucket(UINT64_MAX));
+}
+
+TEST_F(StageStatisticsTest, RecordsIntoFile) {
+  suPHP::StageStatistics::Segment segment;
+  memset(&segment, 0, sizeof(segment));
+  segment.magic = suPHP::StageStatistics::MAGIC;
+  segment.version = suPHP::StageStatistics::FORMAT_VERSION;
+  segment.stages = suPHP::STAGES;
+  segment.buckets = suPHP::StageStatistics::BUCKETS;
+  create(segment);
+
+  {
+    suPHP::StageStatistics statistics;
+    statistics.attach(suPHP::File(path));
+    statistics.record(suPHP::STAGE_VALIDATION, 40);
+    statistics.record(suPHP::STAGE_VALIDATION, 1000);
+    statistics.endStage(suPHP::STAGE_EXEC);
+  }
+
+  read(segment);
+  const suPHP::StageStatistics::Histogram& validation =
+      segment.histograms[suPHP::STAGE_VALIDATION];
+  ASSERT_EQ(2u, validation.count);
+  ASSERT_EQ(1040u, validation.sum);
+  ASSERT_EQ(1000u, validation.max);
+  ASSERT_EQ(1u, validation.buckets[suPHP::StageStatistics::getBucket(40)]);
+  ASSERT_EQ(1u, validation.buckets[suPHP::StageStatistics::getBucket(1000)]);
+  ASSERT_EQ(1u, segment.histograms[suPHP::STAGE_EXEC].count);
+  ASSERT_EQ(0u, segment.histograms[suPHP::STAGE_CONFIG].count);
+}
+
+TEST_F(StageStatisticsTest, PublishesPolicy) {
+  suPHP::StageStatistics::Segment segment;
+  memset(&segment, 0, sizeof(segment));
+  segment.magic = suPHP::StageStatistics::MAGIC;
+  segment.version = suPHP::StageStatistics::FORMAT_VERSION;
+  segment.stages = suPHP::STAGES;
+  segment.buckets = suPHP::StageStatistics::BUCKETS;
+  create(segment);
+
+  suPHP::FileIdentity identity = {1, 2, 3, 4, 5};
+  {
+    suPHP::StageStatistics statistics;
+    statistics.attach(suPHP::File(path));
+    statistics.publishPolicy(
+        "/etc/suphp.conf", identity,
+        suPHP::StageStatistics::POLICY_DENY_FILE_OTHERS_WRITEABLE);
+  }
+
+  read(segment);
+  const suPHP::StageStatistics::Policy& policy = segment.policy;
+  ASSERT_EQ(2u, policy.seq);
+  ASSERT_EQ(
+      static_cast<uint32_t>(
+          suPHP::StageStatistics::POLICY_DENY_FILE_OTHERS_WRITEABLE),
+      policy.flags);
+  ASSERT_EQ(2u, policy.inode);
+  ASSERT_EQ(5, policy.size);
+  ASSERT_STREQ("/etc/suphp.conf", policy.config);
+
+  // The same policy is not written again
+  {
+    suPHP::StageStatistics statistics;
+    statistics.attach(suPHP::File(path));
+    statistics.publishPolicy(
+        "/etc/suphp.conf", identity,
+        suPHP::StageStatistics::POLICY_DENY_FILE_OTHERS_WRITEABLE);
+    read(segment);
+    ASSERT_EQ(2u, segment.policy.seq);
+    statistics.publishPolicy("/etc/suphp.conf", identity, 0);
+  }
+
+  read(segment);
+  ASSERT_EQ(4u, segment.policy.seq);
+  ASSERT_EQ(0u, segment.policy.flags);
+}
+
+TEST_F(StageStatisticsTest, RejectsOtherFiles) {
+  suPHP::StageStatistics statistics;
+  EXPECT_THROW(statistics.attach(suPHP::File(path)), suPHP::IOException);
+
+  suPHP::StageStatistics::Segment segment;
+  memset(&segment, 0, sizeof(segment));
+  create(segment);
+  EXPECT_THROW(statistics.attach(suPHP::File(path)), suPHP::IOException);
+
+  // Nothing is recorded without a file
+  statistics.record(suPHP::STAGE_CONFIG, 10);
+}
+}  // namespace
@@ -0,0 +1,32 @@
+#ifndef SUPHP_TEMPORARYFILETEST_H
+#define SUPHP_TEMPORARYFILETEST_H
+
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <string>
+#include "gtest/gtest.h"
+
+namespace suPHP {
+
+/**
+ * Fixture providing an empty file in /tmp, removed after the test
+ */
+class TemporaryFileTest : public ::testing::Test {
+ protected:
+  /**
+   * Creates the file, name is part of its path
+   */
+  explicit TemporaryFileTest(const std::string& name)
+      : path("/tmp/suphp-" + name + "-test.XXXXXX") {
+    int fd = mkstemp(&path[0]);
+    close(fd);
+  }
+
+  ~TemporaryFileTest() { unlink(path.c_str()); }
+
+  std::string path;
+};
+}  // namespace suPHP
+
+#endif  // SUPHP_TEMPORARYFILETEST_H
@@ -0,0 +1,140 @@
+#include <fcntl.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <mutex>
+#include <set>
+#include <string>
+#include "gtest/gtest.h"
+
+#include "LookupException.hpp"
+#include "TreeWalker.hpp"
+#include "Util.hpp"
+
+namespace {
+
+class RecordingVisitor : public suPHP::TreeVisitor {
+ public:
+  virtual void visitDirectory(const suPHP::File& directory,
+                              const std::vector<suPHP::File>& files,
+                              const std::vector<suPHP::File>& subdirectories) {
+    std::lock_guard<std::mutex> lock(mutex);
+    directories.insert(directory.getPath());
+    if (announced.count(directory.getPath()) == 0) {
+      unannounced.insert(directory.getPath());
+    }
+    for (std::vector<suPHP::File>::const_iterator i = files.begin();
+         i != files.end(); i++) {
+      this->files.insert(i->getPath());
+    }
+    for (std::vector<suPHP::File>::const_iterator i = subdirectories.begin();
+         i != subdirectories.end(); i++) {
+      announced.insert(i->getPath());
+    }
+  }
+
+  virtual void visitError(const suPHP::File& directory, suPHP::Exception& e) {
+    std::lock_guard<std::mutex> lock(mutex);
+    errors.insert(directory.getPath());
+  }
+
+  std::mutex mutex;
+  std::set<std::string> directories;
+  std::set<std::string> files;
+  std::set<std::string> errors;
+  // Directories passed as subdirectories, visited without being passed
+  std::set<std::string> announced;
+  std::set<std::string> unannounced;
+};
+
+// Fails on one directory, like a visitor looking up an unknown owner
+class FailingVisitor : public RecordingVisitor {
+ public:
+  explicit FailingVisitor(const std::string& path) : path(path) {}
+
+  virtual void visitDirectory(const suPHP::File& directory,
+                              const std::vector<suPHP::File>& files,
+                              const std::vector<suPHP::File>& subdirectories) {
+    RecordingVisitor::visitDirectory(directory, files, subdirectories);
+    if (directory.getPath() == path) {
+      throw suPHP::LookupException("No user with UID 4242", __FILE__,
+                                   __LINE__);
+    }
+  }
+
+  std::string path;
+};
+
+class TreeWalkerTest : public ::testing::Test {
+ protected:
+  TreeWalkerTest() : root("/tmp/suphp-treewalker-test.XXXXXX") {
+    mkdtemp(&root[0]);
+    for (int i = 0; i < 10; i++) {
+      std::string directory = root + "/" + suPHP::Util::intToStr(i);
+      mkdir(directory.c_str(), 0755);
+      mkdir((directory + "/sub").c_str(), 0755);
+      close(creat((directory + "/sub/index.php").c_str(), 0644));
+    }
+    symlink(root.c_str(), (root + "/loop").c_str());
+  }
+  ~TreeWalkerTest() {
+    for (int i = 0; i < 10; i++) {
+      std::string directory = root + "/" + suPHP::Util::intToStr(i);
+      unlink((directory + "/sub/index.php").c_str());
+      rmdir((directory + "/sub").c_str());
+      rmdir(directory.c_str());
+    }
+    unlink((root + "/loop").c_str());
+    rmdir(root.c_str());
+  }
+  std::string root;
+};
+
+TEST_F(TreeWalkerTest, VisitsEveryDirectoryOnce) {
+  RecordingVisitor visitor;
+  std::vector<suPHP::File> roots(1, suPHP::File(root));
+  suPHP::TreeWalker(visitor).walk(roots, 4);
+
+  // The root, ten directories and their subdirectories, the symlink is
+  // not followed
+  ASSERT_EQ(21u, visitor.directories.size());
+  ASSERT_EQ(10u, visitor.files.size());
+  ASSERT_EQ(1u, visitor.files.count(root + "/9/sub/index.php"));
+  ASSERT_TRUE(visitor.errors.empty());
+
+  // Subdirectories are passed to the visitor before they are visited
+  ASSERT_EQ(20u, visitor.announced.size());
+  ASSERT_EQ(1u, visitor.unannounced.size());
+  ASSERT_EQ(1u, visitor.unannounced.count(root));
+}
+
+TEST_F(TreeWalkerTest, SharesDirectoriesOfSeveralRoots) {
+  RecordingVisitor visitor;
+  std::vector<suPHP::File> roots;
+  roots.push_back(suPHP::File(root + "/0"));
+  roots.push_back(suPHP::File(root + "/1/sub"));
+
+  // More threads than directories, most of them never find one
+  suPHP::TreeWalker(visitor).walk(roots, 16);
+  ASSERT_EQ(3u, visitor.directories.size());
+  ASSERT_EQ(2u, visitor.files.size());
+}
+
+TEST_F(TreeWalkerTest, ContinuesAfterErrorsOfTheVisitor) {
+  FailingVisitor visitor(root + "/3");
+  std::vector<suPHP::File> roots(1, suPHP::File(root));
+  suPHP::TreeWalker(visitor).walk(roots, 4);
+  ASSERT_EQ(21u, visitor.directories.size());
+  ASSERT_EQ(1u, visitor.errors.size());
+  ASSERT_EQ(1u, visitor.errors.count(root + "/3"));
+}
+
+TEST_F(TreeWalkerTest, ReportsUnreadableDirectories) {
+  RecordingVisitor visitor;
+  std::vector<suPHP::File> roots(1, suPHP::File(root + "/missing"));
+  suPHP::TreeWalker(visitor).walk(roots, 2);
+  ASSERT_TRUE(visitor.directories.empty());
+  ASSERT_EQ(1u, visitor.errors.size());
+}
+}  // namespace
@@ -0,0 +1,76 @@
+#include <string.h>
+
+#include <string>
+#include <vector>
+#include "gtest/gtest.h"
+
+#include "IOException.hpp"
+#include "TemporaryFileTest.hpp"
+#include "WatchState.hpp"
+
+namespace {
+
+class WatchStateTest : public suPHP::TemporaryFileTest {
+ protected:
+  WatchStateTest() : TemporaryFileTest("watchstate"), roots() {
+    roots.push_back(suPHP::File("/srv/www"));
+    roots.push_back(suPHP::File("/home"));
+  }
+
+  std::vector<suPHP::File> roots;
+};
+
+TEST_F(WatchStateTest, WatchesRootsWhileAlive) {
+  suPHP::WatchState daemon;
+  daemon.create(suPHP::File(path), roots);
+  suPHP::WatchState state;
+  state.attach(suPHP::File(path));
+
+  uint64_t epoch = 0;
+  ASSERT_FALSE(state.isWatched(suPHP::File("/srv/www"), epoch));
+  daemon.beat();
+  ASSERT_TRUE(state.isWatched(suPHP::File("/srv/www"), epoch));
+  ASSERT_TRUE(state.isWatched(suPHP::File("/home/user/public_html"), epoch));
+  ASSERT_FALSE(state.isWatched(suPHP::File("/srv/www2"), epoch));
+  ASSERT_FALSE(state.isWatched(suPHP::File("/srv"), epoch));
+
+  daemon.stop();
+  ASSERT_FALSE(state.isWatched(suPHP::File("/srv/www"), epoch));
+}
+
+TEST_F(WatchStateTest, ForgetsKeysOfPreviousEpochs) {
+  suPHP::WatchState daemon;
+  daemon.create(suPHP::File(path), roots);
+  daemon.beat();
+  suPHP::WatchState state;
+  state.attach(suPHP::File(path));
+
+  uint64_t epoch = 0;
+  ASSERT_TRUE(state.isWatched(suPHP::File("/srv/www"), epoch));
+  ASSERT_FALSE(state.isVerified("--:1000:/srv/www", epoch));
+  state.setVerified("--:1000:/srv/www", epoch);
+  ASSERT_TRUE(state.isVerified("--:1000:/srv/www", epoch));
+  ASSERT_FALSE(state.isVerified("--:1001:/srv/www", epoch));
+
+  daemon.invalidate();
+  uint64_t next = 0;
+  ASSERT_TRUE(state.isWatched(suPHP::File("/srv/www"), next));
+  ASSERT_NE(epoch, next);
+  ASSERT_FALSE(state.isVerified("--:1000:/srv/www", next));
+
+  // Keys too long for a slot are never trusted
+  std::string key(suPHP::WatchState::KEY_LENGTH + 1, 'x');
+  state.setVerified(key, next);
+  ASSERT_FALSE(state.isVerified(key, next));
+}
+
+TEST_F(WatchStateTest, RejectsOtherFiles) {
+  suPHP::WatchState state;
+  EXPECT_THROW(state.attach(suPHP::File(path)), suPHP::IOException);
+
+  // Nothing is watched without a file
+  uint64_t epoch = 0;
+  ASSERT_FALSE(state.isWatched(suPHP::File("/srv/www"), epoch));
+  state.setVerified("--:1000:/srv/www", epoch);
+}
+}  // namespace